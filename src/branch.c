@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include "branch.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include "snapshot.h"
+#include <windows.h>
+#else
+#include "log.h"
+#include "pool.h"
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+static void clear_results(double *results, int n) {
+  for (int i = 0; i < n; i++) {
+    results[i] = NAN;
+  }
+}
+
+#ifdef _WIN32
+
+/* -------------
+ * SNAPSHOT COPIES
+ *
+ * The snapshot goes to a file of its own in the temp directory, made by
+ * GetTempFileName() so nothing already there is overwritten.
+ * ------------- */
+
+bool run_branches(GameState *gs, int n, BranchTask task, void *ctx,
+                  double *results, int n_results, int max_running) {
+  (void)max_running;
+  clear_results(results, n * n_results);
+
+  char dir[MAX_PATH];
+  char path[MAX_PATH];
+  DWORD length = GetTempPathA(sizeof(dir), dir);
+  if (length == 0 || length > sizeof(dir) ||
+      GetTempFileNameA(dir, "brn", 0, path) == 0) {
+    printf("ERROR: Couldn't make a temporary file for branching\n");
+    return false;
+  }
+  if (!save_snapshot(gs, path)) {
+    remove(path);
+    return false;
+  }
+
+  bool ok = true;
+  for (int b = 0; b < n; b++) {
+    GameState *copy = load_snapshot(path);
+    if (!copy) {
+      ok = false;
+      continue;
+    }
+    task(copy, b, ctx, &results[b * n_results]);
+    free_game(copy);
+  }
+
+  remove(path);
+  return ok;
+}
+
+#else
+
+/* -------------
+ * FORKED BRANCHES
+ *
+ * Each branch writes its results back up a pipe of its own as raw
+ * doubles, since both ends are the same program on the same machine.
+ * Branches are collected oldest first; one still running just blocks
+ * on its pipe until its turn.
+ * ------------- */
+
+typedef struct Branch {
+  pid_t pid;
+  int fd;
+} Branch;
+
+static bool write_all(int fd, const void *data, size_t size) {
+  const char *p = data;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *data, size_t size) {
+  char *p = data;
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// The branch's side of the fork. Only the forking thread comes across,
+// so the pool and the log carry on without their threads, and _exit()
+// skips the atexit handlers that would try to join them.
+static void run_branch(GameState *gs, int b, BranchTask task, void *ctx,
+                       int n_results, int fd) {
+  pool_after_fork();
+  log_after_fork();
+
+  double *result = malloc(n_results * sizeof(double));
+  if (!result)
+    _exit(1);
+  clear_results(result, n_results);
+  task(gs, b, ctx, result);
+
+  fflush(stdout);
+  _exit(write_all(fd, result, n_results * sizeof(double)) ? 0 : 1);
+}
+
+static bool start_branch(GameState *gs, int b, BranchTask task, void *ctx,
+                         int n_results, Branch *out) {
+  int fds[2];
+  if (pipe(fds) != 0)
+    return false;
+
+  // Anything still buffered would be written again by the branch.
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    run_branch(gs, b, task, ctx, n_results, fds[1]);
+  }
+
+  close(fds[1]);
+  *out = (Branch){pid, fds[0]};
+  return true;
+}
+
+static bool finish_branch(Branch *branch, double *result, int n_results) {
+  bool ok = read_all(branch->fd, result, n_results * sizeof(double));
+  close(branch->fd);
+
+  int status;
+  while (waitpid(branch->pid, &status, 0) < 0) {
+    if (errno != EINTR)
+      return false;
+  }
+  return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool run_branches(GameState *gs, int n, BranchTask task, void *ctx,
+                  double *results, int n_results, int max_running) {
+  clear_results(results, n * n_results);
+  if (max_running < 1)
+    max_running = 1;
+
+  Branch *branches = malloc(n * sizeof(Branch));
+  bool *started = calloc(n, sizeof(bool));
+  if (!branches || !started) {
+    printf("ERROR: Couldn't allocate %d branches\n", n);
+    exit(1);
+  }
+
+  bool ok = true;
+  int next = 0;
+  for (int b = 0; b < n; b++) {
+    while (next < n && next < b + max_running) {
+      started[next] = start_branch(gs, next, task, ctx, n_results,
+                                   &branches[next]);
+      next++;
+    }
+
+    double *result = &results[b * n_results];
+    if (!started[b] || !finish_branch(&branches[b], result, n_results)) {
+      printf("ERROR: Branch %d didn't finish\n", b);
+      clear_results(result, n_results);
+      ok = false;
+    }
+  }
+
+  free(branches);
+  free(started);
+  return ok;
+}
+
+#endif
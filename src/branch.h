@@ -0,0 +1,29 @@
+#ifndef BRANCH_H
+#define BRANCH_H
+
+#include "game.h"
+
+// What-if branching from a live game. Each branch starts as a copy of
+// the game as it stands, gets its own tweak (another worker, a moved
+// stockpile) and runs on from there, and the copy is thrown away once
+// it reports back.
+//
+// Branches are forked processes, so the copy is the kernel's
+// copy-on-write of the whole address space: only the pages a branch
+// actually writes to are duplicated, and however big the floor is,
+// starting a branch costs about the same. Without fork() (on Windows)
+// each branch loads a snapshot of the game instead, one at a time.
+
+// Run in each branch on its copy of the game. Fills in the branch's
+// results, which start out NaN.
+typedef void (*BranchTask)(GameState *gs, int branch, void *ctx,
+                           double *result);
+
+// Runs `task` in `n` branches of `gs`, up to `max_running` at once.
+// Branch b's results go to results[b * n_results] onwards. `gs` itself
+// is left as it was. Returns false, with a message, if any branch
+// didn't report back, in which case its results are left NaN.
+bool run_branches(GameState *gs, int n, BranchTask task, void *ctx,
+                  double *results, int n_results, int max_running);
+
+#endif
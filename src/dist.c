@@ -0,0 +1,254 @@
+#include "dist.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* -------------
+ * PROBABILITIES
+ *
+ * Each shape is turned into the chance of every whole outcome in
+ * [min, max]. Continuous shapes are rounded to the nearest tick, so
+ * outcome k gets the mass between k - 0.5 and k + 0.5.
+ * ------------- */
+
+static double triangular_cdf(const Distribution *d, double x) {
+  double lo = d->a, hi = d->b, mode = d->c;
+  if (x <= lo)
+    return 0;
+  if (x >= hi)
+    return 1;
+  if (x <= mode)
+    return (x - lo) * (x - lo) / ((hi - lo) * (mode - lo));
+  return 1 - (hi - x) * (hi - x) / ((hi - lo) * (hi - mode));
+}
+
+static double lognormal_cdf(const Distribution *d, double x) {
+  if (x <= 0)
+    return 0;
+  return 0.5 * erfc(-(log(x) - d->a) / (d->b * sqrt(2.0)));
+}
+
+static double binomial_pmf(int trials, double p, int k) {
+  return exp(lgamma(trials + 1.0) - lgamma(k + 1.0) -
+             lgamma(trials - k + 1.0) + k * log(p) +
+             (trials - k) * log1p(-p));
+}
+
+static int outcome_range(Distribution *d, int *max) {
+  double lo, hi;
+
+  switch (d->kind) {
+  case DIST_FIXED:
+    lo = hi = d->a;
+    break;
+  case DIST_UNIFORM:
+    lo = d->a;
+    hi = d->b;
+    break;
+  case DIST_TRIANGULAR:
+    if (d->b <= d->a) {
+      lo = hi = d->a;
+    } else {
+      lo = d->a;
+      hi = d->b;
+    }
+    break;
+  case DIST_LOGNORMAL:
+    // Eight standard deviations covers all but ~1e-15 of either tail.
+    lo = exp(d->a - 8 * d->b);
+    hi = exp(d->a + 8 * d->b);
+    break;
+  case DIST_EMPIRICAL:
+    if (d->c_values <= 0) {
+      printf("ERROR: Empirical distribution with no values\n");
+      exit(1);
+    }
+    lo = hi = d->values[0];
+    for (int i = 1; i < d->c_values; i++) {
+      if (d->values[i] < lo)
+        lo = d->values[i];
+      if (d->values[i] > hi)
+        hi = d->values[i];
+    }
+    break;
+  case DIST_BINOMIAL:
+    lo = 0;
+    hi = d->a;
+    if (d->b <= 0)
+      hi = 0;
+    if (d->b >= 1)
+      lo = d->a;
+    break;
+  default:
+    printf("ERROR: Unknown distribution kind %d\n", d->kind);
+    exit(1);
+  }
+
+  int min = (int)floor(lo + 0.5);
+  *max = (int)floor(hi + 0.5);
+  if (min < 0)
+    min = 0;
+  if (*max < min)
+    *max = min;
+  if (*max - min >= DIST_MAX_TICKS)
+    *max = min + DIST_MAX_TICKS - 1;
+  return min;
+}
+
+static void outcome_weights(const Distribution *d, int min, int n,
+                            double *weight) {
+  for (int i = 0; i < n; i++) {
+    weight[i] = 0;
+  }
+
+  switch (d->kind) {
+  case DIST_FIXED:
+    weight[0] = 1;
+    break;
+  case DIST_UNIFORM:
+    for (int i = 0; i < n; i++) {
+      weight[i] = 1;
+    }
+    break;
+  case DIST_TRIANGULAR:
+  case DIST_LOGNORMAL: {
+    double (*cdf)(const Distribution *, double) =
+        (d->kind == DIST_TRIANGULAR) ? triangular_cdf : lognormal_cdf;
+    if (d->kind == DIST_TRIANGULAR && d->b <= d->a) {
+      weight[0] = 1;
+      break;
+    }
+    // The first and last outcomes also take whatever is beyond them.
+    double below = 0;
+    for (int i = 0; i < n; i++) {
+      double upto = (i == n - 1) ? 1 : cdf(d, min + i + 0.5);
+      weight[i] = upto - below;
+      below = upto;
+    }
+  } break;
+  case DIST_EMPIRICAL:
+    for (int i = 0; i < d->c_values; i++) {
+      int k = d->values[i] - min;
+      if (k < 0)
+        k = 0;
+      if (k >= n)
+        k = n - 1;
+      weight[k] += d->weights[i];
+    }
+    break;
+  case DIST_BINOMIAL:
+    if (n == 1) {
+      weight[0] = 1;
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      weight[i] = binomial_pmf((int)d->a, d->b, min + i);
+    }
+    break;
+  }
+}
+
+/* -------------
+ * ALIAS TABLE
+ *
+ * Vose's version of Walker's method. Every outcome gets a bucket of
+ * equal width; outcomes under the average fill the rest of their bucket
+ * with part of one over the average.
+ * ------------- */
+
+void dist_compile(Distribution *d) {
+  dist_free(d);
+
+  int max;
+  int min = outcome_range(d, &max);
+  int n = max - min + 1;
+
+  d->min = min;
+  d->n = n;
+  if (n == 1)
+    return;
+
+  double *scaled = malloc(n * sizeof(double));
+  int *small = malloc(n * sizeof(int));
+  int *large = malloc(n * sizeof(int));
+  d->threshold = malloc(n * sizeof(uint64_t));
+  d->alias = malloc(n * sizeof(int));
+  if (!scaled || !small || !large || !d->threshold || !d->alias) {
+    printf("ERROR: Couldn't allocate alias table of %d outcomes\n", n);
+    exit(1);
+  }
+
+  outcome_weights(d, min, n, scaled);
+  double total = 0;
+  for (int i = 0; i < n; i++) {
+    if (scaled[i] < 0)
+      scaled[i] = 0;
+    total += scaled[i];
+  }
+  if (!(total > 0)) {
+    printf("ERROR: Distribution has no probability mass\n");
+    exit(1);
+  }
+
+  int c_small = 0, c_large = 0;
+  for (int i = 0; i < n; i++) {
+    scaled[i] *= n / total;
+    if (scaled[i] < 1)
+      small[c_small++] = i;
+    else
+      large[c_large++] = i;
+  }
+
+  while (c_small > 0 && c_large > 0) {
+    int s = small[--c_small];
+    int l = large[--c_large];
+    d->threshold[s] = (uint64_t)(scaled[s] * 4294967296.0);
+    d->alias[s] = l;
+
+    scaled[l] -= 1 - scaled[s];
+    if (scaled[l] < 1)
+      small[c_small++] = l;
+    else
+      large[c_large++] = l;
+  }
+  // Whatever is left is 1 up to rounding error.
+  while (c_large > 0) {
+    int l = large[--c_large];
+    d->threshold[l] = 4294967296ULL;
+    d->alias[l] = l;
+  }
+  while (c_small > 0) {
+    int s = small[--c_small];
+    d->threshold[s] = 4294967296ULL;
+    d->alias[s] = s;
+  }
+
+  free(scaled);
+  free(small);
+  free(large);
+}
+
+int dist_sample(const Distribution *d, Rng *r) {
+  if (d->n == 1)
+    return d->min;
+  return dist_pick(d, rng_next(r));
+}
+
+int dist_pick(const Distribution *d, uint64_t x) {
+  if (d->n == 0) {
+    printf("ERROR: Sampling a distribution that wasn't compiled\n");
+    exit(1);
+  }
+
+  // The high half picks the bucket, the low half picks within it.
+  int i = (int)(((x >> 32) * (uint64_t)d->n) >> 32);
+  return d->min + ((x & 0xffffffff) < d->threshold[i] ? i : d->alias[i]);
+}
+
+void dist_free(Distribution *d) {
+  free(d->threshold);
+  free(d->alias);
+  d->threshold = NULL;
+  d->alias = NULL;
+  d->n = 0;
+}
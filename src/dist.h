@@ -0,0 +1,55 @@
+#ifndef DIST_H
+#define DIST_H
+
+#include "rng.h"
+
+// Longest outcome a distribution can have, in ticks. Heavier tails are
+// cut off here, their mass going to the last tick.
+#define DIST_MAX_TICKS 65536
+
+enum DistKind {
+  DIST_FIXED,
+  DIST_UNIFORM,
+  DIST_TRIANGULAR,
+  DIST_LOGNORMAL,
+  DIST_EMPIRICAL,
+  DIST_BINOMIAL
+};
+
+// A whole number of ticks (or units) drawn from one of a few shapes:
+//
+//   DIST_FIXED       always `a`
+//   DIST_UNIFORM     the integers `a` to `b`, inclusive
+//   DIST_TRIANGULAR  min `a`, max `b`, mode `c`, rounded to a whole tick
+//   DIST_LOGNORMAL   exp(N(`a`, `b` squared)), rounded to a whole tick
+//   DIST_EMPIRICAL   `values[i]` with relative weight `weights[i]`
+//   DIST_BINOMIAL    successes in `a` trials of chance `b`
+//
+// Fill in the shape, then dist_compile() turns it into an alias table so
+// dist_sample() is one draw and one lookup, without allocating.
+typedef struct Distribution {
+  enum DistKind kind;
+  double a;
+  double b;
+  double c;
+  int c_values;
+  const int *values;
+  const double *weights;
+
+  // Built by dist_compile(). Outcome min + i is kept with chance
+  // threshold[i] / 2^32, otherwise it's min + alias[i].
+  int min;
+  int n;
+  uint64_t *threshold;
+  int *alias;
+} Distribution;
+
+void dist_compile(Distribution *d);
+int dist_sample(const Distribution *d, Rng *r);
+// The outcome a draw `x` from the stream lands on, for draws made in
+// lanes. A distribution with one outcome doesn't draw at all in
+// dist_sample(), so this is only for ones with more.
+int dist_pick(const Distribution *d, uint64_t x);
+void dist_free(Distribution *d);
+
+#endif
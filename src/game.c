@@ -1,4 +1,12 @@
 #include "game.h"
+#include "log.h"
+#include "pool.h"
+#include "profile.h"
+#include <pthread.h>
+#include <limits.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 
@@ -9,258 +17,438 @@
 // Job queue
 // ---------
 
-#define MAX_JOB_QUEUE 100
-
-struct JobQueueItem {
-  ObjectReference object;
-  enum Job job;
-} job_queue[MAX_JOB_QUEUE];
-
-void enqueue_job(ObjectReference o, enum Job job);
-bool jobs_on_queue(void);
-struct JobQueueItem pop_job(void);
+int job_priority(enum Job job);
+void enqueue_job(GameState *gs, ObjectReference o, enum Job job);
+bool jobs_on_queue(GameState *gs);
+struct JobQueueItem pop_job(GameState *gs);
 
 // Stockpiles
 // ----------
 
-Stockpile *get_stockpile_by_id(int id);
+Stockpile *get_stockpile_by_id(const GameState *gs, int id);
 
 typedef struct MaterialCount {
   ProductionMaterial material;
   int count;
 } MaterialCount;
 
-int add_stockpile(int x, int y, int w, int h);
+int add_stockpile(GameState *gs, int x, int y, int w, int h);
 
 void add_required_material_to_stockpile(Stockpile *s, ProductionMaterial m,
                                         int amount);
 
-int index_of_material_in_stockpile(const Stockpile *s, ProductionMaterial p);
 
-Stockpile *find_stockpile_with_material(MaterialCount mc);
-Stockpile *find_stockpile_with_free_material(MaterialCount mc);
+Stockpile *find_stockpile_with_material(GameState *gs, MaterialCount mc);
+Stockpile *find_stockpile_with_free_material(GameState *gs, MaterialCount mc);
 
 int material_in_stockpile(Stockpile const *s, ProductionMaterial p);
 int free_material_in_stockpile(Stockpile const *s, ProductionMaterial p);
 
-void earmark_material_in_stockpile(Stockpile *s, ProductionMaterial p,
-                                   int count);
-void add_material_to_stockpile(Stockpile *s, ProductionMaterial p, int count);
-void remove_material_from_stockpile(Stockpile *s, ProductionMaterial p,
-                                    int amount_to_remove);
+void earmark_material_in_stockpile(GameState *gs, Stockpile *s,
+                                   ProductionMaterial p, int count);
+void add_material_to_stockpile(GameState *gs, Stockpile *s,
+                               ProductionMaterial p, int count);
+void remove_material_from_stockpile(GameState *gs, Stockpile *s,
+                                    ProductionMaterial p, int amount_to_remove);
+
+void update_replenishment_orders(GameState *gs, Stockpile *s);
+
+void update_supply_index(GameState *gs, Stockpile *s, ProductionMaterial p);
 
-void update_replenishment_orders(Stockpile *s);
+// Recipes
+// -------
+
+void compile_recipe(Recipe *r);
+void compile_recipes(GameState *gs);
 
 // Machines
 // --------
 
-Machine *get_machine_by_id(int id);
+Machine *get_machine_by_id(const GameState *gs, int id);
+Rng get_machine_rng(const GameState *gs, int id);
+void set_machine_rng(GameState *gs, int id, Rng r);
 
-int add_machine(enum MachineType type, int x, int y);
-void add_output_stockpile_to_machine(int mid, int sid);
-void add_input_stockpile_to_machine(int mid, int sid);
+int add_machine(GameState *gs, enum MachineType type, int x, int y);
+void add_output_stockpile_to_machine(GameState *gs, int mid, int sid);
+void add_input_stockpile_to_machine(GameState *gs, int mid, int sid);
 
 // TODO: Should probably take a machine pointer, not id.
-void assign_machine_production_job(int machine_id, RecipeName rn);
-void start_production_job(Machine *m);
-void complete_production_job(Machine *m);
+void assign_machine_production_job(GameState *gs, int machine_id,
+                                   RecipeName rn);
+void start_production_job(GameState *gs, Machine *m);
+void complete_production_job(GameState *gs, Machine *m);
 int machine_has_input(Machine *m, ProductionMaterial p);
-MaterialCount next_unfullfilled_material(Machine *m, Recipe r);
-bool machine_has_required_inputs(Machine *m, Recipe r);
+MaterialCount next_unfullfilled_material(Machine *m, const Recipe *r);
+bool machine_has_required_inputs(Machine *m, const Recipe *r);
 
-void tick_machine(Machine *m);
+void queue_batch_start(GameState *gs, int machine_id);
+bool advance_batch_draws(GameState *gs, struct BatchStart *b,
+                         const uint64_t *x);
+void draw_batch_times(GameState *gs);
+bool count_down_machine(MachineHot *m);
+void finish_machine_batch(GameState *gs, Machine *m);
 
 // Workers
 // -------
 
-Worker *get_worker_by_id(int id);
+Worker *get_worker_by_id(const GameState *gs, int id);
 
-int add_worker(void);
+int add_worker(GameState *gs);
 
-// TODO: Should probably return a pointer to worker.
-int first_idle_worker(void);
-void worker_take_job(int worker_id, struct JobQueueItem jq);
+void set_worker_status(GameState *gs, Worker *w, enum WorkerStatus status);
+int nearest_idle_worker(GameState *gs, Vector to);
+Vector object_location(GameState *gs, ObjectReference o);
+void worker_take_job(GameState *gs, int worker_id, struct JobQueueItem jq);
 
 void worker_pickup_output(Worker *w, Machine *m);
 void worker_drop_material_at_machine(Worker *w, Machine *m);
-void worker_pickup_from_stockpile(Worker *w, Stockpile *s, ProductionMaterial p,
-                                  int count);
-void worker_drop_at_stockpile(Worker *w, Stockpile *s);
+void worker_pickup_from_stockpile(GameState *gs, Worker *w, Stockpile *s,
+                                  ProductionMaterial p, int count);
+void worker_drop_at_stockpile(GameState *gs, Worker *w, Stockpile *s);
 
-void tick_worker(Worker *w);
+void tick_worker(GameState *gs, Worker *w);
 
-// Replenishment Orders
-// --------------------
+// Tile grid
+// ---------
 
-#define MAX_REPLENISHMENT_QUEUE 100
+void grid_add_machine(GameState *gs, const Machine *m);
+void grid_add_stockpile(GameState *gs, const Stockpile *s);
+void grid_stamp_objects(GameState *gs);
+void move_worker(GameState *gs, Worker *w, Vector to);
+int idle_level(const TileGrid *g, int level, int *width, int *height);
+void count_idle(TileGrid *g, int bx, int by, int delta);
+WorkerHot *get_worker_hot(GameState *gs, int id);
+void block_link_idle(GameState *gs, Worker *w);
+void block_unlink_idle(GameState *gs, Worker *w);
+bool area_on_floor(int x, int y, int w, int h);
+void check_placement(const char *what, int x, int y, int w, int h);
+
+// Parallel phases
+// ---------------
+
+void tick_machines(GameState *gs);
+void tick_workers(GameState *gs);
+
+// Pathfinding
+// -----------
+
+const FlowField *flow_field_to(GameState *gs, Vector goal);
+const FlowField *built_flow_field(GameState *gs, Vector goal);
+bool worker_route_current(GameState *gs, const Worker *w);
+bool target_is_object(GameState *gs, Vector target);
+void prepare_worker_route(GameState *gs, Worker *w);
+bool plan_worker_route(GameState *gs, Worker *w);
+void ensure_worker_path(GameState *gs, Worker *w);
+Vector worker_next_step(GameState *gs, Worker *w);
+int worker_steps_to_target(GameState *gs, Worker *w);
+void advance_worker(GameState *gs, Worker *w, int steps);
 
-struct ReplenishmentOrder {
-  int ordering_stockpile;
-  ProductionMaterial material;
-  int amount_ordered;
-  int amount_picked_up;
-} replenishment_order_queue[MAX_REPLENISHMENT_QUEUE];
+// Replenishment Orders
+// --------------------
 
-struct ReplenishmentOrder *get_replenishment_order(int id);
-int next_fillable_replenishment_order(void);
-void enqueue_replenishment_order(int stockpile_id, ProductionMaterial pm,
-                                 int amount);
-void complete_replenishment_order(int ro_id, int amount);
-int outstanding_replenishment_orders(int stockpile_id, ProductionMaterial pm);
+struct ReplenishmentOrder *get_replenishment_order(GameState *gs, int id);
+int next_fillable_replenishment_order(GameState *gs);
+void enqueue_replenishment_order(GameState *gs, int stockpile_id,
+                                 ProductionMaterial pm, int amount);
+void pick_up_replenishment_order(GameState *gs, int ro_id, int amount);
+void complete_replenishment_order(GameState *gs, int ro_id, int amount);
+int outstanding_replenishment_orders(GameState *gs, int stockpile_id,
+                                     ProductionMaterial pm);
 
 /* -------------
  * STATE
  * ------------- */
 
-GameState game = {.cursor = (Vector){10, 10}};
-GameState *new_game(void) { return &game; }
-
-/* -------------
- * MESSAGE BUFFER
- * ------------- */
+#define INITIAL_ENTITY_CAPACITY 8
 
-void add_message(char *message) {
-  if (strlen(message) > MESSAGE_MAX_SIZE) {
-    printf("ERROR: message too long\n");
+GameState *new_game(void) {
+  GameState *gs = calloc(1, sizeof(GameState));
+  if (!gs) {
+    printf("ERROR: Couldn't allocate game\n");
     exit(1);
   }
+  gs->cursor = (Vector){10, 10};
+  gs->free_replenishment_orders = -1;
 
-  strcpy(game.message_buffer[game.message_head], message);
+  compile_recipes(gs);
+  return gs;
+}
 
-  game.message_head++;
-  if (game.message_head >= MESSAGE_BUFFER_SIZE) {
-    game.message_head = 0;
+void free_game(GameState *gs) {
+  for (int i = 0; i < gs->c_workers; i++) {
+    free_path(&get_worker_by_id(gs, i)->path);
+  }
+  for (int i = 0; i < gs->c_machines; i++) {
+    dist_free(&get_machine_by_id(gs, i)->repair_time);
+  }
+  for (int i = 0; i < RECIPE_COUNT; i++) {
+    Recipe *r = &gs->recipes[i];
+    dist_free(&r->time);
+    dist_free(&r->setup);
+    dist_free(&r->teardown);
+    for (int j = 0; j < r->c_outputs; j++) {
+      dist_free(&r->defects[j]);
+    }
   }
-}
 
-/* -------------
- * MATERIALS
- * ------------- */
+  chunks_free(&gs->machines);
+  chunks_free(&gs->machine_hot);
+  chunks_free(&gs->machine_rng);
+  chunks_free(&gs->workers);
+  chunks_free(&gs->worker_hot);
+  chunks_free(&gs->stockpiles);
+  chunks_free(&gs->stockpile_hot);
+  free(gs->idle_workers);
+  free(gs->grid.statics);
+  free(gs->grid.workers);
+  free(gs->grid.blocked);
+  free(gs->grid.idle_in_block);
+  free(gs->grid.idle_count);
+  free_flow_cache(&gs->flow_cache);
+  free(gs->job_queue);
+  free(gs->replenishment_orders);
+  free(gs->batch_starts);
+  free(gs->machine_done);
+  free(gs->worker_intent);
+  free(gs->worker_step);
+
+  free(gs);
+}
 
-char _material[50] = {0};
+// Each entity draws from its own stream, numbered by kind and id, so
+// adding a worker doesn't change what any machine rolls.
+#define RNG_STREAM_WORKER 1
+#define RNG_STREAM_MACHINE 2
 
-char *material_str(ProductionMaterial m) {
-  switch (m) {
+Rng entity_rng(GameState *gs, int kind, int id) {
+  return rng_stream(gs->seed, ((uint64_t)kind << 32) | (uint32_t)id);
+}
 
-  case NONE: {
-    strcpy(_material, "NONE");
-    break;
+void seed_game(GameState *gs, uint64_t seed) {
+  gs->seed = seed;
+  for (int i = 0; i < gs->c_workers; i++) {
+    get_worker_by_id(gs, i)->rng = entity_rng(gs, RNG_STREAM_WORKER, i);
   }
-
-  case EMPTY_SPINDLE: {
-    strcpy(_material, "EMPTY_SPINDLE");
-    break;
+  for (int i = 0; i < gs->c_machines; i++) {
+    set_machine_rng(gs, i, entity_rng(gs, RNG_STREAM_MACHINE, i));
   }
+}
 
-  case WASHED_IRON_WIRE_COIL: {
-    strcpy(_material, "WASHED_IRON_WIRE_COIL");
-    break;
-  }
+void *grow_array(void *array, int *capacity, int needed, size_t element_size) {
+  if (needed <= *capacity)
+    return array;
 
-  case SPINDLED_WIRE_COIL: {
-    strcpy(_material, "SPINDLED_WIRE_COIL");
-    break;
+  int new_capacity = (*capacity > 0) ? *capacity : INITIAL_ENTITY_CAPACITY;
+  while (new_capacity < needed) {
+    new_capacity *= 2;
   }
 
-  case LONG_WIRES: {
-    strcpy(_material, "WIRE");
-    break;
+  void *grown = realloc(array, new_capacity * element_size);
+  if (!grown) {
+    printf("ERROR: Couldn't grow array to %d elements\n", new_capacity);
+    exit(1);
   }
+  *capacity = new_capacity;
+  return grown;
+}
 
-  case SMALL_BOWL: {
-    strcpy(_material, "SMALL_BOWL");
-    break;
-  }
+void chunks_reserve(Chunks *c, int needed, size_t size) {
+  int chunks = (needed + ENTITY_CHUNK - 1) >> ENTITY_CHUNK_BITS;
+  if (chunks <= c->c_chunks)
+    return;
 
-  case BOWL_OF_SHORT_WIRES: {
-    strcpy(_material, "BOWL_OF_SHORT_WIRES");
-    break;
+  c->chunk = grow_array(c->chunk, &c->cap_chunks, chunks, sizeof(void *));
+  for (; c->c_chunks < chunks; c->c_chunks++) {
+    c->chunk[c->c_chunks] = malloc(ENTITY_CHUNK * size);
+    if (!c->chunk[c->c_chunks]) {
+      printf("ERROR: Couldn't allocate chunk of %d entities\n", ENTITY_CHUNK);
+      exit(1);
+    }
   }
+}
 
-  case BOWL_OF_HEADLESS_PINS: {
-    strcpy(_material, "BOWL_OF_HEADLESS_PINS");
-    break;
+void chunks_free(Chunks *c) {
+  for (int i = 0; i < c->c_chunks; i++) {
+    free(c->chunk[i]);
   }
-  }
-  return _material;
+  free(c->chunk);
+  *c = (Chunks){0};
 }
 
-/* -------------
- * JOBS
- * ------------- */
+Stockpile *new_stockpile(GameState *gs, int id) {
+  chunks_reserve(&gs->stockpiles, id + 1, sizeof(Stockpile));
+  chunks_reserve(&gs->stockpile_hot, id + 1, sizeof(StockpileHot));
+  Stockpile *s = get_stockpile_by_id(gs, id);
+  *s = (Stockpile){.hot = CHUNK_ITEM(gs->stockpile_hot, StockpileHot, id)};
+  *s->hot = (StockpileHot){0};
+  return s;
+}
 
-int job_queue_head = 0;
-int job_queue_tail = 0;
+Machine *new_machine(GameState *gs, int id) {
+  chunks_reserve(&gs->machines, id + 1, sizeof(Machine));
+  chunks_reserve(&gs->machine_hot, id + 1, sizeof(MachineHot));
+  chunks_reserve(&gs->machine_rng, id / RNG_LANES + 1, sizeof(RngLanes));
+  Machine *m = get_machine_by_id(gs, id);
+  *m = (Machine){.hot = CHUNK_ITEM(gs->machine_hot, MachineHot, id)};
+  *m->hot = (MachineHot){0};
+  // Lanes past the last machine are stepped along with the rest of
+  // their block, so a new block starts out cleared.
+  if (id % RNG_LANES == 0)
+    *CHUNK_ITEM(gs->machine_rng, RngLanes, id / RNG_LANES) = (RngLanes){0};
+  return m;
+}
 
-char _job[50] = {0};
+Worker *new_worker(GameState *gs, int id) {
+  chunks_reserve(&gs->workers, id + 1, sizeof(Worker));
+  chunks_reserve(&gs->worker_hot, id + 1, sizeof(WorkerHot));
+  Worker *w = get_worker_by_id(gs, id);
+  *w = (Worker){.hot = CHUNK_ITEM(gs->worker_hot, WorkerHot, id)};
+  *w->hot = (WorkerHot){0};
+  return w;
+}
 
-char *job_str(enum Job j) {
-  switch (j) {
+/* -------------
+ * MESSAGE BUFFER
+ * ------------- */
 
-  case JOB_NONE: {
-    strcpy(_job, "JOB_NONE");
-    break;
+void add_message(GameState *gs, char *message) {
+  if (strlen(message) > MESSAGE_MAX_SIZE) {
+    printf("ERROR: message too long\n");
+    exit(1);
   }
 
-  case JOB_MAN_MACHINE: {
-    strcpy(_job, "JOB_MAN_MACHINE");
-    break;
-  }
+  strcpy(gs->message_buffer[gs->message_head], message);
 
-  case JOB_EMPTY_OUTPUT_BUFFER: {
-    strcpy(_job, "JOB_EMPTY_OUTPUT_BUFFER");
-    break;
+  gs->message_head++;
+  if (gs->message_head >= MESSAGE_BUFFER_SIZE) {
+    gs->message_head = 0;
   }
+}
 
-  case JOB_FILL_INPUT_BUFFER: {
-    strcpy(_job, "JOB_FILL_INPUT_BUFFER");
-    break;
-  }
+/* -------------
+ * MATERIALS
+ * ------------- */
 
-  case JOB_REPLENISH_STOCKPILE: {
-    strcpy(_job, "JOB_REPLENISH_STOCKPILE");
+const char *material_str(ProductionMaterial m) {
+  switch (m) {
+  case NONE:
+    return "NONE";
+  case EMPTY_SPINDLE:
+    return "EMPTY_SPINDLE";
+  case WASHED_IRON_WIRE_COIL:
+    return "WASHED_IRON_WIRE_COIL";
+  case SPINDLED_WIRE_COIL:
+    return "SPINDLED_WIRE_COIL";
+  case LONG_WIRES:
+    return "WIRE";
+  case SMALL_BOWL:
+    return "SMALL_BOWL";
+  case BOWL_OF_SHORT_WIRES:
+    return "BOWL_OF_SHORT_WIRES";
+  case BOWL_OF_HEADLESS_PINS:
+    return "BOWL_OF_HEADLESS_PINS";
+  }
+  return "";
+}
+
+/* -------------
+ * JOBS
+ * ------------- */
+
+const char *job_str(enum Job j) {
+  switch (j) {
+  case JOB_NONE:
+    return "JOB_NONE";
+  case JOB_MAN_MACHINE:
+    return "JOB_MAN_MACHINE";
+  case JOB_EMPTY_OUTPUT_BUFFER:
+    return "JOB_EMPTY_OUTPUT_BUFFER";
+  case JOB_FILL_INPUT_BUFFER:
+    return "JOB_FILL_INPUT_BUFFER";
+  case JOB_REPLENISH_STOCKPILE:
+    return "JOB_REPLENISH_STOCKPILE";
+  }
+
+  return "";
+}
+
+// Lower runs first. Emptying a finished machine frees it for its next
+// batch, so that goes ahead of starting new work.
+int job_priority(enum Job job) {
+  switch (job) {
+  case JOB_EMPTY_OUTPUT_BUFFER:
+    return 0;
+  case JOB_MAN_MACHINE:
+  case JOB_FILL_INPUT_BUFFER:
+    return 1;
+  case JOB_REPLENISH_STOCKPILE:
+  case JOB_NONE:
     break;
   }
-  }
+  return 2;
+}
 
-  return _job;
+bool job_before(const struct JobQueueItem *a, const struct JobQueueItem *b) {
+  int pa = job_priority(a->job);
+  int pb = job_priority(b->job);
+  if (pa != pb)
+    return pa < pb;
+  return a->sequence < b->sequence;
 }
 
-void enqueue_job(ObjectReference o, enum Job job) {
-  // printf("DEBUG_ENQUEUE_JOB: MachineID %d and job %s\n", machine_id,
-  // job_str(job));
-  job_queue[job_queue_tail].object = o;
-  job_queue[job_queue_tail].job = job;
-  job_queue_tail++;
-  if (job_queue_tail > MAX_JOB_QUEUE) {
-    job_queue_tail = 0;
+void enqueue_job(GameState *gs, ObjectReference o, enum Job job) {
+  gs->job_queue = grow_array(gs->job_queue, &gs->cap_job_queue,
+                             gs->c_job_queue + 1, sizeof(struct JobQueueItem));
+
+  struct JobQueueItem item = {o, job, gs->job_sequence++};
+  int i = gs->c_job_queue++;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!job_before(&item, &gs->job_queue[parent]))
+      break;
+    gs->job_queue[i] = gs->job_queue[parent];
+    i = parent;
   }
+  gs->job_queue[i] = item;
 }
 
-bool jobs_on_queue(void) { return job_queue_tail != job_queue_head; }
+bool jobs_on_queue(GameState *gs) { return gs->c_job_queue > 0; }
 
-void debug_print_job_queue(void) {
-  if (jobs_on_queue()) {
-    printf("JOB QUEUE:\n");
-    for (int i = job_queue_head; i < job_queue_tail; i++) {
-      printf("\t%2d: %s\n", i, job_str(job_queue[i].job));
+void debug_print_job_queue(GameState *gs) {
+  if (jobs_on_queue(gs)) {
+    printf("JOB QUEUE (heap order):\n");
+    for (int i = 0; i < gs->c_job_queue; i++) {
+      printf("\t%2d: %s\n", i, job_str(gs->job_queue[i].job));
     }
   } else {
     printf("NO jobs on queue\n");
   }
 }
 
-struct JobQueueItem pop_job(void) {
-  struct JobQueueItem j;
-  if (job_queue_tail == job_queue_head) {
-    j.object.id = -1;
-    j.job = 0;
-  } else {
-    j.object = job_queue[job_queue_head].object;
-    j.job = job_queue[job_queue_head].job;
-    job_queue_head++;
-  }
-  return j;
+struct JobQueueItem pop_job(GameState *gs) {
+  if (gs->c_job_queue == 0)
+    return (struct JobQueueItem){{O_NOTHING, -1}, JOB_NONE, -1};
+
+  struct JobQueueItem top = gs->job_queue[0];
+  struct JobQueueItem last = gs->job_queue[--gs->c_job_queue];
+
+  int i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= gs->c_job_queue)
+      break;
+    if (child + 1 < gs->c_job_queue &&
+        job_before(&gs->job_queue[child + 1], &gs->job_queue[child]))
+      child++;
+    if (!job_before(&gs->job_queue[child], &last))
+      break;
+    gs->job_queue[i] = gs->job_queue[child];
+    i = child;
+  }
+  if (gs->c_job_queue > 0)
+    gs->job_queue[i] = last;
+
+  return top;
 }
 
 /* -------------
@@ -272,73 +460,104 @@ void debug_print_ro(const struct ReplenishmentOrder *ro) {
          ro->amount_ordered, material_str(ro->material), ro->amount_picked_up);
 }
 
-void debug_print_ro_queue(void) {
-  for (int i = 0; i < MAX_REPLENISHMENT_QUEUE; i++) {
-    debug_print_ro(&replenishment_order_queue[i]);
+void debug_print_ro_queue(GameState *gs) {
+  for (int i = 0; i < gs->c_replenishment_orders; i++) {
+    if (gs->replenishment_orders[i].amount_ordered > 0)
+      debug_print_ro(&gs->replenishment_orders[i]);
   }
 }
 
-struct ReplenishmentOrder *get_replenishment_order(int id) {
-  return &replenishment_order_queue[id];
+struct ReplenishmentOrder *get_replenishment_order(GameState *gs, int id) {
+  return &gs->replenishment_orders[id];
 }
 
-int next_fillable_replenishment_order(void) {
-  struct ReplenishmentOrder ro;
-  int un_picked_amount;
+// The oldest order that can be started now, i.e. one whose material is
+// free in some takeable stockpile.
+int next_fillable_replenishment_order(GameState *gs) {
+  int best = -1;
 
-  for (int i = 0; i < MAX_REPLENISHMENT_QUEUE; i++) {
-    ro = replenishment_order_queue[i];
-    un_picked_amount = ro.amount_ordered - ro.amount_picked_up;
-    if ((un_picked_amount) > 0 &&
-        find_stockpile_with_free_material((MaterialCount){ro.material, 1})) {
-      return i;
-    }
+  for (int pm = 0; pm < PM_COUNT; pm++) {
+    const struct OpenOrders *open = &gs->open_replenishment_orders[pm];
+    if (open->count == 0)
+      continue;
+
+    int id = open->head;
+    if (best != -1 && gs->replenishment_orders[id].sequence >
+                          gs->replenishment_orders[best].sequence)
+      continue;
+    if (find_stockpile_with_free_material(gs, (MaterialCount){pm, 1}))
+      best = id;
   }
-  return -1;
+  return best;
 }
 
-void enqueue_replenishment_order(int stockpile_id, ProductionMaterial pm,
-                                 int amount) {
-  struct ReplenishmentOrder *ro;
-  int outstanding;
-  for (int i = 0; i < MAX_REPLENISHMENT_QUEUE; i++) {
-    ro = &replenishment_order_queue[i];
-    outstanding = ro->amount_ordered - ro->amount_picked_up;
+void enqueue_replenishment_order(GameState *gs, int stockpile_id,
+                                 ProductionMaterial pm, int amount) {
+  int id = gs->free_replenishment_orders;
+  if (id != -1) {
+    gs->free_replenishment_orders = gs->replenishment_orders[id].next;
+  } else {
+    id = gs->c_replenishment_orders;
+    gs->replenishment_orders = grow_array(gs->replenishment_orders,
+                                          &gs->cap_replenishment_orders, id + 1,
+                                          sizeof(struct ReplenishmentOrder));
+    gs->c_replenishment_orders++;
+  }
+
+  gs->replenishment_orders[id] =
+      (struct ReplenishmentOrder){.ordering_stockpile = stockpile_id,
+                                  .material = pm,
+                                  .amount_ordered = amount,
+                                  .amount_picked_up = 0,
+                                  .sequence = gs->replenishment_sequence++,
+                                  .next = -1};
+
+  struct OpenOrders *open = &gs->open_replenishment_orders[pm];
+  if (open->count == 0) {
+    open->head = id;
+  } else {
+    gs->replenishment_orders[open->tail].next = id;
+  }
+  open->tail = id;
+  open->count++;
 
-    if (outstanding == 0) {
-      ro->ordering_stockpile = stockpile_id;
-      ro->material = pm;
-      ro->amount_ordered = amount;
-      ro->amount_picked_up = 0;
-      return;
-    }
+  get_stockpile_by_id(gs, stockpile_id)->replenishment_outstanding[pm] +=
+      amount;
+}
+
+// Records `amount` of the order as picked up, taking it off its
+// material's queue once nothing is left to pick up. Only the order at
+// the front of the queue can be picked up.
+void pick_up_replenishment_order(GameState *gs, int ro_id, int amount) {
+  struct ReplenishmentOrder *ro = get_replenishment_order(gs, ro_id);
+  ro->amount_picked_up += amount;
+
+  if (ro->amount_picked_up == ro->amount_ordered) {
+    struct OpenOrders *open = &gs->open_replenishment_orders[ro->material];
+    open->head = ro->next;
+    open->count--;
+    ro->next = -1;
   }
-  printf("ERROR: Couldn't find a space to put replenishment order\n");
-  exit(1);
 }
 
-void complete_replenishment_order(int ro_id, int amount) {
-  struct ReplenishmentOrder *ro = get_replenishment_order(ro_id);
+void complete_replenishment_order(GameState *gs, int ro_id, int amount) {
+  struct ReplenishmentOrder *ro = get_replenishment_order(gs, ro_id);
   ro->amount_ordered -= amount;
   ro->amount_picked_up -= amount;
+  get_stockpile_by_id(gs, ro->ordering_stockpile)
+      ->replenishment_outstanding[ro->material] -= amount;
 
   if (ro->amount_ordered == 0) {
     ro->material = NONE;
     ro->ordering_stockpile = -1;
+    ro->next = gs->free_replenishment_orders;
+    gs->free_replenishment_orders = ro_id;
   }
 }
 
-int outstanding_replenishment_orders(int stockpile_id, ProductionMaterial pm) {
-  int amount = 0;
-  struct ReplenishmentOrder ro;
-
-  for (int i = 0; i < MAX_REPLENISHMENT_QUEUE; i++) {
-    ro = replenishment_order_queue[i];
-    if (ro.ordering_stockpile == stockpile_id && ro.material == pm) {
-      amount += (ro.amount_ordered);
-    }
-  }
-  return amount;
+int outstanding_replenishment_orders(GameState *gs, int stockpile_id,
+                                     ProductionMaterial pm) {
+  return get_stockpile_by_id(gs, stockpile_id)->replenishment_outstanding[pm];
 }
 
 /* -------------
@@ -352,7 +571,9 @@ const Recipe wind_wire = {.name = WIND_WIRE,
                           .c_outputs = 1,
                           .outputs = {SPINDLED_WIRE_COIL},
                           .outputs_count = {1},
-                          .time = 1};
+                          .time = {.kind = DIST_FIXED, .a = 1},
+                          .needs = {.count = {[WASHED_IRON_WIRE_COIL] = 1,
+                                              [EMPTY_SPINDLE] = 1}}};
 
 const Recipe pull_wire = {.name = PULL_WIRE,
                           .c_inputs = 1,
@@ -361,7 +582,8 @@ const Recipe pull_wire = {.name = PULL_WIRE,
                           .c_outputs = 2,
                           .outputs = {LONG_WIRES, EMPTY_SPINDLE},
                           .outputs_count = {100, 1},
-                          .time = 1};
+                          .time = {.kind = DIST_FIXED, .a = 1},
+                          .needs = {.count = {[SPINDLED_WIRE_COIL] = 1}}};
 
 const Recipe cut_wire = {.name = CUT_WIRE,
                          .c_inputs = 2,
@@ -370,7 +592,9 @@ const Recipe cut_wire = {.name = CUT_WIRE,
                          .c_outputs = 1,
                          .outputs = {BOWL_OF_SHORT_WIRES},
                          .outputs_count = {1, 1},
-                         .time = 1};
+                         .time = {.kind = DIST_FIXED, .a = 1},
+                         .needs = {.count = {[LONG_WIRES] = 10,
+                                             [SMALL_BOWL] = 1}}};
 
 const Recipe grind_point = {.name = GRIND_POINT,
                             .c_inputs = 1,
@@ -379,260 +603,366 @@ const Recipe grind_point = {.name = GRIND_POINT,
                             .c_outputs = 1,
                             .outputs = {BOWL_OF_HEADLESS_PINS},
                             .outputs_count = {1},
-                            .time = 1};
-
-Recipe get_recipe_from_name(RecipeName rn) {
-  switch (rn) {
-  case PULL_WIRE:
-    return pull_wire;
-  case WIND_WIRE:
-    return wind_wire;
-  case CUT_WIRE:
-    return cut_wire;
-  case GRIND_POINT:
-    return grind_point;
-  default:
-    printf("Unknown recipe %d\n", rn);
-    exit(1);
+                            .time = {.kind = DIST_FIXED, .a = 1},
+                            .needs = {.count = {[BOWL_OF_SHORT_WIRES] = 1}}};
+
+// The recipes every new game starts with.
+const Recipe *const recipe_book[RECIPE_COUNT] = {[WIND_WIRE] = &wind_wire,
+                                                 [PULL_WIRE] = &pull_wire,
+                                                 [CUT_WIRE] = &cut_wire,
+                                                 [GRIND_POINT] = &grind_point};
+
+// Builds the alias tables for a recipe's distributions, including the
+// number of defects in each output, which is binomial in its count.
+void compile_recipe(Recipe *r) {
+  dist_compile(&r->time);
+  dist_compile(&r->setup);
+  dist_compile(&r->teardown);
+
+  for (int i = 0; i < r->c_outputs; i++) {
+    dist_free(&r->defects[i]);
+    r->defects[i] = (Distribution){.kind = DIST_BINOMIAL,
+                                   .a = r->outputs_count[i],
+                                   .b = r->defect_rate};
+    dist_compile(&r->defects[i]);
   }
 }
 
-char _recipe[50] = {0};
-
-char *recipe_str(RecipeName rn) {
-  switch (rn) {
-
-  case WIND_WIRE: {
-    strcpy(_recipe, "WIND_WIRE");
-    break;
+void compile_recipes(GameState *gs) {
+  for (int i = 0; i < RECIPE_COUNT; i++) {
+    gs->recipes[i] = *recipe_book[i];
+    compile_recipe(&gs->recipes[i]);
   }
+}
 
-  case PULL_WIRE: {
-    strcpy(_recipe, "PULL_WIRE");
-    break;
+void set_recipe_variation(GameState *gs, RecipeName rn, Distribution time,
+                          Distribution setup, Distribution teardown,
+                          double defect_rate) {
+  if ((int)rn < 0 || (int)rn >= RECIPE_COUNT) {
+    printf("ERROR: Unknown recipe %d\n", rn);
+    exit(1);
   }
 
-  case CUT_WIRE: {
-    strcpy(_recipe, "CUT_WIRE");
-    break;
+  Recipe *r = &gs->recipes[rn];
+  dist_free(&r->time);
+  dist_free(&r->setup);
+  dist_free(&r->teardown);
+  r->time = time;
+  r->setup = setup;
+  r->teardown = teardown;
+  r->defect_rate = defect_rate;
+  compile_recipe(r);
+}
+
+const Recipe *get_recipe_from_name(GameState *gs, RecipeName rn) {
+  if ((int)rn < 0 || rn >= RECIPE_COUNT) {
+    printf("Unknown recipe %d\n", rn);
+    exit(1);
   }
+  return &gs->recipes[rn];
+}
 
-  case GRIND_POINT: {
-    strcpy(_recipe, "GRIND_POINT");
+const char *recipe_str(RecipeName rn) {
+  switch (rn) {
+  case WIND_WIRE:
+    return "WIND_WIRE";
+  case PULL_WIRE:
+    return "PULL_WIRE";
+  case CUT_WIRE:
+    return "CUT_WIRE";
+  case GRIND_POINT:
+    return "GRIND_POINT";
+  case RECIPE_COUNT:
     break;
   }
-  }
-  return _recipe;
+  return "";
 }
 
 /* -------------
  * STOCKPILES
  * ------------- */
 
-int add_stockpile(int x, int y, int w, int h) {
+int add_stockpile(GameState *gs, int x, int y, int w, int h) {
+  check_placement("stockpile", x, y, w, h);
+
+  int id = gs->c_stockpile;
+  Stockpile *s = new_stockpile(gs, id);
+  *s = (Stockpile){.hot = s->hot,
+                   .id = id,
+                   .location = {x, y},
+                   .size = {w, h},
+                   .can_be_taken_from = false,
+                   .io = -1,
+                   .attached_machine = -1};
+  gs->c_stockpile++;
+  grid_add_stockpile(gs, s);
+  gs->layout_version++;
+  return id;
+}
 
-  int id = game.c_stockpile;
+void move_stockpile(GameState *gs, int id, int x, int y) {
+  Stockpile *s = get_stockpile_by_id(gs, id);
+  check_placement("stockpile", x, y, s->size.x, s->size.y);
+  Vector from = s->location;
+  s->location = (Vector){x, y};
 
-  if (id > MAX_STOCKPILES) {
-    printf("ERROR: Exceeded maximum stockpiles\n");
-    exit(1);
+  for (int i = 0; i < gs->c_workers; i++) {
+    Worker *w = get_worker_by_id(gs, i);
+    if (w->hot->status != W_IDLE && vec_equal(w->hot->target, from))
+      w->hot->target = s->location;
   }
 
-  game.stockpiles[id] = (Stockpile){.id = id,
-                                    .location = {x, y},
-                                    .size = {w, h},
-                                    .can_be_taken_from = false,
-                                    .c_contents = 0,
-                                    .contents = {0},
-                                    .contents_count = {0},
-                                    .c_required_material = 0,
-                                    .required_material = {0},
-                                    .required_material_count = {0},
-                                    .io = -1,
-                                    .attached_machine = -1};
-  game.c_stockpile++;
-  return id;
+  grid_ensure(gs, x + s->size.x, y + s->size.y);
+  grid_stamp_objects(gs);
+  gs->layout_version++;
 }
 
 void debug_print_stockpile(const Stockpile *s) {
-  printf("DEBUG_STOCKPILE: S%d. Can be taken from: %d. Has materials:\n", s->id,
-         s->can_be_taken_from);
-  for (int i = 0; i < s->c_contents; i++) {
-    printf("\t%d %s (of which %d earmarked)\n", s->contents_count[i],
-           material_str(s->contents[i]), s->contents_earmarks[i]);
-  }
-}
-
-int index_of_material_in_stockpile(const Stockpile *s, ProductionMaterial p) {
-  for (int i = 0; i < s->c_contents; i++) {
-    if (s->contents[i] == p) {
-      return i;
+  LOG_DEBUG(LOG_STOCKPILE, "S%d. Can be taken from: %d. Has materials:", s->id,
+            s->can_be_taken_from);
+  for (int p = 0; p < PM_COUNT; p++) {
+    if (inventory_has(&s->contents, p)) {
+      LOG_DEBUG(LOG_STOCKPILE, "\t%d %s (of which %d earmarked)",
+                s->contents.count[p], material_str(p), s->earmarked[p]);
     }
   }
-  return -1;
 }
 
 void add_required_material_to_stockpile(Stockpile *s, ProductionMaterial m,
                                         int amount) {
-  int i = index_of_material_in_stockpile(s, m);
-  if (i > -1) {
-    s->required_material_count[i] += amount;
-    return;
-  }
-  s->required_material[s->c_required_material] = m;
-  s->required_material_count[s->c_required_material] = amount;
-  s->c_required_material++;
+  inventory_add(&s->hot->required_material, m, amount);
+}
+
+Stockpile *get_stockpile_by_id(const GameState *gs, int id) {
+  return CHUNK_ITEM(gs->stockpiles, Stockpile, id);
 }
 
-Stockpile *get_stockpile_by_id(int id) { return &game.stockpiles[id]; }
+bool inventory_has(const Inventory *inv, ProductionMaterial p) {
+  return (inv->present >> p) & 1u;
+}
 
-void add_material_to_stockpile(Stockpile *s, ProductionMaterial p, int count) {
-  int i = index_of_material_in_stockpile(s, p);
-  if (i == -1) {
-    s->contents[s->c_contents] = p;
-    s->contents_count[s->c_contents] = count;
-    s->c_contents++;
+// `count` may be negative to take material out.
+void inventory_add(Inventory *inv, ProductionMaterial p, int count) {
+  inv->count[p] += count;
+  if (inv->count[p] != 0) {
+    inv->present |= 1u << p;
   } else {
-    s->contents_count[i] += count;
+    inv->present &= ~(1u << p);
+  }
+}
+
+// True if `have` holds at least as much of every material as `need`.
+bool inventory_covers(const Inventory *have, const Inventory *need) {
+#if defined(__SSE2__)
+  __m128i short_of = _mm_setzero_si128();
+  for (int i = 0; i < MATERIAL_LANES; i += 4) {
+    __m128i h = _mm_loadu_si128((const __m128i *)&have->count[i]);
+    __m128i n = _mm_loadu_si128((const __m128i *)&need->count[i]);
+    short_of = _mm_or_si128(short_of, _mm_cmplt_epi32(h, n));
+  }
+  return _mm_movemask_epi8(short_of) == 0;
+#else
+  int short_of = 0;
+  for (int i = 0; i < MATERIAL_LANES; i++) {
+    short_of |= have->count[i] < need->count[i];
+  }
+  return !short_of;
+#endif
+}
+
+// Sets bit i of `ready` when the input stockpile of machine
+// `machines[i]` holds a full batch of `recipes[i]`, for a dispatcher
+// deciding which machines to start. `ready` needs room for n bits.
+void batch_inputs_ready(GameState *gs, int n, const int *machines,
+                        const RecipeName *recipes, uint64_t *ready) {
+  for (int w = 0; w < (n + 63) / 64; w++) {
+    ready[w] = 0;
+  }
+
+  for (int i = 0; i < n; i++) {
+    const Machine *m = get_machine_by_id(gs, machines[i]);
+    const Stockpile *s = get_stockpile_by_id(gs, m->input_stockpile);
+    const Recipe *r = get_recipe_from_name(gs, recipes[i]);
+    if (inventory_covers(&s->contents, &r->needs))
+      ready[i / 64] |= (uint64_t)1 << (i % 64);
+  }
+}
+
+void set_stockpile_takeable(GameState *gs, Stockpile *s, bool takeable) {
+  s->can_be_taken_from = takeable;
+  for (int p = 0; p < PM_COUNT; p++) {
+    if (inventory_has(&s->contents, p))
+      update_supply_index(gs, s, p);
   }
 }
 
+void add_material_to_stockpile(GameState *gs, Stockpile *s,
+                               ProductionMaterial p, int count) {
+  inventory_add(&s->contents, p, count);
+  update_supply_index(gs, s, p);
+}
+
 int material_in_stockpile(Stockpile const *s, ProductionMaterial p) {
-  int i = index_of_material_in_stockpile(s, p);
-  return s->contents_count[i];
+  return s->contents.count[p];
 }
 
-void earmark_material_in_stockpile(Stockpile *s, ProductionMaterial p,
-                                   int count) {
-  int i = index_of_material_in_stockpile(s, p);
-  if (i == -1) {
+void earmark_material_in_stockpile(GameState *gs, Stockpile *s,
+                                   ProductionMaterial p, int count) {
+  if (!inventory_has(&s->contents, p)) {
     printf(
         "ERROR: Cannot earmark %s in stockpile %d: material is not present\n",
         material_str(p), s->id);
     exit(1);
   }
 
-  s->contents_earmarks[i] += count;
+  s->earmarked[p] += count;
+  update_supply_index(gs, s, p);
 
   if (count > 0) {
-    printf("DEBUG: Earmarking %d %s in S%d\n", count, material_str(p), s->id);
+    LOG_DEBUG(LOG_STOCKPILE, "Earmarking %d %s in S%d", count, material_str(p),
+              s->id);
   } else {
-    printf("DEBUG: UNEarmarking %d %s in S%d\n", -count, material_str(p),
-           s->id);
+    LOG_DEBUG(LOG_STOCKPILE, "UNEarmarking %d %s in S%d", -count,
+              material_str(p), s->id);
   }
   debug_print_stockpile(s);
 }
 
 int free_material_in_stockpile(Stockpile const *s, ProductionMaterial p) {
-  int i = index_of_material_in_stockpile(s, p);
-  return (s->contents_count[i] - s->contents_earmarks[i]);
+  return s->contents.count[p] - s->earmarked[p];
 }
 
-void update_replenishment_orders(Stockpile *s) {
-  ProductionMaterial pm;
+void update_replenishment_orders(GameState *gs, Stockpile *s) {
   int required;
   int current;
   int oro;
   int shortfall;
 
-  for (int i = 0; i < s->c_required_material; i++) {
-    pm = s->required_material[i];
-    oro = outstanding_replenishment_orders(s->id, pm);
+  for (ProductionMaterial pm = 0; pm < PM_COUNT; pm++) {
+    if (!inventory_has(&s->hot->required_material, pm))
+      continue;
+
+    oro = outstanding_replenishment_orders(gs, s->id, pm);
     if (oro > 0) {
       return;
     }
 
-    required = s->required_material_count[i];
+    required = s->hot->required_material.count[pm];
     current = material_in_stockpile(s, pm);
     shortfall = required - current;
 
     if (shortfall > 0) {
-      printf("DEBUG: SP %d placed RO for %d %s", s->id, shortfall,
-             material_str(pm));
-      printf("\t(current %d; in_queue %d)\n", current, oro);
-      enqueue_replenishment_order(s->id, pm, shortfall);
+      LOG_DEBUG(LOG_REPLENISHMENT,
+                "SP %d placed RO for %d %s\t(current %d; in_queue %d)", s->id,
+                shortfall, material_str(pm), current, oro);
+      enqueue_replenishment_order(gs, s->id, pm, shortfall);
     }
   }
 }
 
-Stockpile *find_stockpile_with_material(MaterialCount mc) {
-  for (int i = 0; i < game.c_stockpile; i++) {
-    Stockpile s = game.stockpiles[i];
-    if (s.can_be_taken_from && material_in_stockpile(&s, mc.material) > 0) {
-      return &game.stockpiles[i];
+/* -------------
+ * SUPPLY INDEX
+ *
+ * For each material, the takeable stockpiles that have some of it free
+ * (not earmarked), linked through Stockpile.supply_next/prev in id
+ * order. Kept up to date by everything that changes contents, earmarks
+ * or can_be_taken_from, so finding gs->supply is a lookup.
+ * ------------- */
+
+void update_supply_index(GameState *gs, Stockpile *s, ProductionMaterial p) {
+  unsigned bit = 1u << p;
+  bool listed = (s->supplying & bit) != 0;
+  bool supplies = s->can_be_taken_from && free_material_in_stockpile(s, p) > 0;
+  struct SupplyList *l = &gs->supply[p];
+
+  if (supplies && !listed) {
+    int prev = -1;
+    int next = (l->count > 0) ? l->head : -1;
+    while (next != -1 && next < s->id) {
+      prev = next;
+      next = get_stockpile_by_id(gs, next)->supply_next[p];
+    }
+
+    s->supply_prev[p] = prev;
+    s->supply_next[p] = next;
+    if (prev == -1) {
+      l->head = s->id;
+    } else {
+      get_stockpile_by_id(gs, prev)->supply_next[p] = s->id;
+    }
+    if (next != -1) {
+      get_stockpile_by_id(gs, next)->supply_prev[p] = s->id;
+    }
+    l->count++;
+    s->supplying |= bit;
+  } else if (!supplies && listed) {
+    int prev = s->supply_prev[p];
+    int next = s->supply_next[p];
+    if (prev == -1) {
+      l->head = next;
+    } else {
+      get_stockpile_by_id(gs, prev)->supply_next[p] = next;
     }
+    if (next != -1) {
+      get_stockpile_by_id(gs, next)->supply_prev[p] = prev;
+    }
+    l->count--;
+    s->supplying &= ~bit;
   }
-  return NULL;
 }
-Stockpile *find_stockpile_with_free_material(MaterialCount mc) {
-  for (int i = 0; i < game.c_stockpile; i++) {
-    Stockpile s = game.stockpiles[i];
-    if (s.can_be_taken_from &&
-        free_material_in_stockpile(&s, mc.material) > 0) {
-      return &game.stockpiles[i];
+
+Stockpile *find_stockpile_with_material(GameState *gs, MaterialCount mc) {
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    Stockpile *s = get_stockpile_by_id(gs, i);
+    if (s->can_be_taken_from && material_in_stockpile(s, mc.material) > 0) {
+      return s;
     }
   }
   return NULL;
 }
+// The lowest id takeable stockpile with any of the material free.
+Stockpile *find_stockpile_with_free_material(GameState *gs, MaterialCount mc) {
+  const struct SupplyList *l = &gs->supply[mc.material];
+  return (l->count > 0) ? get_stockpile_by_id(gs, l->head) : NULL;
+}
 
-void remove_material_from_stockpile(Stockpile *s, ProductionMaterial p,
+void remove_material_from_stockpile(GameState *gs, Stockpile *s,
+                                    ProductionMaterial p,
                                     int amount_to_remove) {
-  int idx = index_of_material_in_stockpile(s, p);
-  if (idx == -1) {
+  if (!inventory_has(&s->contents, p)) {
     printf("ERROR: Material is not in stockpile");
     exit(1);
   }
-  int available = s->contents_count[idx];
+  int available = s->contents.count[p];
 
   if (available < amount_to_remove) {
     printf("ERROR: Not enough material in stockpile to remove");
     exit(1);
   }
 
-  s->contents_count[idx] -= amount_to_remove;
-
-  if (s->contents_count[idx] == 0) {
-    for (int i = idx; i < s->c_contents; i++) {
-      s->contents[i] = s->contents[i + 1];
-      s->contents_count[i] = s->contents_count[i + 1];
-    }
-    s->c_contents--;
-  }
+  inventory_add(&s->contents, p, -amount_to_remove);
+  update_supply_index(gs, s, p);
 }
 
 /* -------------
  * MACHINES
  * ------------- */
 
-char _machine[50] = {0};
-
-char *machine_str(enum MachineType m) {
+const char *machine_str(enum MachineType m) {
   switch (m) {
-
-  case WIRE_WINDER: {
-    strcpy(_machine, "WIRE_WINDER");
-    break;
-  }
-
-  case WIRE_PULLER: {
-    strcpy(_machine, "WIRE_PULLER");
-    break;
-  }
-
-  case WIRE_CUTTER: {
-    strcpy(_machine, "WIRE_CUTTER");
-    break;
-  }
-
-  case WIRE_GRINDER: {
-    strcpy(_machine, "WIRE_GRINDER");
-    break;
-  }
+  case WIRE_WINDER:
+    return "WIRE_WINDER";
+  case WIRE_PULLER:
+    return "WIRE_PULLER";
+  case WIRE_CUTTER:
+    return "WIRE_CUTTER";
+  case WIRE_GRINDER:
+    return "WIRE_GRINDER";
   default:
     printf("ERROR: Unrecognized machine type\n");
     exit(1);
   }
-  return _machine;
+  return "";
 }
 
 const RecipeName wire_winder_recipes[2] = {WIND_WIRE, -1};
@@ -679,104 +1009,119 @@ Vector machine_size(enum MachineType mt) {
   }
 }
 
-int add_machine(enum MachineType type, int x, int y) {
-  int id = game.c_machines;
-
-  if (id > MAX_MACHINES) {
-    printf("ERROR: Exceeded maximum machines\n");
-    exit(1);
-  }
-
+int add_machine(GameState *gs, enum MachineType type, int x, int y) {
+  int id = gs->c_machines;
   Vector v = machine_size(type);
+  check_placement(machine_str(type), x, y, v.x, v.y);
 
-  game.machines[id] = (Machine){
+  Machine *m = new_machine(gs, id);
+  *m = (Machine){
+      .hot = m->hot,
       .id = id,
       .type = type,
-      .job_time_left = 0,
       .has_current_work_order = false,
-      .c_output_buffer = 0,
       .worker = -1,
       .location = (Vector){x, y},
       .size = v,
       .input_stockpile = -1,
       .output_stockpile = -1,
   };
+  set_machine_rng(gs, id, entity_rng(gs, RNG_STREAM_MACHINE, id));
 
-  game.c_machines++;
+  gs->c_machines++;
+  grid_add_machine(gs, m);
+  gs->layout_version++;
 
   return id;
 }
 
-Machine *get_machine_by_id(int id) { return &game.machines[id]; }
+Machine *get_machine_by_id(const GameState *gs, int id) {
+  return CHUNK_ITEM(gs->machines, Machine, id);
+}
+
+Rng get_machine_rng(const GameState *gs, int id) {
+  return rng_lane(CHUNK_ITEM(gs->machine_rng, RngLanes, id / RNG_LANES),
+                  id % RNG_LANES);
+}
 
-void add_output_stockpile_to_machine(int mid, int sid) {
-  Machine *m = get_machine_by_id(mid);
+void set_machine_rng(GameState *gs, int id, Rng r) {
+  rng_set_lane(CHUNK_ITEM(gs->machine_rng, RngLanes, id / RNG_LANES),
+               id % RNG_LANES, r);
+}
+
+void add_output_stockpile_to_machine(GameState *gs, int mid, int sid) {
+  Machine *m = get_machine_by_id(gs, mid);
   m->output_stockpile = sid;
 
-  Stockpile *s = get_stockpile_by_id(sid);
+  Stockpile *s = get_stockpile_by_id(gs, sid);
   s->io = OUTPUT;
-  s->can_be_taken_from = true;
+  set_stockpile_takeable(gs, s, true);
   s->attached_machine = mid;
 }
 
-void add_input_stockpile_to_machine(int mid, int sid) {
-  Machine *m = get_machine_by_id(mid);
+void add_input_stockpile_to_machine(GameState *gs, int mid, int sid) {
+  Machine *m = get_machine_by_id(gs, mid);
   m->input_stockpile = sid;
 
-  Stockpile *s = get_stockpile_by_id(sid);
+  Stockpile *s = get_stockpile_by_id(gs, sid);
   s->io = INPUT;
-  s->can_be_taken_from = false;
+  set_stockpile_takeable(gs, s, false);
   s->attached_machine = mid;
 }
 
-void assign_machine_production_job(int id, RecipeName rn) {
-  Recipe r = get_recipe_from_name(rn);
-  Machine *m = get_machine_by_id(id);
+void assign_machine_production_job(GameState *gs, int id, RecipeName rn) {
+  const Recipe *r = get_recipe_from_name(gs, rn);
+  Machine *m = get_machine_by_id(gs, id);
 
-  printf("DEBUG: machine %d assigned recipe %s\n", id, recipe_str(rn));
+  LOG_DEBUG(LOG_MACHINE, "machine %d assigned recipe %s", id, recipe_str(rn));
 
   m->has_current_work_order = true;
   m->active_recipe = r;
-  m->job_time_left = r.time;
-  enqueue_job((ObjectReference){O_MACHINE, id}, JOB_MAN_MACHINE);
+  enqueue_job(gs, (ObjectReference){O_MACHINE, id}, JOB_MAN_MACHINE);
 }
 
-void complete_production_job(Machine *m) {
-  Worker *w = get_worker_by_id(m->worker);
+void complete_production_job(GameState *gs, Machine *m) {
+  Worker *w = get_worker_by_id(gs, m->worker);
 
-  int num_outputs = m->active_recipe.c_outputs;
+  const Recipe *r = m->active_recipe;
   m->has_current_work_order = false;
   m->worker = -1;
-  m->c_output_buffer = num_outputs;
 
-  for (int i = 0; i < num_outputs; i++) {
-    m->output_buffer[i] = m->active_recipe.outputs[i];
-    m->output_buffer_count[i] = m->active_recipe.outputs_count[i];
+  Rng rng = get_machine_rng(gs, m->id);
+  for (int i = 0; i < r->c_outputs; i++) {
+    int defective = dist_sample(&r->defects[i], &rng);
+    int good = r->outputs_count[i] - defective;
+    inventory_add(&m->output_buffer, r->outputs[i], good);
+    gs->produced[r->outputs[i]] += good;
+    gs->scrapped[r->outputs[i]] += defective;
+  }
+  set_machine_rng(gs, m->id, rng);
+  m->hot->working = false;
+
+  // If the whole batch was scrapped there's nothing to carry off.
+  if (m->output_buffer.present == 0) {
+    w->hot->job = JOB_NONE;
+    w->job_target.object_type = O_NOTHING;
+    set_worker_status(gs, w, W_IDLE);
+    return;
   }
 
-  w->status = W_MOVING;
-  w->job = JOB_EMPTY_OUTPUT_BUFFER;
+  set_worker_status(gs, w, W_MOVING);
+  w->hot->job = JOB_EMPTY_OUTPUT_BUFFER;
   w->job_target = (ObjectReference){O_MACHINE, m->id};
-  w->target = m->location;
-  m->working = false;
+  w->hot->target = m->location;
 }
 
 int machine_has_input(Machine *m, ProductionMaterial p) {
-  int count = 0;
-  for (int i = 0; i < m->c_input_buffer; i++) {
-    if (m->input_buffer[i] == p) {
-      count += m->input_buffer_count[i];
-    }
-  }
-  return count;
+  return m->input_buffer.count[p];
 }
 
-MaterialCount next_unfullfilled_material(Machine *m, Recipe r) {
+MaterialCount next_unfullfilled_material(Machine *m, const Recipe *r) {
   MaterialCount mc = {-1, 0};
 
-  for (int i = 0; i < r.c_inputs; i++) {
-    ProductionMaterial p = r.inputs[i];
-    int required = r.inputs_count[i];
+  for (int i = 0; i < r->c_inputs; i++) {
+    ProductionMaterial p = r->inputs[i];
+    int required = r->inputs_count[i];
 
     int current = machine_has_input(m, p);
 
@@ -793,176 +1138,442 @@ MaterialCount next_unfullfilled_material(Machine *m, Recipe r) {
   return mc;
 }
 
-bool machine_has_required_inputs(Machine *m, Recipe r) {
-  MaterialCount mc = next_unfullfilled_material(m, r);
-  return (mc.count == 0);
-}
-
-int index_of_material_in_machine_input(Machine *m, ProductionMaterial p) {
-  for (int i = 0; i < m->c_input_buffer; i++) {
-    if (m->input_buffer[i] == p) {
-      return i;
-    }
-  }
-  return -1;
+bool machine_has_required_inputs(Machine *m, const Recipe *r) {
+  return inventory_covers(&m->input_buffer, &r->needs);
 }
 
-void start_production_job(Machine *m) {
+void start_production_job(GameState *gs, Machine *m) {
   if (!machine_has_required_inputs(m, m->active_recipe)) {
     printf("ERROR: Trying to start production job, but don't have required "
            "materials\n");
     exit(1);
   }
 
-  if (m->working) {
+  if (m->hot->working) {
     printf("ERROR: Trying to start production job, machine already working!\n");
     exit(1);
   }
 
-  printf("DEBUG: Starting Production Job, clearing inputs\n");
+  LOG_DEBUG(LOG_MACHINE, "Starting Production Job, clearing inputs");
 
-  Recipe r = m->active_recipe;
-  ProductionMaterial pm;
-  int required;
-  int j;
+  const Recipe *r = m->active_recipe;
 
-  for (int i = 0; i < r.c_inputs; i++) {
-    pm = r.inputs[i];
-    required = r.inputs_count[i];
-    j = index_of_material_in_machine_input(m, pm);
-    m->input_buffer_count[j] -= required;
+  for (int i = 0; i < r->c_inputs; i++) {
+    inventory_add(&m->input_buffer, r->inputs[i], -r->inputs_count[i]);
   }
 
-  m->working = true;
+  m->hot->working = true;
+  queue_batch_start(gs, m->id);
 }
 
-void tick_machine(Machine *m) {
-  if (m->has_current_work_order && m->worker >= 0 && m->working) {
+// The random parts of a batch, in the order they're drawn: its run time,
+// any change over from the last recipe, and whether the machine breaks
+// down along the way, which if it does adds a repair.
+enum BatchDraw {
+  DRAW_TIME,
+  DRAW_TEARDOWN,
+  DRAW_SETUP,
+  DRAW_BREAKDOWN,
+  DRAW_REPAIR,
+  DRAW_DONE
+};
+
+// A batch that takes no draws, say a fixed run time on a machine that
+// never breaks down, is timed straight away. The rest wait for the end
+// of the tick, kept in machine order so that the machines sharing a
+// block of streams sit next to each other for draw_batch_times().
+void queue_batch_start(GameState *gs, int machine_id) {
+  struct BatchStart b = {.machine = machine_id, .draw = DRAW_TIME};
+  if (!advance_batch_draws(gs, &b, NULL)) {
+    get_machine_by_id(gs, machine_id)->hot->job_time_left = b.ticks;
+    return;
+  }
 
-    printf("DEBUG_TICK_MACHINE: machine is working...\n");
-    if (m->job_time_left > 0) {
-      m->job_time_left--;
-    } else {
-      complete_production_job(m);
+  gs->batch_starts =
+      grow_array(gs->batch_starts, &gs->cap_batch_starts,
+                 gs->c_batch_starts + 1, sizeof(struct BatchStart));
 
-      printf("DEBUG: Machine %d produced output: \n", m->id);
+  int i = gs->c_batch_starts++;
+  for (; i > 0 && gs->batch_starts[i - 1].machine > machine_id; i--) {
+    gs->batch_starts[i] = gs->batch_starts[i - 1];
+  }
+  gs->batch_starts[i] = b;
+}
+
+// Works through the parts of `b`'s batch, adding in the ones that take
+// no draw, and using `x`, if given, for the first one that does. Returns
+// whether `b` is left waiting on a draw.
+bool advance_batch_draws(GameState *gs, struct BatchStart *b,
+                         const uint64_t *x) {
+  Machine *m = get_machine_by_id(gs, b->machine);
+  const Recipe *r = m->active_recipe;
+
+  for (; b->draw != DRAW_DONE; b->draw++) {
+    const Distribution *d = NULL;
+    switch (b->draw) {
+    case DRAW_TIME:
+      d = &r->time;
+      break;
+    case DRAW_TEARDOWN:
+      if (m->set_up_for && m->set_up_for != r)
+        d = &m->set_up_for->teardown;
+      break;
+    case DRAW_SETUP:
+      if (m->set_up_for != r)
+        d = &r->setup;
+      break;
+    case DRAW_BREAKDOWN:
+      if (m->breakdown_chance <= 0) {
+        b->draw = DRAW_REPAIR;
+        continue;
+      }
+      if (!x)
+        return true;
+      if (rng_unit(*x) < m->breakdown_chance) {
+        m->breakdowns++;
+        LOG_DEBUG(LOG_MACHINE, "machine %d will break down this batch",
+                  m->id);
+      } else {
+        b->draw = DRAW_REPAIR;
+      }
+      x = NULL;
+      continue;
+    case DRAW_REPAIR:
+      d = &m->repair_time;
+      break;
+    }
 
-      for (int i = 0; i < m->c_output_buffer; i++)
-        printf("\t%s: %d\n", material_str(m->output_buffer[i]),
-               m->output_buffer_count[i]);
+    if (d && d->n == 1) {
+      b->ticks += d->min;
+    } else if (d) {
+      if (!x)
+        return true;
+      b->ticks += dist_pick(d, *x);
+      x = NULL;
     }
+    if (b->draw == DRAW_SETUP)
+      m->set_up_for = r;
   }
+  return false;
 }
 
-/* -------------
- * WORKERS
- * ------------- */
+// Draws the rest of every batch started this tick, once the workers
+// that started them have all moved. Each round steps each block of
+// machine streams once, with the lanes of its waiting machines masked
+// in, so every machine's stream gives exactly the draws it would on its
+// own. A batch leaves the list once it has all its draws, which for
+// most is after the first round; none takes more than five. Its length
+// is then fixed, which is what lets fast_forward() skip over it.
+void draw_batch_times(GameState *gs) {
+  struct BatchStart *starts = gs->batch_starts;
+  int n = gs->c_batch_starts;
+
+  while (n > 0) {
+    int waiting = 0;
+    for (int i = 0, end; i < n; i = end) {
+      int block = starts[i].machine / RNG_LANES;
+      unsigned mask = 0;
+      for (end = i; end < n && starts[end].machine / RNG_LANES == block;
+           end++) {
+        mask |= 1u << (starts[end].machine % RNG_LANES);
+      }
 
-Worker *get_worker_by_id(int id) { return &game.workers[id]; }
+      uint64_t x[RNG_LANES];
+      rng_lanes_next(CHUNK_ITEM(gs->machine_rng, RngLanes, block), mask, x);
+      for (int j = i; j < end; j++) {
+        struct BatchStart b = starts[j];
+        if (advance_batch_draws(gs, &b, &x[b.machine % RNG_LANES]))
+          starts[waiting++] = b;
+        else
+          get_machine_by_id(gs, b.machine)->hot->job_time_left = b.ticks;
+      }
+    }
+    n = waiting;
+  }
+  gs->c_batch_starts = 0;
+}
 
-char _status[50] = {0};
+void set_machine_breakdowns(GameState *gs, int machine_id, double chance,
+                            Distribution repair) {
+  Machine *m = get_machine_by_id(gs, machine_id);
+  dist_free(&m->repair_time);
+  m->breakdown_chance = chance;
+  m->repair_time = repair;
+  dist_compile(&m->repair_time);
+}
 
-char *status_str(enum WorkerStatus s) {
-  switch (s) {
+// Counts down a working machine, returning true once its batch is done
+// and needs finish_machine_batch(). Only touches the machine's hot part;
+// a working machine always has a work order and a worker.
+bool count_down_machine(MachineHot *m) {
+  if (m->working) {
 
-  case W_IDLE: {
-    strcpy(_status, "W_IDLE");
-    break;
+    LOG_DEBUG(LOG_MACHINE, "machine is working...");
+    if (m->job_time_left > 0) {
+      m->job_time_left--;
+    } else {
+      return true;
+    }
   }
+  return false;
+}
 
-  case W_CANT_PROCEED: {
-    strcpy(_status, "W_CANT_PROCEED");
-    break;
-  }
+void finish_machine_batch(GameState *gs, Machine *m) {
+  complete_production_job(gs, m);
 
-  case W_CARRYING: {
-    strcpy(_status, "W_CARRYING");
-    break;
-  }
+  LOG_DEBUG(LOG_MACHINE, "Machine %d produced output:", m->id);
 
-  case W_PRODUCING: {
-    strcpy(_status, "W_PRODUCING");
-    break;
+  for (int p = 0; p < PM_COUNT; p++) {
+    if (inventory_has(&m->output_buffer, p))
+      LOG_DEBUG(LOG_MACHINE, "\t%s: %d", material_str(p),
+                m->output_buffer.count[p]);
   }
+}
 
-  case W_MOVING: {
-    strcpy(_status, "W_MOVING");
-    break;
-  }
-  }
+/* -------------
+ * WORKERS
+ * ------------- */
+
+Worker *get_worker_by_id(const GameState *gs, int id) {
+  return CHUNK_ITEM(gs->workers, Worker, id);
+}
 
-  return _status;
+const char *status_str(enum WorkerStatus s) {
+  switch (s) {
+  case W_IDLE:
+    return "W_IDLE";
+  case W_CANT_PROCEED:
+    return "W_CANT_PROCEED";
+  case W_CARRYING:
+    return "W_CARRYING";
+  case W_PRODUCING:
+    return "W_PRODUCING";
+  case W_MOVING:
+    return "W_MOVING";
+  }
+
+  return "";
 }
 
 void print_worker(const Worker *w) {
   printf("DEBUG: Summary for W%d: ", w->id);
-  printf("\tJOB: %s", job_str(w->job));
-  printf("\tSTATUS: %s", status_str(w->status));
+  printf("\tJOB: %s", job_str(w->hot->job));
+  printf("\tSTATUS: %s", status_str(w->hot->status));
   printf("\n");
   printf("\t target material: %d %s\n", w->target_count,
          material_str(w->target_material));
 }
 
-int first_idle_worker(void) {
-  for (int i = 0; i < game.c_workers; i++) {
-    if (game.workers[i].status == W_IDLE)
-      return game.workers[i].id;
+// Idle workers are kept in a dense set, so there's always a cheap
+// answer to "is anyone idle", and in the grid's per-block lists that
+// nearest_idle_worker() searches.
+void idle_set_add(GameState *gs, Worker *w) {
+  gs->idle_workers = grow_array(gs->idle_workers, &gs->cap_idle, gs->c_idle + 1,
+                                sizeof(int));
+  w->idle_slot = gs->c_idle;
+  gs->idle_workers[gs->c_idle++] = w->id;
+  block_link_idle(gs, w);
+}
+
+void idle_set_remove(GameState *gs, Worker *w) {
+  block_unlink_idle(gs, w);
+  int last = gs->idle_workers[--gs->c_idle];
+  gs->idle_workers[w->idle_slot] = last;
+  get_worker_by_id(gs, last)->idle_slot = w->idle_slot;
+  w->idle_slot = -1;
+}
+
+void set_worker_status(GameState *gs, Worker *w, enum WorkerStatus status) {
+  if (w->hot->status == W_IDLE && status != W_IDLE) {
+    idle_set_remove(gs, w);
+  } else if (w->hot->status != W_IDLE && status == W_IDLE) {
+    idle_set_add(gs, w);
   }
-  return -1;
+  w->hot->status = status;
 }
 
-int add_worker(void) {
-  int id = game.c_workers;
+// Distance from `to` to the nearest tile of the `size` x `size` square
+// with its top left corner at (x0, y0).
+int distance_to_square(Vector to, int x0, int y0, int size) {
+  int x1 = x0 + size - 1;
+  int y1 = y0 + size - 1;
+  int dx = (to.x < x0) ? x0 - to.x : (to.x > x1) ? to.x - x1 : 0;
+  int dy = (to.y < y0) ? y0 - to.y : (to.y > y1) ? to.y - y1 : 0;
+  return dx + dy;
+}
 
-  if (id > MAX_WORKERS) {
-    printf("ERROR: Exceeded maximum workers\n");
-    exit(1);
+struct IdleSearch {
+  Vector to;
+  int best;
+  int best_distance;
+};
+
+// Looks for a better idle worker under cell (x, y) of `level` of the
+// idle count pyramid. Cells with nobody idle under them, or too far
+// away to beat the best so far, are passed over whole. Otherwise the
+// four cells below are searched nearest first, so a close answer turns
+// up early and rules out the rest.
+void search_idle(GameState *gs, struct IdleSearch *s, int level, int x,
+                 int y) {
+  const TileGrid *g = &gs->grid;
+  int width;
+  int height;
+  int offset = idle_level(g, level, &width, &height);
+  if (x >= width || y >= height || g->idle_count[offset + y * width + x] == 0)
+    return;
+
+  int shift = level + IDLE_BLOCK_BITS;
+  if (distance_to_square(s->to, x << shift, y << shift, 1 << shift) >
+      s->best_distance)
+    return;
+
+  if (level == 0) {
+    for (int id = g->idle_in_block[y * g->block_width + x]; id != -1;) {
+      const WorkerHot *h = get_worker_hot(gs, id);
+      int d = abs(h->location.x - s->to.x) + abs(h->location.y - s->to.y);
+      if (d < s->best_distance || (d == s->best_distance && id < s->best)) {
+        s->best = id;
+        s->best_distance = d;
+      }
+      id = h->idle_next;
+    }
+    return;
+  }
+
+  int child[4];
+  int bound[4];
+  for (int i = 0; i < 4; i++) {
+    int cx = 2 * x + (i & 1);
+    int cy = 2 * y + (i >> 1);
+    int d = distance_to_square(s->to, cx << (shift - 1), cy << (shift - 1),
+                               1 << (shift - 1));
+    int j = i;
+    for (; j > 0 && bound[j - 1] > d; j--) {
+      child[j] = child[j - 1];
+      bound[j] = bound[j - 1];
+    }
+    child[j] = i;
+    bound[j] = d;
+  }
+  for (int i = 0; i < 4; i++) {
+    search_idle(gs, s, level - 1, 2 * x + (child[i] & 1),
+                2 * y + (child[i] >> 1));
+  }
+}
+
+// Checks the workers on one tile, keeping the idle one with the lowest
+// id.
+void closest_idle_on_tile(GameState *gs, int x, int y, int *best) {
+  int t = tile_index(gs, x, y);
+  if (t == -1)
+    return;
+
+  for (int id = gs->grid.workers[t]; id != -1;
+       id = get_worker_by_id(gs, id)->next_on_tile) {
+    if (get_worker_by_id(gs, id)->hot->status == W_IDLE &&
+        (*best == -1 || id < *best))
+      *best = id;
+  }
+}
+
+// Tiles nearer than this are searched ring by ring before the pyramid,
+// since on a busy floor someone idle is usually that close.
+#define IDLE_RING_RADIUS 4
+
+// The idle worker closest to `to` (by Manhattan distance, ties to the
+// lowest id), or -1 if nobody is idle. Searches the few tiles around
+// `to` ring by ring, then does a branch and bound search down the idle
+// count pyramid. That costs a walk from the top to the blocks near the
+// answer, plus the idle workers in blocks near enough to hold a tie,
+// however many are idle elsewhere.
+int nearest_idle_worker(GameState *gs, Vector to) {
+  if (gs->c_idle == 0 || gs->grid.idle_levels == 0)
+    return -1;
+
+  for (int r = 0; r < IDLE_RING_RADIUS; r++) {
+    int best = -1;
+    for (int dx = -r; dx <= r; dx++) {
+      int dy = r - abs(dx);
+      closest_idle_on_tile(gs, to.x + dx, to.y + dy, &best);
+      if (dy != 0)
+        closest_idle_on_tile(gs, to.x + dx, to.y - dy, &best);
+    }
+    if (best != -1)
+      return best;
   }
 
-  game.workers[id] = (Worker){.id = id,
-                              .status = W_IDLE,
-                              .location = {0, 0},
-                              .target = {0, 0},
-                              .carrying_count = 0};
+  struct IdleSearch s = {.to = to, .best = -1, .best_distance = INT_MAX};
+  search_idle(gs, &s, gs->grid.idle_levels - 1, 0, 0);
+  return s.best;
+}
+
+Vector object_location(GameState *gs, ObjectReference o) {
+  switch (o.object_type) {
+  case O_MACHINE:
+    return get_machine_by_id(gs, o.id)->location;
+  case O_STOCKPILE:
+    return get_stockpile_by_id(gs, o.id)->location;
+  case O_WORKER:
+    return get_worker_by_id(gs, o.id)->hot->location;
+  case O_NOTHING:
+  case O_WALL:
+    break;
+  }
+  return (Vector){0, 0};
+}
 
-  game.c_workers++;
+int add_worker(GameState *gs) {
+  int id = gs->c_workers;
+  Worker *w = new_worker(gs, id);
+  *w->hot = (WorkerHot){.status = W_IDLE, .location = {-1, -1}};
+  *w = (Worker){.hot = w->hot,
+                .id = id,
+                .carrying_count = 0,
+                .next_on_tile = -1,
+                .idle_slot = -1,
+                .rng = entity_rng(gs, RNG_STREAM_WORKER, id)};
+
+  gs->c_workers++;
+  move_worker(gs, w, (Vector){0, 0});
+  idle_set_add(gs, w);
 
   return id;
 }
 
-void worker_take_job(int worker_id, struct JobQueueItem jq) {
-  Worker *w = get_worker_by_id(worker_id);
+void worker_take_job(GameState *gs, int worker_id, struct JobQueueItem jq) {
+  Worker *w = get_worker_by_id(gs, worker_id);
 
   char mb[256] = {0};
 
   switch (jq.job) {
   case JOB_MAN_MACHINE: {
-    Machine *m = get_machine_by_id(jq.object.id);
+    Machine *m = get_machine_by_id(gs, jq.object.id);
 
-    w->target = m->location;
+    w->hot->target = m->location;
 
-    w->job = jq.job;
+    w->hot->job = jq.job;
     w->job_target = jq.object;
-    w->status = W_MOVING;
+    set_worker_status(gs, w, W_MOVING);
 
     m->worker = worker_id;
 
-    printf("DEBUG: W:%d took job to to man machine %d\n", worker_id, m->id);
+    LOG_DEBUG(LOG_JOBS, "W:%d took job to to man machine %d", worker_id,
+              m->id);
     sprintf(mb, "DEBUG: assigning W:%d to man machine %d\n", worker_id,
             m->id);
-    add_message(mb);
+    add_message(gs, mb);
 
     break;
   }
   case JOB_EMPTY_OUTPUT_BUFFER: {
-    Machine *m = get_machine_by_id(jq.object.id);
-    w->target = m->location;
-    w->status = W_MOVING;
-    w->job = jq.job;
+    Machine *m = get_machine_by_id(gs, jq.object.id);
+    w->hot->target = m->location;
+    set_worker_status(gs, w, W_MOVING);
+    w->hot->job = jq.job;
     sprintf(mb, "DEBUG: assigning W%d to empty machine %d\n", worker_id,
             m->id);
-    printf("DEBUG: W%d took job to empty machine %d\n", worker_id, m->id);
-    add_message(mb);
+    LOG_DEBUG(LOG_JOBS, "W%d took job to empty machine %d", worker_id, m->id);
+    add_message(gs, mb);
     break;
   }
   case JOB_REPLENISH_STOCKPILE: {
@@ -978,34 +1589,35 @@ void worker_take_job(int worker_id, struct JobQueueItem jq) {
 void worker_pickup_output(Worker *w, Machine *m) {
   // printf("DEBUG: %d\n", m->outputs);
   // printf("DEBUG: %d\n", m->output_buffer[0]);
-  m->c_output_buffer--;
-  int o = m->c_output_buffer;
-  ProductionMaterial mat = m->output_buffer[o];
-  int mat_count = m->output_buffer_count[o];
+  // Outputs are carried off one material at a time, lowest first.
+  ProductionMaterial mat = 0;
+  while (!inventory_has(&m->output_buffer, mat)) {
+    mat++;
+  }
+  int mat_count = m->output_buffer.count[mat];
+  inventory_add(&m->output_buffer, mat, -mat_count);
   w->carrying = mat;
   w->carrying_count = mat_count;
-  printf("DEBUG: W%d picked up %d %s from %d\n", w->id, mat_count,
-         material_str(mat), m->id);
+  LOG_DEBUG(LOG_WORKER, "W%d picked up %d %s from %d", w->id, mat_count,
+            material_str(mat), m->id);
 }
 
 void worker_drop_material_at_machine(Worker *w, Machine *m) {
   // printf("DEBUG: %d\n", m->outputs);
   // printf("DEBUG: %d\n", m->output_buffer[0]);
 
-  int i = m->c_input_buffer;
-  m->input_buffer[i] = w->carrying;
-  m->input_buffer_count[i] = w->carrying_count;
+  ProductionMaterial p = w->carrying;
+  inventory_add(&m->input_buffer, p, w->carrying_count);
 
   w->carrying = -1;
   w->carrying_count = 0;
 
-  m->c_input_buffer++;
-  printf("DEBUG: W%d dropped %d %s to machine %d\n", w->id,
-         m->input_buffer_count[i], material_str(m->input_buffer[i]), m->id);
+  LOG_DEBUG(LOG_WORKER, "W%d dropped %d %s to machine %d", w->id,
+            m->input_buffer.count[p], material_str(p), m->id);
 }
 
-void worker_pickup_from_stockpile(Worker *w, Stockpile *s, ProductionMaterial p,
-                                  int count) {
+void worker_pickup_from_stockpile(GameState *gs, Worker *w, Stockpile *s,
+                                  ProductionMaterial p, int count) {
   int mis = material_in_stockpile(s, p);
   // printf("DEBUG: W:%d getting %d %s from S:%d. There is %d\n", w->id, count,
   //        material_str(p), s->id, mis);
@@ -1017,36 +1629,37 @@ void worker_pickup_from_stockpile(Worker *w, Stockpile *s, ProductionMaterial p,
   } else {
     w->carrying_count = count;
     w->carrying = p;
-    remove_material_from_stockpile(s, p, count);
-    printf("DEBUG: W%d picked up %d %s from stockpile %d. There are %d left, "
-           "of which %d are free.\n",
-           w->id, count, material_str(p), s->id, material_in_stockpile(s, p),
-           free_material_in_stockpile(s, p));
+    remove_material_from_stockpile(gs, s, p, count);
+    LOG_DEBUG(LOG_WORKER,
+              "W%d picked up %d %s from stockpile %d. There are %d left, "
+              "of which %d are free.",
+              w->id, count, material_str(p), s->id,
+              material_in_stockpile(s, p), free_material_in_stockpile(s, p));
   }
 }
 
-void worker_drop_at_stockpile(Worker *w, Stockpile *s) {
-  printf("%ld: W:%d dropped %d %s at S%d\n", game.turn, w->id,
-         w->carrying_count, material_str(w->carrying), s->id);
+void worker_drop_at_stockpile(GameState *gs, Worker *w, Stockpile *s) {
+  LOG_DEBUG(LOG_WORKER, "%ld: W:%d dropped %d %s at S%d", gs->turn, w->id,
+            w->carrying_count, material_str(w->carrying), s->id);
 
-  add_material_to_stockpile(s, w->carrying, w->carrying_count);
+  add_material_to_stockpile(gs, s, w->carrying, w->carrying_count);
 
   w->carrying = NONE;
   w->carrying_count = 0;
 }
 
-void tick_worker(Worker *w) {
-  if (w->status == W_CANT_PROCEED) {
+void tick_worker(GameState *gs, Worker *w) {
+  if (w->hot->status == W_CANT_PROCEED) {
     // if the worker is in the 'stuck' status, they should check if
     // they can now complete the assigned job. If circumstances have
     // changed, they should continue with their intended task.
     // Otherwise they should continue to hold.
     // TODO: not implemented yet.
 
-    switch (w->job) {
+    switch (w->hot->job) {
     default:
       printf("ERROR: W:%d has 'Can't proceed' status with job %s\n", w->id,
-             job_str(w->job));
+             job_str(w->hot->job));
       exit(1);
     }
 
@@ -1056,47 +1669,48 @@ void tick_worker(Worker *w) {
   // If the worker isn't at the destination, move towards the
   // destination
 
-  if (!vec_equal(w->location, w->target)) {
-    w->location = vec_move_towards(w->location, w->target);
+  if (!vec_equal(w->hot->location, w->hot->target)) {
+    advance_worker(gs, w, 1);
     return;
   }
 
   // Worker is at its destination
-  switch (w->job) {
+  switch (w->hot->job) {
   case JOB_EMPTY_OUTPUT_BUFFER: {
 
-    if (w->status == W_CARRYING) {
-      Machine *m = get_machine_by_id(w->job_target.id);
-      Stockpile *s = get_stockpile_by_id(m->output_stockpile);
-      worker_drop_at_stockpile(w, s);
+    if (w->hot->status == W_CARRYING) {
+      Machine *m = get_machine_by_id(gs, w->job_target.id);
+      Stockpile *s = get_stockpile_by_id(gs, m->output_stockpile);
+      worker_drop_at_stockpile(gs, w, s);
 
-      if (m->c_output_buffer == 0) {
-        w->status = W_IDLE;
-        w->job = JOB_NONE;
-        w->target = (Vector){15, 0};
+      if (m->output_buffer.present == 0) {
+        set_worker_status(gs, w, W_IDLE);
+        w->hot->job = JOB_NONE;
+        w->hot->target = (Vector){15, 0};
       } else {
-        w->status = W_MOVING;
-        w->target = m->location;
+        set_worker_status(gs, w, W_MOVING);
+        w->hot->target = m->location;
       }
 
-    } else if (w->status == W_MOVING) {
-      Machine *m = get_machine_by_id(w->job_target.id);
-      Stockpile *s = get_stockpile_by_id(m->output_stockpile);
+    } else if (w->hot->status == W_MOVING) {
+      Machine *m = get_machine_by_id(gs, w->job_target.id);
+      Stockpile *s = get_stockpile_by_id(gs, m->output_stockpile);
       worker_pickup_output(w, m);
-      w->status = W_CARRYING;
-      w->target = s->location;
+      set_worker_status(gs, w, W_CARRYING);
+      w->hot->target = s->location;
     } else {
-      printf("ERROR: Unhandled worker status %d for empty output buffer job\n",
-             w->status);
+      LOG_ERROR(LOG_WORKER,
+                "Unhandled worker status %d for empty output buffer job",
+                w->hot->status);
     }
 
   } break;
 
   case JOB_FILL_INPUT_BUFFER: {
-    Machine *m = get_machine_by_id(w->job_target.id);
-    Stockpile *s = get_stockpile_by_id(m->input_stockpile);
+    Machine *m = get_machine_by_id(gs, w->job_target.id);
+    Stockpile *s = get_stockpile_by_id(gs, m->input_stockpile);
 
-    if (w->status == W_CARRYING) {
+    if (w->hot->status == W_CARRYING) {
       worker_drop_material_at_machine(w, m);
       MaterialCount mc = next_unfullfilled_material(m, m->active_recipe);
       if (mc.count > 0) { // the machine requires more materials
@@ -1106,67 +1720,72 @@ void tick_worker(Worker *w) {
                  "stockpile to make a machine run is not handled\n");
           exit(1);
         }
-        w->status = W_MOVING;
-        w->target = s->location;
+        set_worker_status(gs, w, W_MOVING);
+        w->hot->target = s->location;
       } else { // machine has what it needs
-        printf("DEBUG: Machine has what it needs, switching to producing\n");
+        LOG_DEBUG(LOG_WORKER, "Machine has what it needs, switching to "
+                              "producing");
         m->worker = w->id;
-        start_production_job(m);
-        w->job = JOB_MAN_MACHINE;
-        w->status = W_PRODUCING;
+        start_production_job(gs, m);
+        w->hot->job = JOB_MAN_MACHINE;
+        set_worker_status(gs, w, W_PRODUCING);
       }
-    } else if (w->status == W_MOVING) {
+    } else if (w->hot->status == W_MOVING) {
       // The worker has reached the input stockpile of the machine and will try
       // to pick up the material required.
       MaterialCount mc = next_unfullfilled_material(m, m->active_recipe);
       int mis = material_in_stockpile(s, mc.material);
 
       if (mis >= mc.count) {
-        worker_pickup_from_stockpile(w, s, mc.material, mc.count);
-        w->target = m->location;
-        w->status = W_CARRYING;
+        worker_pickup_from_stockpile(gs, w, s, mc.material, mc.count);
+        w->hot->target = m->location;
+        set_worker_status(gs, w, W_CARRYING);
       } else {
-        printf("DEBUG: W%d tried to pick up material from stockpile, but "
-               "there wasn't enough in it.\n",
-               w->id);
-        w->status = W_CANT_PROCEED;
+        LOG_DEBUG(LOG_WORKER,
+                  "W%d tried to pick up material from stockpile, but "
+                  "there wasn't enough in it.",
+                  w->id);
+        set_worker_status(gs, w, W_CANT_PROCEED);
       }
     } else {
-      printf("ERROR: Unhandled worker status %d for fill input buffer job\n",
-             w->status);
+      LOG_ERROR(LOG_WORKER,
+                "Unhandled worker status %d for fill input buffer job",
+                w->hot->status);
     }
 
     break;
 
   case JOB_MAN_MACHINE: {
-    if (w->status == W_PRODUCING) {
+    if (w->hot->status == W_PRODUCING) {
       return;
     }
-    Machine *m = get_machine_by_id(w->job_target.id);
+    Machine *m = get_machine_by_id(gs, w->job_target.id);
 
     if (machine_has_required_inputs(m, m->active_recipe)) {
-      start_production_job(m);
-      w->status = W_PRODUCING;
+      start_production_job(gs, m);
+      set_worker_status(gs, w, W_PRODUCING);
       return;
     }
 
-    w->job = JOB_FILL_INPUT_BUFFER;
-    w->status = W_MOVING;
-    Stockpile *s = get_stockpile_by_id(m->input_stockpile);
-    w->target = s->location;
+    w->hot->job = JOB_FILL_INPUT_BUFFER;
+    set_worker_status(gs, w, W_MOVING);
+    Stockpile *s = get_stockpile_by_id(gs, m->input_stockpile);
+    w->hot->target = s->location;
   }
 
   break;
 
   case JOB_REPLENISH_STOCKPILE: {
-    if (w->status == W_MOVING) {
-      Stockpile *s = get_stockpile_by_id(w->job_target_secondary.id);
+    if (w->hot->status == W_MOVING) {
+      Stockpile *s = get_stockpile_by_id(gs, w->job_target_secondary.id);
       // worker reached stockpile and will pick up (and un-earmark) material
-      earmark_material_in_stockpile(s, w->target_material, (-w->target_count));
-      worker_pickup_from_stockpile(w, s, w->target_material, w->target_count);
+      earmark_material_in_stockpile(gs, s, w->target_material,
+                                    (-w->target_count));
+      worker_pickup_from_stockpile(gs, w, s, w->target_material,
+                                   w->target_count);
 
-      w->target = get_stockpile_by_id(w->job_target.id)->location;
-      w->status = W_CARRYING;
+      w->hot->target = get_stockpile_by_id(gs, w->job_target.id)->location;
+      set_worker_status(gs, w, W_CARRYING);
 
       w->target_material = NONE;
       w->target_count = 0;
@@ -1174,15 +1793,15 @@ void tick_worker(Worker *w) {
       return;
     }
 
-    if (w->status == W_CARRYING) {
-      Stockpile *s = get_stockpile_by_id(w->job_target.id);
-      complete_replenishment_order(w->job_id, w->carrying_count);
-      worker_drop_at_stockpile(w, s);
+    if (w->hot->status == W_CARRYING) {
+      Stockpile *s = get_stockpile_by_id(gs, w->job_target.id);
+      complete_replenishment_order(gs, w->job_id, w->carrying_count);
+      worker_drop_at_stockpile(gs, w, s);
 
-      w->job = JOB_NONE;
+      w->hot->job = JOB_NONE;
       w->job_id = -1;
       w->job_target.object_type = O_NOTHING;
-      w->status = W_IDLE;
+      set_worker_status(gs, w, W_IDLE);
 
       return;
     }
@@ -1198,56 +1817,528 @@ void tick_worker(Worker *w) {
 }
 
 /* -------------
- * GAME
+ * TILE GRID
+ * ------------- */
+
+#define INITIAL_GRID_SIZE 16
+
+int tile_index(GameState *gs, int x, int y) {
+  if (x < 0 || y < 0 || x >= gs->grid.width || y >= gs->grid.height)
+    return -1;
+  return y * gs->grid.width + x;
+}
+
+// Machines take precedence over stockpiles on a shared tile, and
+// otherwise the first object placed keeps it, which matches the order
+// object_under_point() has always reported them in.
+void grid_stamp(GameState *gs, ObjectReference o, Vector location,
+                Vector size) {
+  grid_ensure(gs, location.x + size.x, location.y + size.y);
+
+  for (int x = location.x; x < location.x + size.x; x++) {
+    for (int y = location.y; y < location.y + size.y; y++) {
+      int i = tile_index(gs, x, y);
+      if (i == -1)
+        continue;
+
+      ObjectReference *tile = &gs->grid.statics[i];
+      if (tile->object_type == O_NOTHING ||
+          (tile->object_type == O_STOCKPILE && o.object_type == O_MACHINE)) {
+        *tile = o;
+      }
+      if (o.object_type == O_MACHINE) {
+        gs->grid.blocked[i] |= TILE_MACHINE;
+      }
+    }
+  }
+}
+
+void grid_add_machine(GameState *gs, const Machine *m) {
+  grid_stamp(gs, (ObjectReference){O_MACHINE, m->id}, m->location, m->size);
+}
+
+void grid_add_stockpile(GameState *gs, const Stockpile *s) {
+  grid_stamp(gs, (ObjectReference){O_STOCKPILE, s->id}, s->location, s->size);
+}
+
+void grid_link_worker(GameState *gs, Worker *w) {
+  int i = tile_index(gs, w->hot->location.x, w->hot->location.y);
+  w->next_on_tile = -1;
+  if (i == -1)
+    return;
+
+  int *link = &gs->grid.workers[i];
+  while (*link != -1 && *link < w->id) {
+    link = &get_worker_by_id(gs, *link)->next_on_tile;
+  }
+  w->next_on_tile = *link;
+  *link = w->id;
+  if (w->idle_slot != -1)
+    block_link_idle(gs, w);
+}
+
+void grid_unlink_worker(GameState *gs, Worker *w) {
+  int i = tile_index(gs, w->hot->location.x, w->hot->location.y);
+  if (i == -1)
+    return;
+
+  int *link = &gs->grid.workers[i];
+  while (*link != w->id) {
+    link = &get_worker_by_id(gs, *link)->next_on_tile;
+  }
+  *link = w->next_on_tile;
+  w->next_on_tile = -1;
+  if (w->idle_slot != -1)
+    block_unlink_idle(gs, w);
+}
+
+// Where `level` of the idle count pyramid starts in idle_count, and
+// its size in cells. Level 0 has a cell per block, and each level up
+// halves both ways, rounding up, until a single cell covers the floor.
+int idle_level(const TileGrid *g, int level, int *width, int *height) {
+  int offset = 0;
+  int w = g->block_width;
+  int h = g->block_height;
+  for (int l = 0; l < level; l++) {
+    offset += w * h;
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+  *width = w;
+  *height = h;
+  return offset;
+}
+
+// Adds `delta` to the idle count of block (bx, by) and every cell
+// above it.
+void count_idle(TileGrid *g, int bx, int by, int delta) {
+  int offset = 0;
+  int w = g->block_width;
+  int h = g->block_height;
+  for (int l = 0; l < g->idle_levels; l++) {
+    g->idle_count[offset + (by >> l) * w + (bx >> l)] += delta;
+    offset += w * h;
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+}
+
+WorkerHot *get_worker_hot(GameState *gs, int id) {
+  return CHUNK_ITEM(gs->worker_hot, WorkerHot, id);
+}
+
+void block_link_idle(GameState *gs, Worker *w) {
+  TileGrid *g = &gs->grid;
+  WorkerHot *h = w->hot;
+  h->idle_next = -1;
+  h->idle_prev = -1;
+  if (tile_index(gs, h->location.x, h->location.y) == -1)
+    return;
+
+  int bx = h->location.x >> IDLE_BLOCK_BITS;
+  int by = h->location.y >> IDLE_BLOCK_BITS;
+  int *head = &g->idle_in_block[by * g->block_width + bx];
+  if (*head != -1)
+    get_worker_hot(gs, *head)->idle_prev = w->id;
+  h->idle_next = *head;
+  *head = w->id;
+  count_idle(g, bx, by, 1);
+}
+
+void block_unlink_idle(GameState *gs, Worker *w) {
+  TileGrid *g = &gs->grid;
+  WorkerHot *h = w->hot;
+  if (tile_index(gs, h->location.x, h->location.y) == -1)
+    return;
+
+  int bx = h->location.x >> IDLE_BLOCK_BITS;
+  int by = h->location.y >> IDLE_BLOCK_BITS;
+  if (h->idle_prev != -1)
+    get_worker_hot(gs, h->idle_prev)->idle_next = h->idle_next;
+  else
+    g->idle_in_block[by * g->block_width + bx] = h->idle_next;
+  if (h->idle_next != -1)
+    get_worker_hot(gs, h->idle_next)->idle_prev = h->idle_prev;
+  h->idle_next = -1;
+  h->idle_prev = -1;
+  count_idle(g, bx, by, -1);
+}
+
+// Grows the grid to at least width x height. Everything is re-indexed
+// from the entity arrays, which is fine since the floor only grows a
+// handful of times.
+void grid_ensure(GameState *gs, int width, int height) {
+  TileGrid *g = &gs->grid;
+  if (width <= g->width && height <= g->height)
+    return;
+
+  int new_width = (g->width > 0) ? g->width : INITIAL_GRID_SIZE;
+  int new_height = (g->height > 0) ? g->height : INITIAL_GRID_SIZE;
+  while (new_width < width)
+    new_width *= 2;
+  while (new_height < height)
+    new_height *= 2;
+
+  size_t tiles = (size_t)new_width * new_height;
+  unsigned char *old_blocked = g->blocked;
+  int old_width = g->width;
+  int old_height = g->height;
+
+  int block_width = (new_width + IDLE_BLOCK - 1) >> IDLE_BLOCK_BITS;
+  int block_height = (new_height + IDLE_BLOCK - 1) >> IDLE_BLOCK_BITS;
+  size_t blocks = (size_t)block_width * block_height;
+  size_t cells = blocks;
+  int levels = 1;
+  for (int w = block_width, h = block_height; w > 1 || h > 1; levels++) {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    cells += (size_t)w * h;
+  }
+
+  free(g->statics);
+  free(g->workers);
+  free(g->idle_in_block);
+  free(g->idle_count);
+  g->statics = malloc(tiles * sizeof(ObjectReference));
+  g->workers = malloc(tiles * sizeof(int));
+  g->blocked = calloc(tiles, sizeof(unsigned char));
+  g->idle_in_block = malloc(blocks * sizeof(int));
+  g->idle_count = calloc(cells, sizeof(int));
+  if (!g->statics || !g->workers || !g->blocked || !g->idle_in_block ||
+      !g->idle_count) {
+    printf("ERROR: Couldn't allocate %dx%d tile grid\n", new_width,
+           new_height);
+    exit(1);
+  }
+  g->width = new_width;
+  g->height = new_height;
+  g->block_width = block_width;
+  g->block_height = block_height;
+  g->idle_levels = levels;
+
+  for (size_t i = 0; i < tiles; i++) {
+    g->workers[i] = -1;
+  }
+  for (size_t i = 0; i < blocks; i++) {
+    g->idle_in_block[i] = -1;
+  }
+
+  // Walls only exist on the grid, so carry them over.
+  for (int y = 0; y < old_height; y++) {
+    for (int x = 0; x < old_width; x++) {
+      g->blocked[y * new_width + x] = old_blocked[y * old_width + x] & TILE_WALL;
+    }
+  }
+  free(old_blocked);
+
+  grid_stamp_objects(gs);
+  for (int i = 0; i < gs->c_workers; i++) {
+    grid_link_worker(gs, get_worker_by_id(gs, i));
+  }
+}
+
+// Clears machines and stockpiles off the grid and stamps them again
+// where they are now, leaving walls be.
+void grid_stamp_objects(GameState *gs) {
+  TileGrid *g = &gs->grid;
+  size_t tiles = (size_t)g->width * g->height;
+  for (size_t i = 0; i < tiles; i++) {
+    g->statics[i] = (ObjectReference){O_NOTHING, -1};
+    g->blocked[i] &= TILE_WALL;
+  }
+
+  for (int i = 0; i < gs->c_machines; i++) {
+    grid_add_machine(gs, get_machine_by_id(gs, i));
+  }
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    grid_add_stockpile(gs, get_stockpile_by_id(gs, i));
+  }
+}
+
+void move_worker(GameState *gs, Worker *w, Vector to) {
+  if (vec_equal(w->hot->location, to))
+    return;
+
+  grid_ensure(gs, to.x + 1, to.y + 1);
+  grid_unlink_worker(gs, w);
+  w->hot->location = to;
+  grid_link_worker(gs, w);
+}
+
+ObjectReference object_under_point(GameState *gs, int x, int y) {
+  int i = tile_index(gs, x, y);
+  if (i == -1)
+    return (ObjectReference){O_NOTHING, -1};
+
+  if (gs->grid.workers[i] != -1)
+    return (ObjectReference){O_WORKER, gs->grid.workers[i]};
+
+  return gs->grid.statics[i];
+}
+
+// True if no machine, stockpile or wall covers any tile of the
+// rectangle. Workers don't count, they'll walk out of the way.
+// The floor is anchored at (0, 0) and only grows right and down, so
+// anything at negative coordinates would never be stamped on the grid,
+// found under the cursor or walked around.
+bool area_on_floor(int x, int y, int w, int h) {
+  return x >= 0 && y >= 0 && w > 0 && h > 0;
+}
+
+void check_placement(const char *what, int x, int y, int w, int h) {
+  if (!area_on_floor(x, y, w, h)) {
+    printf("ERROR: Can't place %s of %dx%d at (%d, %d), off the floor\n",
+           what, w, h, x, y);
+    exit(1);
+  }
+}
+
+bool area_is_free(GameState *gs, int x, int y, int w, int h) {
+  if (!area_on_floor(x, y, w, h))
+    return false;
+
+  for (int tx = x; tx < x + w; tx++) {
+    for (int ty = y; ty < y + h; ty++) {
+      int i = tile_index(gs, tx, ty);
+      if (i != -1 && (gs->grid.statics[i].object_type != O_NOTHING ||
+                      gs->grid.blocked[i] & TILE_WALL))
+        return false;
+    }
+  }
+  return true;
+}
+
+void add_wall(GameState *gs, int x, int y, int w, int h) {
+  check_placement("wall", x, y, w, h);
+  grid_ensure(gs, x + w, y + h);
+
+  for (int tx = x; tx < x + w; tx++) {
+    for (int ty = y; ty < y + h; ty++) {
+      int i = tile_index(gs, tx, ty);
+      if (i != -1)
+        gs->grid.blocked[i] |= TILE_WALL;
+    }
+  }
+  gs->layout_version++;
+}
+
+bool tile_is_wall(GameState *gs, int x, int y) {
+  int i = tile_index(gs, x, y);
+  return i != -1 && (gs->grid.blocked[i] & TILE_WALL);
+}
+
+/* -------------
+ * PATHFINDING
  * ------------- */
 
-ObjectReference object_under_point(int x, int y) {
-  // Worker
-  for (int i = 0; i < game.c_workers; i++) {
-    Worker w = game.workers[i];
-    bool in_x_bound = (x == w.location.x);
-    bool in_y_bound = (y == w.location.y);
-    if (in_x_bound && in_y_bound)
-      return (ObjectReference){O_WORKER, w.id};
+// Searches are run from the pool threads, so each thread gets its own
+// scratch space. It's registered under a thread-specific key as well,
+// whose destructor frees it when the thread exits (pool helpers at
+// pool_shutdown(), the window's sim thread at sim_stop()).
+_Thread_local PathFinder *path_finder;
+pthread_key_t path_finder_key;
+pthread_once_t path_finder_once = PTHREAD_ONCE_INIT;
+
+void free_thread_path_finder(void *pf) {
+  free_path_finder(pf);
+  free(pf);
+}
+
+void make_path_finder_key(void) {
+  if (pthread_key_create(&path_finder_key, free_thread_path_finder) != 0) {
+    printf("ERROR: Couldn't create path finder key\n");
+    exit(1);
+  }
+}
+
+PathFinder *thread_path_finder(void) {
+  if (path_finder)
+    return path_finder;
+
+  pthread_once(&path_finder_once, make_path_finder_key);
+  path_finder = calloc(1, sizeof(PathFinder));
+  if (!path_finder || pthread_setspecific(path_finder_key, path_finder)) {
+    printf("ERROR: Couldn't allocate path finder\n");
+    exit(1);
+  }
+  return path_finder;
+}
+
+
+const FlowField *flow_field_to(GameState *gs, Vector goal) {
+  return get_flow_field(&gs->flow_cache, gs->grid.width, gs->grid.height,
+                        gs->grid.blocked, gs->layout_version, goal);
+}
+
+const FlowField *built_flow_field(GameState *gs, Vector goal) {
+  return peek_flow_field(&gs->flow_cache, gs->grid.width, gs->grid.height,
+                         gs->layout_version, goal);
+}
+
+bool worker_route_current(GameState *gs, const Worker *w) {
+  if (w->path_version != gs->layout_version ||
+      !vec_equal(w->path_target, w->hot->target))
+    return false;
+
+  if (w->route == ROUTE_SEARCH) {
+    Vector expected = (w->path_step == 0) ? w->path_start
+                                          : w->path.steps[w->path_step - 1];
+    return vec_equal(expected, w->hot->location);
+  }
+  return true;
+}
+
+bool target_is_object(GameState *gs, Vector target) {
+  int goal = tile_index(gs, target.x, target.y);
+  return goal != -1 && gs->grid.statics[goal].object_type != O_NOTHING;
+}
+
+// The part of routing that touches shared state: growing the grid to
+// cover the trip and building the flow field it needs. After this,
+// plan_worker_route() and worker_next_step() only touch the worker.
+void prepare_worker_route(GameState *gs, Worker *w) {
+  bool current = worker_route_current(gs, w);
+  Vector from = w->hot->location;
+  Vector to = w->hot->target;
+  if (!current) {
+    grid_ensure(gs, (from.x > to.x ? from.x : to.x) + 1,
+                (from.y > to.y ? from.y : to.y) + 1);
+  }
+  if (!target_is_object(gs, w->hot->target))
+    return;
+
+  if (!current) {
+    try_flow_field(&gs->flow_cache, gs->grid.width, gs->grid.height,
+                   gs->grid.blocked, gs->layout_version, w->hot->target,
+                   gs->flow_busy_since);
+  } else if (w->route == ROUTE_FLOW) {
+    flow_field_to(gs, w->hot->target);
+  }
+}
+
+// Works out a new route if the cached one is stale, following the flow
+// field to an object if prepare_worker_route() built one and searching
+// otherwise. Returns false if the worker is on a flow route whose field
+// isn't built, which only happens when prepare_worker_route() wasn't
+// called or the field was evicted since.
+bool plan_worker_route(GameState *gs, Worker *w) {
+  if (worker_route_current(gs, w)) {
+    return w->route != ROUTE_FLOW ||
+           built_flow_field(gs, w->hot->target) != NULL;
+  }
+
+  const FlowField *ff = target_is_object(
+      gs, w->hot->target) ? built_flow_field(gs, w->hot->target) : NULL;
+  if (ff) {
+    bool reachable = flow_distance(&gs->flow_cache, ff, gs->grid.blocked,
+                                   w->hot->location) != -1;
+    w->route = reachable ? ROUTE_FLOW : ROUTE_DIRECT;
+  } else if (find_path(thread_path_finder(), gs->grid.width, gs->grid.height,
+                       gs->grid.blocked, w->hot->location, w->hot->target,
+                       &w->path)) {
+    w->route = ROUTE_SEARCH;
+  } else {
+    w->route = ROUTE_DIRECT;
   }
+  w->path_step = 0;
+  w->path_start = w->hot->location;
+  w->path_target = w->hot->target;
+  w->path_version = gs->layout_version;
 
-  // Machine
-  for (int i = 0; i < game.c_machines; i++) {
-    Machine m = game.machines[i];
-    bool in_x_bound = (x >= m.location.x && x < (m.location.x + m.size.x));
-    bool in_y_bound = (y >= m.location.y && y < (m.location.y + m.size.y));
-    if (in_x_bound && in_y_bound)
-      return (ObjectReference){O_MACHINE, m.id};
+  if (w->route == ROUTE_DIRECT) {
+    LOG_DEBUG(LOG_WORKER, "W%d has no route to %d,%d, walking straight",
+              w->id, w->hot->target.x, w->hot->target.y);
   }
+  return true;
+}
 
-  // Stockpile
-  for (int i = 0; i < game.c_stockpile; i++) {
-    Stockpile s = game.stockpiles[i];
-    bool in_x_bound = (x >= s.location.x && x < (s.location.x + s.size.x));
-    bool in_y_bound = (y >= s.location.y && y < (s.location.y + s.size.y));
-    if (in_x_bound && in_y_bound)
-      return (ObjectReference){O_STOCKPILE, s.id};
+void ensure_worker_path(GameState *gs, Worker *w) {
+  if (worker_route_current(gs, w) && w->route != ROUTE_FLOW)
+    return;
+  prepare_worker_route(gs, w);
+  plan_worker_route(gs, w);
+}
+
+// The tile the worker moves to next, advancing its place on the route
+// but not moving it. Needs a current route from plan_worker_route().
+Vector worker_next_step(GameState *gs, Worker *w) {
+  switch (w->route) {
+  case ROUTE_SEARCH:
+    return w->path.steps[w->path_step++];
+  case ROUTE_FLOW:
+    return flow_step(&gs->flow_cache, built_flow_field(gs, w->hot->target),
+                     gs->grid.blocked, w->hot->location);
+  case ROUTE_DIRECT:
+    break;
   }
+  return vec_move_towards(w->hot->location, w->hot->target);
+}
 
-  return (ObjectReference){O_NOTHING, -1};
+int worker_steps_to_target(GameState *gs, Worker *w) {
+  ensure_worker_path(gs, w);
+  switch (w->route) {
+  case ROUTE_SEARCH:
+    return w->path.length - w->path_step;
+  case ROUTE_FLOW:
+    return flow_distance(&gs->flow_cache, built_flow_field(gs, w->hot->target),
+                         gs->grid.blocked, w->hot->location);
+  case ROUTE_DIRECT:
+    break;
+  }
+  return abs(w->hot->target.x - w->hot->location.x) +
+         abs(w->hot->target.y - w->hot->location.y);
 }
 
-void tick_game(void) {
+// Moves the worker `steps` tiles along its route. `steps` must not be
+// more than worker_steps_to_target().
+void advance_worker(GameState *gs, Worker *w, int steps) {
+  ensure_worker_path(gs, w);
+  switch (w->route) {
+  case ROUTE_SEARCH:
+    w->path_step += steps;
+    move_worker(gs, w, w->path.steps[w->path_step - 1]);
+    break;
+  case ROUTE_FLOW: {
+    const FlowField *ff = built_flow_field(gs, w->hot->target);
+    Vector at = w->hot->location;
+    for (int i = 0; i < steps; i++) {
+      at = flow_step(&gs->flow_cache, ff, gs->grid.blocked, at);
+    }
+    move_worker(gs, w, at);
+    break;
+  }
+  case ROUTE_DIRECT:
+    move_worker(gs, w,
+                vec_move_towards_n(w->hot->location, w->hot->target, steps));
+    break;
+  }
+}
+
+/* -------------
+ * GAME
+ * ------------- */
+
+void tick_game(GameState *gs) {
+  PROF_BEGIN(PROF_TICK);
+
   // check stockpiles for missing materials and, if necessary issue
   // replenishment order
-  for (int i = 0; i < game.c_stockpile; i++) {
-    update_replenishment_orders(&game.stockpiles[i]);
+  PROF_BEGIN(PROF_REPLENISHMENT_ORDERS);
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    const StockpileHot *h = CHUNK_ITEM(gs->stockpile_hot, StockpileHot, i);
+    if (h->required_material.present)
+      update_replenishment_orders(gs, get_stockpile_by_id(gs, i));
   }
+  PROF_END(PROF_REPLENISHMENT_ORDERS);
 
   // take replenishment jobs
-  int idle_worker = first_idle_worker();
-  int fro = next_fillable_replenishment_order();
+  PROF_BEGIN(PROF_REPLENISHMENT_MATCHING);
+  int fro = next_fillable_replenishment_order(gs);
 
-  while (idle_worker >= 0 && fro >= 0) {
-    Worker *w = get_worker_by_id(idle_worker);
-    struct ReplenishmentOrder *ro = get_replenishment_order(fro);
-    Stockpile *s =
-        find_stockpile_with_material((MaterialCount){ro->material, 1});
+  while (gs->c_idle > 0 && fro >= 0) {
+    struct ReplenishmentOrder *ro = get_replenishment_order(gs, fro);
+    Stockpile *s = find_stockpile_with_free_material(
+        gs, (MaterialCount){ro->material, 1});
 
     if (!s) {
       printf(
@@ -1255,44 +2346,313 @@ void tick_game(void) {
       exit(1);
     }
 
+    // Send whoever is closest to the stockpile they'll pick up from.
+    Worker *w = get_worker_by_id(gs, nearest_idle_worker(gs, s->location));
+
     int available = free_material_in_stockpile(s, ro->material);
-    int desire = ro->amount_ordered;
+    int desire = ro->amount_ordered - ro->amount_picked_up;
     int pickup = (available < desire) ? available : desire;
 
-    printf("DEBUG: W:%d is taking replenishment job %d:\n\t", w->id, fro);
-    debug_print_ro(ro);
-    printf("\tdesire: %d, available: %d\n", desire, available);
+    LOG_DEBUG(LOG_REPLENISHMENT, "W:%d is taking replenishment job %d:", w->id,
+              fro);
+    LOG_DEBUG(LOG_REPLENISHMENT,
+              "\tRO for S%d, order of %d %s (%d picked up).",
+              ro->ordering_stockpile, ro->amount_ordered,
+              material_str(ro->material), ro->amount_picked_up);
+    LOG_DEBUG(LOG_REPLENISHMENT, "\tdesire: %d, available: %d", desire,
+              available);
 
-    ro->amount_picked_up += pickup;
-    earmark_material_in_stockpile(s, ro->material, pickup);
+    earmark_material_in_stockpile(gs, s, ro->material, pickup);
+    pick_up_replenishment_order(gs, fro, pickup);
 
-    w->job = JOB_REPLENISH_STOCKPILE;
+    w->hot->job = JOB_REPLENISH_STOCKPILE;
     w->job_id = fro;
-    w->status = W_MOVING;
+    set_worker_status(gs, w, W_MOVING);
     w->job_target = (ObjectReference){O_STOCKPILE, ro->ordering_stockpile};
     w->job_target_secondary = (ObjectReference){O_STOCKPILE, s->id};
 
-    w->target = s->location;
+    w->hot->target = s->location;
     w->target_material = ro->material;
     w->target_count = pickup;
 
-    idle_worker = first_idle_worker();
-    fro = next_fillable_replenishment_order();
+    fro = next_fillable_replenishment_order(gs);
   }
+  PROF_END(PROF_REPLENISHMENT_MATCHING);
 
-  // take other jobs
-  while (idle_worker >= 0 && jobs_on_queue()) {
-    worker_take_job(idle_worker, pop_job());
-    idle_worker = first_idle_worker();
+  // take other jobs, most urgent first, each going to the closest idle
+  // worker
+  PROF_BEGIN(PROF_JOB_DISPATCH);
+  while (gs->c_idle > 0 && jobs_on_queue(gs)) {
+    struct JobQueueItem jq = pop_job(gs);
+    worker_take_job(gs, nearest_idle_worker(gs, object_location(gs, jq.object)),
+                    jq);
   }
+  PROF_END(PROF_JOB_DISPATCH);
+
+  PROF_BEGIN(PROF_MACHINES);
+  tick_machines(gs);
+  PROF_END(PROF_MACHINES);
+  PROF_BEGIN(PROF_WORKERS);
+  tick_workers(gs);
+  PROF_END(PROF_WORKERS);
+
+  gs->turn++;
+  PROF_END(PROF_TICK);
+}
+
+long inventory_total(const Inventory *inv) {
+  long total = 0;
+  for (int p = 0; p < PM_COUNT; p++) {
+    total += inv->count[p];
+  }
+  return total;
+}
 
-  for (int i = 0; i < game.c_machines; i++) {
-    tick_machine(&game.machines[i]);
+GameSample sample_game(GameState *gs) {
+  GameSample sample = {.queued_jobs = gs->c_job_queue,
+                       .busy_workers = gs->c_workers - gs->c_idle};
+
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    const Stockpile *s = get_stockpile_by_id(gs, i);
+    if (s->io == INPUT && s->attached_machine != -1)
+      sample.work_in_progress += inventory_total(&s->contents);
+  }
+  for (int i = 0; i < gs->c_machines; i++) {
+    const Machine *m = get_machine_by_id(gs, i);
+    sample.work_in_progress +=
+        inventory_total(&m->input_buffer) + inventory_total(&m->output_buffer);
+  }
+  for (int i = 0; i < gs->c_workers; i++) {
+    sample.work_in_progress += get_worker_by_id(gs, i)->carrying_count;
+  }
+  for (int p = 0; p < PM_COUNT; p++) {
+    sample.open_orders += gs->open_replenishment_orders[p].count;
+  }
+
+  return sample;
+}
+
+/* -------------
+ * PARALLEL PHASES
+ *
+ * Machines and workers are ticked in two phases. The first works out
+ * what each entity does on its own (machine countdowns, the next step
+ * of each walking worker) and runs on the thread pool. The second
+ * applies everything that touches shared state, serially in id order,
+ * so the result is the same as ticking one entity at a time whatever
+ * the number of threads.
+ * ------------- */
+
+#define PHASE_CHUNK 256
+
+enum WorkerIntent { INTENT_ACT, INTENT_STEP, INTENT_STEP_SERIAL };
+
+void count_down_machines(void *ctx, int begin, int end, int thread) {
+  GameState *gs = ctx;
+  (void)thread;
+  PROF_BEGIN(PROF_MACHINE_COUNTDOWN);
+  for (int i = begin; i < end; i++) {
+    gs->machine_done[i] =
+        count_down_machine(CHUNK_ITEM(gs->machine_hot, MachineHot, i));
+  }
+  PROF_END(PROF_MACHINE_COUNTDOWN);
+}
+
+void tick_machines(GameState *gs) {
+  gs->machine_done = grow_array(gs->machine_done, &gs->cap_machine_done,
+                                gs->c_machines, sizeof(unsigned char));
+  pool_run(gs->c_machines, PHASE_CHUNK, count_down_machines, gs);
+
+  for (int i = 0; i < gs->c_machines; i++) {
+    if (gs->machine_done[i])
+      finish_machine_batch(gs, get_machine_by_id(gs, i));
+  }
+}
+
+void step_workers(void *ctx, int begin, int end, int thread) {
+  GameState *gs = ctx;
+  (void)thread;
+  PROF_BEGIN(PROF_WORKER_STEPS);
+  for (int i = begin; i < end; i++) {
+    if (gs->worker_intent[i] != INTENT_STEP)
+      continue;
+
+    Worker *w = get_worker_by_id(gs, i);
+    if (plan_worker_route(gs, w)) {
+      gs->worker_step[i] = worker_next_step(gs, w);
+    } else {
+      gs->worker_intent[i] = INTENT_STEP_SERIAL;
+    }
+  }
+  PROF_END(PROF_WORKER_STEPS);
+}
+
+void tick_workers(GameState *gs) {
+  int cap = gs->cap_worker_intents;
+  gs->worker_intent = grow_array(gs->worker_intent, &cap, gs->c_workers,
+                                 sizeof(unsigned char));
+  gs->worker_step = grow_array(gs->worker_step, &gs->cap_worker_intents,
+                               gs->c_workers, sizeof(Vector));
+  gs->flow_busy_since = gs->flow_uses_at_tick;
+  gs->flow_uses_at_tick = gs->flow_cache.uses;
+
+  for (int i = 0; i < gs->c_workers; i++) {
+    const WorkerHot *h = CHUNK_ITEM(gs->worker_hot, WorkerHot, i);
+    if (h->status != W_CANT_PROCEED && !vec_equal(h->location, h->target)) {
+      gs->worker_intent[i] = INTENT_STEP;
+      prepare_worker_route(gs, get_worker_by_id(gs, i));
+    } else {
+      gs->worker_intent[i] = INTENT_ACT;
+    }
+  }
+
+  pool_run(gs->c_workers, PHASE_CHUNK, step_workers, gs);
+
+  for (int i = 0; i < gs->c_workers; i++) {
+    Worker *w = get_worker_by_id(gs, i);
+    switch (gs->worker_intent[i]) {
+    case INTENT_STEP:
+      move_worker(gs, w, gs->worker_step[i]);
+      break;
+    case INTENT_STEP_SERIAL:
+      advance_worker(gs, w, 1);
+      break;
+    case INTENT_ACT:
+      tick_worker(gs, w);
+      break;
+    }
+  }
+  draw_batch_times(gs);
+}
+
+/* -------------
+ * SCHEDULER
+ *
+ * Most ticks only walk workers one square and count down machine
+ * timers. These functions work out how many upcoming ticks are like
+ * that and apply them in one go, so the clock can jump straight to the
+ * next tick where something actually changes.
+ * ------------- */
+
+// Mirrors update_replenishment_orders without placing anything.
+bool stockpile_needs_replenishment(GameState *gs, const Stockpile *s) {
+  for (ProductionMaterial pm = 0; pm < PM_COUNT; pm++) {
+    if (!inventory_has(&s->hot->required_material, pm))
+      continue;
+
+    if (outstanding_replenishment_orders(gs, s->id, pm) > 0) {
+      return false;
+    }
+
+    int shortfall = s->hot->required_material.count[pm] - material_in_stockpile(s, pm);
+    if (shortfall > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Number of ticks, starting with the next one, in which the only
+// changes are worker movement and machine countdowns. LONG_MAX means
+// nothing will ever happen without outside input.
+long quiet_ticks(GameState *gs) {
+  // Anything that makes the next tick busy is checked before any
+  // worker's route is measured, since on a busy floor most scans end
+  // in one of these.
+  for (int i = 0; i < gs->c_workers; i++) {
+    const WorkerHot *w = CHUNK_ITEM(gs->worker_hot, WorkerHot, i);
+    if (w->status == W_CANT_PROCEED)
+      return 0;
+    if (vec_equal(w->location, w->target) && w->job != JOB_NONE &&
+        !(w->job == JOB_MAN_MACHINE && w->status == W_PRODUCING))
+      return 0;
+  }
+
+  if (gs->c_idle > 0 &&
+      (jobs_on_queue(gs) || next_fillable_replenishment_order(gs) >= 0))
+    return 0;
+
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    const StockpileHot *h = CHUNK_ITEM(gs->stockpile_hot, StockpileHot, i);
+    if (h->required_material.present &&
+        stockpile_needs_replenishment(gs, get_stockpile_by_id(gs, i)))
+      return 0;
+  }
+
+  long quiet = LONG_MAX;
+  for (int i = 0; i < gs->c_machines; i++) {
+    const MachineHot *m = CHUNK_ITEM(gs->machine_hot, MachineHot, i);
+    if (m->working && m->job_time_left < quiet) {
+      quiet = m->job_time_left;
+    }
+  }
+
+  for (int i = 0; i < gs->c_workers && quiet > 0; i++) {
+    const WorkerHot *h = CHUNK_ITEM(gs->worker_hot, WorkerHot, i);
+    if (!vec_equal(h->location, h->target)) {
+      long steps = worker_steps_to_target(gs, get_worker_by_id(gs, i));
+      if (steps < quiet)
+        quiet = steps;
+    }
+  }
+
+  return quiet;
+}
+
+// Applies `ticks` quiet ticks at once. Only valid for ticks <= quiet_ticks().
+void fast_forward(GameState *gs, long ticks) {
+  for (int i = 0; i < gs->c_machines; i++) {
+    MachineHot *m = CHUNK_ITEM(gs->machine_hot, MachineHot, i);
+    if (m->working) {
+      m->job_time_left -= ticks;
+    }
+  }
+
+  for (int i = 0; i < gs->c_workers; i++) {
+    const WorkerHot *h = CHUNK_ITEM(gs->worker_hot, WorkerHot, i);
+    if (!vec_equal(h->location, h->target)) {
+      advance_worker(gs, get_worker_by_id(gs, i), ticks);
+    }
+  }
+
+  gs->turn += ticks;
+}
+
+// On a busy floor there's something happening nearly every tick, and a
+// scan that finds nothing to skip costs more than the tick. Scans that
+// find fewer than QUIET_SKIP_MIN quiet ticks double the wait before the
+// next, up to QUIET_MAX_BACKOFF ticks; one that finds more resets it.
+#define QUIET_SKIP_MIN 4
+#define QUIET_MAX_BACKOFF 16
+
+long advance_to_next_event(GameState *gs, long max_ticks) {
+  if (gs->quiet_scan_wait > 0) {
+    gs->quiet_scan_wait--;
+    tick_game(gs);
+    return 1;
+  }
+
+  long quiet = quiet_ticks(gs);
+  if (quiet < QUIET_SKIP_MIN) {
+    int backoff = gs->quiet_scan_backoff * 2;
+    if (backoff == 0)
+      backoff = 1;
+    if (backoff > QUIET_MAX_BACKOFF)
+      backoff = QUIET_MAX_BACKOFF;
+    gs->quiet_scan_backoff = backoff;
+    gs->quiet_scan_wait = backoff;
+  } else {
+    gs->quiet_scan_backoff = 0;
   }
 
-  for (int i = 0; i < game.c_workers; i++) {
-    tick_worker(&game.workers[i]);
+  if (quiet == 0) {
+    tick_game(gs);
+    return 1;
   }
 
-  game.turn++;
+  long ticks = (quiet < max_ticks) ? quiet : max_ticks;
+  PROF_BEGIN(PROF_FAST_FORWARD);
+  fast_forward(gs, ticks);
+  PROF_END(PROF_FAST_FORWARD);
+  return ticks;
 }
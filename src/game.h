@@ -1,8 +1,10 @@
-#include "vector.h"
+#ifndef GAME_H
+#define GAME_H
+
+#include "dist.h"
+#include "path.h"
+#include <stdint.h>
 
-#define MAX_WORKERS 10
-#define MAX_STOCKPILES 50
-#define MAX_MACHINES 10
 #define MESSAGE_BUFFER_SIZE 10
 #define MESSAGE_MAX_SIZE 256
 
@@ -10,7 +12,8 @@ typedef enum ObjectType {
   O_NOTHING,
   O_MACHINE,
   O_WORKER,
-  O_STOCKPILE
+  O_STOCKPILE,
+  O_WALL
 } ObjectType;
 
 typedef struct ObjectReference {
@@ -30,7 +33,8 @@ typedef enum RecipeName {
   WIND_WIRE,
   PULL_WIRE,
   CUT_WIRE,
-  GRIND_POINT
+  GRIND_POINT,
+  RECIPE_COUNT
 } RecipeName;
 
 typedef enum ProductionMaterial {
@@ -45,6 +49,19 @@ typedef enum ProductionMaterial {
   PM_COUNT
 } ProductionMaterial;
 
+// Counts are padded to a whole number of 4-int vector lanes so
+// inventory_covers() can compare them with SIMD. Padding stays zero.
+#define MATERIAL_LANES (((int)PM_COUNT + 3) / 4 * 4)
+
+// Material counts indexed directly by material, with a bit set in
+// `present` for each material whose count isn't zero.
+typedef struct Inventory {
+  unsigned present;
+  int count[MATERIAL_LANES];
+} Inventory;
+
+_Static_assert(PM_COUNT <= 32, "Inventory.present needs a bit per material");
+
 typedef struct Recipe {
   enum RecipeName name;
 
@@ -56,7 +73,19 @@ typedef struct Recipe {
   ProductionMaterial outputs[10];
   int outputs_count[10];
 
-  int time;
+  // Ticks per batch, plus the ticks to clear a machine down from this
+  // recipe and set it up for the next when it changes over.
+  Distribution time;
+  Distribution setup;
+  Distribution teardown;
+
+  // Chance each unit of output comes out defective and is scrapped.
+  // `defects` is compiled from it, one per output.
+  double defect_rate;
+  Distribution defects[10];
+
+  // The inputs again as a dense vector, for inventory_covers().
+  Inventory needs;
 } Recipe;
 
 enum MachineType {
@@ -68,48 +97,92 @@ enum MachineType {
 };
 
 
+// The fields of each entity that the per-tick scans read live apart
+// from the rest, in GameState's *_hot chunks. A scan walks those chunks
+// directly, so a machine costs it 8 bytes and a worker 32 instead of
+// the whole struct. Each entity points at its own hot part, so code
+// holding a Machine, Worker or Stockpile reaches them as m->hot->working
+// and so on.
+typedef struct MachineHot {
+  bool working;
+  int job_time_left;
+} MachineHot;
+
 typedef struct Machine {
+  MachineHot *hot;
   int id;
   enum MachineType type;
   bool has_current_work_order;
-  bool working;
-  int job_time_left;
-  Recipe active_recipe;
-
-  int c_input_buffer;
-  ProductionMaterial input_buffer[10];
-  int input_buffer_count[10];
-
-  int c_output_buffer;
-  ProductionMaterial output_buffer[10];
-  int output_buffer_count[10];
-
   int worker;
-
   Vector location;
   Vector size;
+  const Recipe *active_recipe;
   int output_stockpile;
   int input_stockpile;
+
+  Inventory input_buffer;
+  Inventory output_buffer;
+
+  // What's random about this machine's batches. Everything random about
+  // a batch is drawn in the tick it starts, from the machine's stream in
+  // GameState's machine_rng, so its length is known from then on.
+  const Recipe *set_up_for;
+  double breakdown_chance;
+  Distribution repair_time;
+  int breakdowns;
 } Machine;
 
 enum WorkerStatus { W_IDLE, W_CANT_PROCEED, W_CARRYING, W_MOVING, W_PRODUCING };
 
-typedef struct Worker {
-  int id;
+// Objects are popular destinations, so workers heading to one share a
+// flow field. Anywhere else gets its own search. ROUTE_DIRECT is for
+// when there's no way through and the worker walks straight at it.
+enum Route { ROUTE_SEARCH, ROUTE_FLOW, ROUTE_DIRECT };
+
+typedef struct WorkerHot {
   enum WorkerStatus status;
+  enum Job job;
   Vector location;
   Vector target;
+  // Links in the idle list of the grid block the worker is in, while
+  // it's idle and on the floor.
+  int idle_next;
+  int idle_prev;
+} WorkerHot;
+
+typedef struct Worker {
+  WorkerHot *hot;
+  int id;
   ProductionMaterial target_material;
   int target_count;
-  enum Job job;
   int job_id;
   ObjectReference job_target;
   ObjectReference job_target_secondary;
   ProductionMaterial carrying;
   int carrying_count;
+  int next_on_tile;
+  int idle_slot;
+
+  // How the worker gets to `target`, good while the layout is unchanged.
+  // `path` is only used by ROUTE_SEARCH.
+  enum Route route;
+  Path path;
+  int path_step;
+  Vector path_start;
+  Vector path_target;
+  long path_version;
+
+  Rng rng;
 } Worker;
 
+// Only stockpiles that require something need more than a glance from
+// the replenishment scan.
+typedef struct StockpileHot {
+  Inventory required_material;
+} StockpileHot;
+
 typedef struct Stockpile {
+  StockpileHot *hot;
   int id;
   Vector location;
   Vector size;
@@ -117,55 +190,283 @@ typedef struct Stockpile {
   int attached_machine;
   enum { INPUT, OUTPUT } io;
 
-  int c_contents;
-  ProductionMaterial contents[10];
-  int contents_count[10];
-  int contents_earmarks[10];
+  Inventory contents;
+  int earmarked[PM_COUNT];
+
+  // Amount on open replenishment orders placed by this stockpile.
+  int replenishment_outstanding[PM_COUNT];
 
-  int c_required_material;
-  ProductionMaterial required_material[10];
-  int required_material_count[10];
+  // Links in the per-material supply index, for materials whose bit is
+  // set in `supplying` (bits as in Inventory.present).
+  unsigned supplying;
+  int supply_next[PM_COUNT];
+  int supply_prev[PM_COUNT];
 } Stockpile;
 
+enum TileFlag { TILE_MACHINE = 1, TILE_WALL = 2 };
+
+// Tile occupancy for the floor, anchored at (0, 0) and grown to cover
+// whatever is placed on it. `statics` holds the machine or stockpile
+// covering each tile; workers on a tile form a list ordered by id,
+// linked through Worker.next_on_tile. `blocked` holds TileFlags for
+// tiles workers can't walk through.
+//
+// Idle workers are also indexed by block of IDLE_BLOCK x IDLE_BLOCK
+// tiles: `idle_in_block` heads a list per block, linked through
+// WorkerHot.idle_next/idle_prev in no particular order. `idle_count` is a
+// pyramid of how many are idle under each block, each 2x2 blocks, and
+// so on up to the whole floor, in `idle_levels` levels.
+#define IDLE_BLOCK_BITS 3
+#define IDLE_BLOCK (1 << IDLE_BLOCK_BITS)
+
+typedef struct TileGrid {
+  int width;
+  int height;
+  ObjectReference *statics;
+  int *workers;
+  unsigned char *blocked;
+  int block_width;
+  int block_height;
+  int *idle_in_block;
+  int idle_levels;
+  int *idle_count;
+} TileGrid;
+
+struct JobQueueItem {
+  ObjectReference object;
+  enum Job job;
+  long sequence;
+};
+
+struct ReplenishmentOrder {
+  int ordering_stockpile;
+  ProductionMaterial material;
+  int amount_ordered;
+  int amount_picked_up;
+  long sequence;
+  int next; // next open order for the material, or next free slot
+};
+
+struct OpenOrders {
+  int head;
+  int tail;
+  int count;
+};
+
+struct SupplyList {
+  int head;
+  int count;
+};
+
+// A batch whose length is still being drawn: the next part of it that
+// takes a draw (enum BatchDraw in game.c), and the ticks so far.
+struct BatchStart {
+  int machine;
+  int draw;
+  int ticks;
+};
+
+// Entities are stored in chunks of ENTITY_CHUNK, which stay put once
+// allocated, so a pointer from get_*_by_id() is good for as long as the
+// game is. Only the table of chunks is reallocated, doubling as it
+// fills. A small layout takes one chunk of each kind.
+#define ENTITY_CHUNK_BITS 6
+#define ENTITY_CHUNK (1 << ENTITY_CHUNK_BITS)
+
+typedef struct Chunks {
+  int c_chunks;
+  int cap_chunks;
+  void **chunk;
+} Chunks;
+
+// Element `i` of a Chunks holding `type`.
+#define CHUNK_ITEM(chunks, type, i)                                            \
+  ((type *)(chunks).chunk[(i) >> ENTITY_CHUNK_BITS] +                          \
+   ((i) & (ENTITY_CHUNK - 1)))
+
+// Everything about one running factory. Several can exist at once (one
+// per replication in an ensemble), and every function below takes the
+// one it works on.
 typedef struct GameState {
   int c_machines;
-  Machine machines[MAX_MACHINES];
+  Chunks machines;
+  Chunks machine_hot;
+  // Each machine's random stream, as lane id % RNG_LANES of RngLanes
+  // block id / RNG_LANES, so the batches started in a tick can be drawn
+  // a block of machines at a time.
+  Chunks machine_rng;
   int c_workers;
-  Worker workers[MAX_WORKERS];
+  Chunks workers;
+  Chunks worker_hot;
   int c_stockpile;
-  Stockpile stockpiles[MAX_STOCKPILES];
+  Chunks stockpiles;
+  Chunks stockpile_hot;
+  int c_idle;
+  int cap_idle;
+  int *idle_workers;
+  TileGrid grid;
+  // Bumped whenever a machine, stockpile or wall is placed or moved, so
+  // anything derived from the layout knows to rebuild.
+  long layout_version;
+  FlowCache flow_cache;
   long turn;
+  uint64_t seed;
+  long produced[PM_COUNT];
+  long scrapped[PM_COUNT];
   char message_buffer[MESSAGE_BUFFER_SIZE][MESSAGE_MAX_SIZE];
   int message_head;
   Vector cursor;
+
+  // This game's copy of the recipe book, so each game can vary its own.
+  Recipe recipes[RECIPE_COUNT];
+
+  // Jobs waiting for a worker, as a binary heap ordered by
+  // job_priority(), then by age.
+  int c_job_queue;
+  int cap_job_queue;
+  struct JobQueueItem *job_queue;
+  long job_sequence;
+
+  // The replenishment order book. Slots are reused once an order has
+  // been delivered in full, and stay put until then, since a worker
+  // carrying an order holds on to its id.
+  //
+  // Orders that still have something left to pick up are also queued
+  // per material, oldest first. Orders are only ever picked up from the
+  // front of their queue, so a queue is all that's needed.
+  int c_replenishment_orders;
+  int cap_replenishment_orders;
+  struct ReplenishmentOrder *replenishment_orders;
+  int free_replenishment_orders;
+  long replenishment_sequence;
+  struct OpenOrders open_replenishment_orders[PM_COUNT];
+
+  // Takeable stockpiles with some of each material free.
+  struct SupplyList supply[PM_COUNT];
+
+  // Values of flow_cache.uses at the start of the last two ticks. A
+  // field used since flow_busy_since is being followed by a walking
+  // worker, so a new trip searches for a path rather than evict it.
+  long flow_busy_since;
+  long flow_uses_at_tick;
+
+  // advance_to_next_event() steps this many more ticks before it scans
+  // for quiet ones again, and backs off further each time a scan finds
+  // none worth skipping.
+  int quiet_scan_wait;
+  int quiet_scan_backoff;
+
+  // Machines that started a batch this tick, by id, waiting for
+  // draw_batch_times() to draw how long their batches run.
+  int c_batch_starts;
+  int cap_batch_starts;
+  struct BatchStart *batch_starts;
+
+  // Scratch for the parallel tick phases.
+  int cap_machine_done;
+  unsigned char *machine_done;
+  int cap_worker_intents;
+  unsigned char *worker_intent;
+  Vector *worker_step;
 } GameState;
 
+// Starts an empty game.
 GameState *new_game(void);
+void free_game(GameState *gs);
+// Reseeds every worker's and machine's random stream from `seed`.
+// Entities added later are seeded from it too.
+void seed_game(GameState *gs, uint64_t seed);
+void *grow_array(void *array, int *capacity, int needed, size_t element_size);
+// Makes room for `needed` elements of `size`, adding chunks as needed.
+void chunks_reserve(Chunks *c, int needed, size_t size);
+void chunks_free(Chunks *c);
+// Entity `id`, with room made for it and cleared, linked to its hot
+// part. add_* and snapshot loading fill it in and count it.
+Stockpile *new_stockpile(GameState *gs, int id);
+Machine *new_machine(GameState *gs, int id);
+Worker *new_worker(GameState *gs, int id);
+
+const char *material_str(ProductionMaterial m);
+const char *machine_str(enum MachineType m);
+const char *recipe_str(RecipeName rn);
+const char *job_str(enum Job j);
+void debug_print_job_queue(GameState *gs);
+void debug_print_ro_queue(GameState *gs);
 
-char *material_str(ProductionMaterial m);
-char *machine_str(enum MachineType m);
-char *recipe_str(RecipeName rn);
-char *job_str(enum Job j);
-void debug_print_job_queue(void);
-void debug_print_ro_queue(void);
+bool inventory_has(const Inventory *inv, ProductionMaterial p);
+void inventory_add(Inventory *inv, ProductionMaterial p, int count);
+bool inventory_covers(const Inventory *have, const Inventory *need);
+void batch_inputs_ready(GameState *gs, int n, const int *machines,
+                        const RecipeName *recipes, uint64_t *ready);
 
-int add_stockpile(int x, int y, int w, int h);
-void add_material_to_stockpile(Stockpile *s, ProductionMaterial p, int count);
+int add_stockpile(GameState *gs, int x, int y, int w, int h);
+// Moves a stockpile, contents and all, to (x, y). Workers on their way
+// to it follow it there.
+void move_stockpile(GameState *gs, int id, int x, int y);
+void set_stockpile_takeable(GameState *gs, Stockpile *s, bool takeable);
+void add_material_to_stockpile(GameState *gs, Stockpile *s,
+                               ProductionMaterial p, int count);
 void add_required_material_to_stockpile(Stockpile *s, ProductionMaterial p,
                                         int count);
-Stockpile *get_stockpile_by_id(int id);
+int material_in_stockpile(Stockpile const *s, ProductionMaterial p);
+Stockpile *get_stockpile_by_id(const GameState *gs, int id);
 
 Vector machine_size(enum MachineType mt);
-int add_machine(enum MachineType type, int x, int y);
+int add_machine(GameState *gs, enum MachineType type, int x, int y);
 const RecipeName *possible_recipes(const Machine *m);
-void add_output_stockpile_to_machine(int machine_id, int stockpile_id);
-void add_input_stockpile_to_machine(int machine_id, int stockpile_id);
-Machine *get_machine_by_id(int id);
+void add_output_stockpile_to_machine(GameState *gs, int machine_id,
+                                     int stockpile_id);
+void add_input_stockpile_to_machine(GameState *gs, int machine_id,
+                                    int stockpile_id);
+Machine *get_machine_by_id(const GameState *gs, int id);
+// The machine's random stream, for drawing from it on its own.
+Rng get_machine_rng(const GameState *gs, int id);
+void set_machine_rng(GameState *gs, int id, Rng r);
+
+const Recipe *get_recipe_from_name(GameState *gs, RecipeName rn);
+// Replaces a recipe's timing and defect rate. The distributions are
+// compiled here, and the recipe keeps them.
+void set_recipe_variation(GameState *gs, RecipeName rn, Distribution time,
+                          Distribution setup, Distribution teardown,
+                          double defect_rate);
+// Gives a machine a chance of breaking down in each batch, each
+// breakdown adding a repair time to the batch.
+void set_machine_breakdowns(GameState *gs, int machine_id, double chance,
+                            Distribution repair);
+
+void assign_machine_production_job(GameState *gs, int machine_id,
+                                   RecipeName rn);
+
+Worker *get_worker_by_id(const GameState *gs, int id);
+int add_worker(GameState *gs);
+
+void add_wall(GameState *gs, int x, int y, int w, int h);
+bool tile_is_wall(GameState *gs, int x, int y);
+// Grows the floor to at least width x height, re-indexing every
+// machine, stockpile and worker on it.
+void grid_ensure(GameState *gs, int width, int height);
+// Index of (x, y) into the grid's arrays, or -1 if it's off the floor.
+int tile_index(GameState *gs, int x, int y);
+
+ObjectReference object_under_point(GameState *gs, int x, int y);
+// True if nothing covers the area and it's on the floor: at
+// non-negative coordinates and at least a tile each way. add_stockpile,
+// add_machine and add_wall exit on a placement off the floor, so check
+// this first.
+bool area_is_free(GameState *gs, int x, int y, int w, int h);
+void tick_game(GameState *gs);
+long advance_to_next_event(GameState *gs, long max_ticks);
 
-void assign_machine_production_job(int machine_id, RecipeName rn);
+// What the factory looks like right now, for averaging over a run.
+// Nothing in it changes during the quiet ticks advance_to_next_event()
+// skips, so each sample holds until the next tick it returns.
+typedef struct GameSample {
+  long work_in_progress; // in input stockpiles, machines and workers' hands
+  int queued_jobs;
+  int open_orders; // replenishment orders not yet picked up
+  int busy_workers;
+} GameSample;
 
-Worker *get_worker_by_id(int id);
-int add_worker(void);
+GameSample sample_game(GameState *gs);
 
-ObjectReference object_under_point(int x, int y);
-void tick_game(void);
+#endif
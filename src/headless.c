@@ -0,0 +1,632 @@
+#include "branch.h"
+#include "game.h"
+#include "log.h"
+#include "pool.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs the factory without a window, for batch what-if studies. Usage:
+//
+//   headless.exe [-e] [-v] [-j threads] [-s seed] [-n runs]
+//                [-f copies] [-i snapshot] [-o snapshot] [-b ticks]
+//                [-p trace] [ticks]
+//
+// -e jumps the clock from event to event instead of stepping every tick.
+// -v varies batch times, scraps some output and breaks machines down,
+// instead of every batch taking a single tick.
+// -j ticks machines and workers on that many threads. Results don't
+// depend on the thread count.
+// -s seeds the random streams; the same seed gives the same run.
+// -n runs an ensemble of that many replications, seeded seed, seed + 1
+// and so on, each in its own game, with -j of them at a time. It
+// reports how each measure varies across them.
+// -f lays the built-in factory out that many times over, side by side,
+// with four workers each. A few hundred copies is enough for -j to
+// split machines and workers across threads.
+// -i starts from a snapshot instead of the built-in factory, carrying
+// on with the random streams it was saved with unless -s is given.
+// Each run of an ensemble branches from the snapshot with its own seed.
+// -o saves a snapshot of the game once the ticks have run.
+// -b then branches the game into one copy per what-if (another worker,
+// a moved stockpile and so on) and runs each on for that many more
+// ticks, -j at a time, reporting how each does next to leaving it be.
+// -p reports how long each phase of a tick took and writes every span
+// timed as a Chrome trace. Only in builds with PROFILE=1.
+
+#define DEFAULT_TICKS 10000
+#define RAW_MATERIAL_SUPPLY 1000000
+
+// Where -f puts each copy of the sample line.
+#define FACTORY_COPIES_PER_ROW 16
+#define FACTORY_PITCH_X 16
+#define FACTORY_PITCH_Y 14
+
+// Standing orders are kept as parallel arrays so readiness can be
+// checked for all of them in one batch_inputs_ready() call. Each game
+// has its own.
+typedef struct StandingOrders {
+  int n;
+  int cap;
+  int *machine;
+  RecipeName *recipe;
+  uint64_t *ready;
+} StandingOrders;
+
+int add_machine_with_stockpiles(GameState *gs, enum MachineType type, int x,
+                                int y, int in_x, int in_y, int out_x,
+                                int out_y) {
+  int m = add_machine(gs, type, x, y);
+  add_input_stockpile_to_machine(gs, m, add_stockpile(gs, in_x, in_y, 2, 2));
+  add_output_stockpile_to_machine(gs, m, add_stockpile(gs, out_x, out_y, 2, 2));
+  return m;
+}
+
+void add_standing_order(StandingOrders *so, int machine, RecipeName rn) {
+  int cap = so->cap;
+  so->machine = grow_array(so->machine, &cap, so->n + 1, sizeof(int));
+  cap = so->cap;
+  so->recipe = grow_array(so->recipe, &cap, so->n + 1, sizeof(RecipeName));
+  if (cap != so->cap) {
+    so->ready = realloc(so->ready, (cap + 63) / 64 * sizeof(uint64_t));
+    if (!so->ready) {
+      printf("ERROR: Couldn't grow standing orders\n");
+      exit(1);
+    }
+  }
+  so->cap = cap;
+
+  so->machine[so->n] = machine;
+  so->recipe[so->n] = rn;
+  so->n++;
+}
+
+void free_standing_orders(StandingOrders *so) {
+  free(so->machine);
+  free(so->recipe);
+  free(so->ready);
+  *so = (StandingOrders){0};
+}
+
+// Lays out one copy of the sample line with its top left at (x, y).
+void add_factory_copy(GameState *gs, StandingOrders *so, int x, int y) {
+  int factory_in = add_stockpile(gs, x + 0, y + 3, 2, 2);
+  Stockpile *s = get_stockpile_by_id(gs, factory_in);
+  set_stockpile_takeable(gs, s, true);
+  add_material_to_stockpile(gs, s, EMPTY_SPINDLE, 5);
+  add_material_to_stockpile(gs, s, WASHED_IRON_WIRE_COIL, RAW_MATERIAL_SUPPLY);
+  add_material_to_stockpile(gs, s, SMALL_BOWL, RAW_MATERIAL_SUPPLY);
+
+  int winder = add_machine_with_stockpiles(gs, WIRE_WINDER, x + 2, y + 4,
+                                           x + 2, y + 2, x + 2, y + 6);
+  s = get_stockpile_by_id(gs, get_machine_by_id(gs, winder)->input_stockpile);
+  add_required_material_to_stockpile(s, WASHED_IRON_WIRE_COIL, 2);
+  add_required_material_to_stockpile(s, EMPTY_SPINDLE, 2);
+  add_standing_order(so, winder, WIND_WIRE);
+
+  int puller = add_machine_with_stockpiles(gs, WIRE_PULLER, x + 9, y + 10,
+                                           x + 7, y + 10, x + 11, y + 10);
+  s = get_stockpile_by_id(gs, get_machine_by_id(gs, puller)->input_stockpile);
+  add_required_material_to_stockpile(s, SPINDLED_WIRE_COIL, 2);
+  add_standing_order(so, puller, PULL_WIRE);
+
+  int cutter = add_machine_with_stockpiles(gs, WIRE_CUTTER, x + 12, y + 3,
+                                           x + 10, y + 3, x + 12, y + 5);
+  s = get_stockpile_by_id(gs, get_machine_by_id(gs, cutter)->input_stockpile);
+  add_required_material_to_stockpile(s, LONG_WIRES, 20);
+  add_required_material_to_stockpile(s, SMALL_BOWL, 2);
+  add_standing_order(so, cutter, CUT_WIRE);
+
+  int grinder = add_machine_with_stockpiles(gs, WIRE_GRINDER, x + 7, y + 5,
+                                            x + 5, y + 5, x + 7, y + 7);
+  s = get_stockpile_by_id(gs, get_machine_by_id(gs, grinder)->input_stockpile);
+  add_required_material_to_stockpile(s, BOWL_OF_SHORT_WIRES, 2);
+  add_standing_order(so, grinder, GRIND_POINT);
+
+  add_worker(gs);
+  add_worker(gs);
+  add_worker(gs);
+  add_worker(gs);
+}
+
+// The sample line, `copies` times over, FACTORY_COPIES_PER_ROW to a row.
+void setup_factory(GameState *gs, StandingOrders *so, int copies) {
+  for (int c = 0; c < copies; c++) {
+    add_factory_copy(gs, so, (c % FACTORY_COPIES_PER_ROW) * FACTORY_PITCH_X,
+                     (c / FACTORY_COPIES_PER_ROW) * FACTORY_PITCH_Y);
+  }
+}
+
+// The recipe setup_factory() gives each type of machine. A snapshot
+// doesn't carry standing orders, so a loaded factory gets these.
+const RecipeName standing_recipe[COUNT_MACHINE_TYPES] = {
+    [WIRE_WINDER] = WIND_WIRE,
+    [WIRE_PULLER] = PULL_WIRE,
+    [WIRE_CUTTER] = CUT_WIRE,
+    [WIRE_GRINDER] = GRIND_POINT};
+
+void add_standing_orders_by_type(GameState *gs, StandingOrders *so) {
+  for (int i = 0; i < gs->c_machines; i++) {
+    add_standing_order(so, i, standing_recipe[get_machine_by_id(gs, i)->type]);
+  }
+}
+
+// A game ready to run: loaded from `snapshot` if there is one,
+// otherwise `copies` of the built-in factory. Exits if the snapshot
+// won't load.
+GameState *start_game(const char *snapshot, int copies, StandingOrders *so,
+                      uint64_t seed, bool reseed) {
+  if (!snapshot) {
+    GameState *gs = new_game();
+    seed_game(gs, seed);
+    setup_factory(gs, so, copies);
+    return gs;
+  }
+
+  GameState *gs = load_snapshot(snapshot);
+  if (!gs)
+    exit(1);
+  if (reseed)
+    seed_game(gs, seed);
+  add_standing_orders_by_type(gs, so);
+  return gs;
+}
+
+// Made-up but plausible variation, for studying where the line backs up
+// when machines don't all keep time.
+const int grind_ticks[] = {1, 2, 5};
+const double grind_weights[] = {0.7, 0.2, 0.1};
+
+void vary_factory(GameState *gs, const StandingOrders *so) {
+  Distribution none = {.kind = DIST_FIXED, .a = 0};
+
+  set_recipe_variation(
+      gs, WIND_WIRE,
+      (Distribution){.kind = DIST_TRIANGULAR, .a = 1, .b = 4, .c = 2},
+      (Distribution){.kind = DIST_FIXED, .a = 5}, none, 0);
+  set_recipe_variation(
+      gs, PULL_WIRE, (Distribution){.kind = DIST_LOGNORMAL, .a = 1.1, .b = 0.4},
+      none, none, 0);
+  set_recipe_variation(gs, CUT_WIRE,
+                       (Distribution){.kind = DIST_UNIFORM, .a = 1, .b = 6},
+                       none, none, 0.02);
+  set_recipe_variation(gs, GRIND_POINT,
+                       (Distribution){.kind = DIST_EMPIRICAL,
+                                      .c_values = 3,
+                                      .values = grind_ticks,
+                                      .weights = grind_weights},
+                       none, none, 0.01);
+
+  for (int i = 0; i < so->n; i++) {
+    set_machine_breakdowns(
+        gs, so->machine[i], 0.01,
+        (Distribution){.kind = DIST_LOGNORMAL, .a = 3.9, .b = 0.5});
+  }
+}
+
+// A machine is only given a new batch once its input stockpile can
+// cover the whole recipe, since workers can't yet handle running short
+// part way through filling a machine.
+void keep_machines_busy(GameState *gs, StandingOrders *so) {
+  batch_inputs_ready(gs, so->n, so->machine, so->recipe, so->ready);
+
+  for (int i = 0; i < so->n; i++) {
+    Machine *m = get_machine_by_id(gs, so->machine[i]);
+    bool ready = (so->ready[i / 64] >> (i % 64)) & 1;
+    if (ready && !m->has_current_work_order &&
+        m->output_buffer.present == 0) {
+      assign_machine_production_job(gs, m->id, so->recipe[i]);
+    }
+  }
+}
+
+// Advances the game by one tick, or by one event's worth of
+// ticks, returning how many.
+long advance(GameState *gs, long ticks_left, bool event_driven) {
+  if (event_driven)
+    return advance_to_next_event(gs, ticks_left);
+  tick_game(gs);
+  return 1;
+}
+
+double seconds_since(struct timespec start) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Totals and rates are over the whole game, including any ticks it ran
+// before it was saved to the snapshot it was loaded from.
+void print_report(const GameState *gs, long ticks, double elapsed) {
+  printf("\nRan %ld ticks in %.3fs (%.0f ticks/s)\n", ticks, elapsed,
+         elapsed > 0 ? ticks / elapsed : 0.0);
+
+  printf("%-24s %12s %12s %12s\n", "MATERIAL", "PRODUCED", "PER 1K TICKS",
+         "SCRAPPED");
+  for (int i = 1; i < PM_COUNT; i++) {
+    printf("%-24s %12ld %12.2f %12ld\n", material_str(i), gs->produced[i],
+           gs->turn > 0 ? gs->produced[i] * 1000.0 / gs->turn : 0.0,
+           gs->scrapped[i]);
+  }
+
+  int breakdowns = 0;
+  for (int i = 0; i < gs->c_machines; i++) {
+    breakdowns += get_machine_by_id(gs, i)->breakdowns;
+  }
+  printf("%d machine breakdowns\n", breakdowns);
+}
+
+/* -------------
+ * ENSEMBLES
+ * ------------- */
+
+enum Measure {
+  THROUGHPUT,
+  WORK_IN_PROGRESS,
+  QUEUED_JOBS,
+  OPEN_ORDERS,
+  UTILISATION,
+  MEASURE_COUNT
+};
+
+const char *measure_names[MEASURE_COUNT] = {
+    "pins per 1k ticks", "work in progress", "queued jobs",
+    "open replenishment orders", "worker utilisation"};
+
+typedef struct Ensemble {
+  long ticks;
+  bool event_driven;
+  bool varied;
+  uint64_t first_seed;
+  const char *snapshot;
+  int copies;
+  double (*results)[MEASURE_COUNT];
+} Ensemble;
+
+// Runs `gs` on for `ticks`, filling in each measure over that stretch.
+void measure_run(GameState *gs, StandingOrders *so, long ticks,
+                 bool event_driven, double *result) {
+  long produced_before = gs->produced[BOWL_OF_HEADLESS_PINS];
+
+  TimeAverage wip = {0}, jobs = {0}, orders = {0}, busy = {0};
+  for (long t = 0; t < ticks;) {
+    keep_machines_busy(gs, so);
+    GameSample sample = sample_game(gs);
+    long step = advance(gs, ticks - t, event_driven);
+    time_average_add(&wip, sample.work_in_progress, step);
+    time_average_add(&jobs, sample.queued_jobs, step);
+    time_average_add(&orders, sample.open_orders, step);
+    time_average_add(&busy, sample.busy_workers, step);
+    t += step;
+  }
+
+  result[THROUGHPUT] =
+      (gs->produced[BOWL_OF_HEADLESS_PINS] - produced_before) * 1000.0 /
+      ticks;
+  result[WORK_IN_PROGRESS] = time_average_value(&wip);
+  result[QUEUED_JOBS] = time_average_value(&jobs);
+  result[OPEN_ORDERS] = time_average_value(&orders);
+  result[UTILISATION] =
+      gs->c_workers > 0 ? time_average_value(&busy) / gs->c_workers : 0;
+}
+
+// One replication, start to finish, in a game of its own. Everything
+// but throughput is averaged over the run's ticks, and only what's
+// made during them counts towards throughput.
+void run_replication(const Ensemble *e, int run, double *result) {
+  StandingOrders so = {0};
+  GameState *gs = start_game(e->snapshot, e->copies, &so, e->first_seed + run, true);
+  if (e->varied)
+    vary_factory(gs, &so);
+  measure_run(gs, &so, e->ticks, e->event_driven, result);
+
+  free_game(gs);
+  free_standing_orders(&so);
+}
+
+void run_replications(void *ctx, int begin, int end, int thread) {
+  (void)thread;
+  const Ensemble *e = ctx;
+  for (int i = begin; i < end; i++) {
+    run_replication(e, i, e->results[i]);
+  }
+}
+
+// Results are summarised in seed order once every run is in, so the
+// report doesn't depend on which thread finished first.
+void print_ensemble_report(const Ensemble *e, int runs, double elapsed) {
+  printf("\nRan %d replications of %ld ticks (seeds %llu to %llu) in %.3fs\n",
+         runs, e->ticks, (unsigned long long)e->first_seed,
+         (unsigned long long)(e->first_seed + runs - 1), elapsed);
+
+  printf("%-26s %10s %10s %10s %10s %10s\n", "MEASURE", "MEAN", "95% CI +/-",
+         "P10", "P50", "P90");
+  for (int m = 0; m < MEASURE_COUNT; m++) {
+    RunningStats stats = {0};
+    Quantile p10 = quantile_new(0.1);
+    Quantile p50 = quantile_new(0.5);
+    Quantile p90 = quantile_new(0.9);
+
+    for (int i = 0; i < runs; i++) {
+      double x = e->results[i][m];
+      stats_add(&stats, x);
+      quantile_add(&p10, x);
+      quantile_add(&p50, x);
+      quantile_add(&p90, x);
+    }
+
+    printf("%-26s %10.3f %10.3f %10.3f %10.3f %10.3f\n", measure_names[m],
+           stats.mean, stats_ci95(&stats), quantile_value(&p10),
+           quantile_value(&p50), quantile_value(&p90));
+  }
+}
+
+/* -------------
+ * BRANCHES
+ * ------------- */
+
+// A what-if for -b, applied to a branch's copy of the game before it
+// runs on.
+typedef struct Tweak {
+  const char *name;
+  void (*apply)(GameState *gs);
+} Tweak;
+
+void leave_as_is(GameState *gs) { (void)gs; }
+
+void hire_worker(GameState *gs) { add_worker(gs); }
+
+void hire_two_workers(GameState *gs) {
+  add_worker(gs);
+  add_worker(gs);
+}
+
+// Each machine here only has the one recipe to choose from, so this
+// changes how the cutter's recipe runs rather than which one it runs.
+void fix_cutting_time(GameState *gs) {
+  Distribution none = {.kind = DIST_FIXED, .a = 0};
+  const Recipe *r = get_recipe_from_name(gs, CUT_WIRE);
+  set_recipe_variation(gs, CUT_WIRE,
+                       (Distribution){.kind = DIST_FIXED, .a = 2}, none,
+                       none, r->defect_rate);
+}
+
+Machine *first_machine_of_type(GameState *gs, enum MachineType type) {
+  for (int i = 0; i < gs->c_machines; i++) {
+    if (get_machine_by_id(gs, i)->type == type)
+      return get_machine_by_id(gs, i);
+  }
+  return NULL;
+}
+
+// Moves the puller's input to the nearest free spot to the winder's
+// output, cutting out most of the walk between them.
+void move_puller_input(GameState *gs) {
+  Machine *winder = first_machine_of_type(gs, WIRE_WINDER);
+  Machine *puller = first_machine_of_type(gs, WIRE_PULLER);
+  if (!winder || !puller)
+    return;
+
+  Vector near = get_stockpile_by_id(gs, winder->output_stockpile)->location;
+  Stockpile *s = get_stockpile_by_id(gs, puller->input_stockpile);
+  for (int r = 1; r < 16; r++) {
+    for (int dy = -r; dy <= r; dy++) {
+      for (int dx = -r; dx <= r; dx++) {
+        int x = near.x + dx;
+        int y = near.y + dy;
+        if ((abs(dx) != r && abs(dy) != r) || x < 0 || y < 0)
+          continue;
+        if (area_is_free(gs, x, y, s->size.x, s->size.y)) {
+          move_stockpile(gs, s->id, x, y);
+          return;
+        }
+      }
+    }
+  }
+}
+
+const Tweak tweaks[] = {{"as is", leave_as_is},
+                        {"one more worker", hire_worker},
+                        {"two more workers", hire_two_workers},
+                        {"cutting fixed at 2 ticks", fix_cutting_time},
+                        {"puller input by winder", move_puller_input}};
+
+#define TWEAK_COUNT ((int)(sizeof(tweaks) / sizeof(tweaks[0])))
+
+typedef struct BranchStudy {
+  long ticks;
+  bool event_driven;
+  StandingOrders *so;
+  double results[TWEAK_COUNT][MEASURE_COUNT];
+} BranchStudy;
+
+void run_tweak(GameState *gs, int branch, void *ctx, double *result) {
+  BranchStudy *b = ctx;
+  tweaks[branch].apply(gs);
+  measure_run(gs, b->so, b->ticks, b->event_driven, result);
+}
+
+void print_branch_report(const BranchStudy *b, long turn, double elapsed) {
+  printf("\nBranched %d ways at tick %ld and ran each %ld ticks on in "
+         "%.3fs\n",
+         TWEAK_COUNT, turn, b->ticks, elapsed);
+
+  printf("%-26s %10s %10s %10s %10s %10s\n", "BRANCH", "PINS/1K", "WIP",
+         "JOBS", "ORDERS", "BUSY");
+  for (int i = 0; i < TWEAK_COUNT; i++) {
+    const double *r = b->results[i];
+    printf("%-26s %10.3f %10.3f %10.3f %10.3f %10.3f\n", tweaks[i].name,
+           r[THROUGHPUT], r[WORK_IN_PROGRESS], r[QUEUED_JOBS], r[OPEN_ORDERS],
+           r[UTILISATION]);
+  }
+}
+
+void print_profile_report(void) {
+  ProfileTotal totals[PROF_PHASE_COUNT];
+  profile_totals(totals);
+
+  printf("\n%-26s %10s %10s %10s\n", "PHASE", "SPANS", "TOTAL MS",
+         "MEAN US");
+  for (int p = 0; p < PROF_PHASE_COUNT; p++) {
+    if (totals[p].count == 0)
+      continue;
+    printf("%-26s %10llu %10.3f %10.3f\n", profile_phase_str(p),
+           (unsigned long long)totals[p].count, totals[p].ns / 1e6,
+           totals[p].ns / 1e3 / totals[p].count);
+  }
+}
+
+void usage(const char *program) {
+  printf("Usage: %s [-e] [-v] [-j threads] [-s seed] [-n runs] "
+         "[-f copies] [-i snapshot] [-o snapshot] [-b ticks] [-p trace] "
+         "[ticks]\n",
+         program);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  long ticks = DEFAULT_TICKS;
+  bool event_driven = false;
+  bool varied = false;
+  int threads = 1;
+  uint64_t seed = 0;
+  bool seeded = false;
+  int runs = 0;
+  const char *load_from = NULL;
+  const char *save_to = NULL;
+  long branch_ticks = 0;
+  const char *trace_to = NULL;
+  int copies = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-e") == 0) {
+      event_driven = true;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      varied = true;
+    } else if (strcmp(argv[i], "-j") == 0) {
+      if (++i == argc)
+        usage(argv[0]);
+      threads = strtol(argv[i], NULL, 10);
+      if (threads < 1 || threads > POOL_MAX_THREADS)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-s") == 0) {
+      if (++i == argc)
+        usage(argv[0]);
+      seed = strtoull(argv[i], NULL, 10);
+      seeded = true;
+    } else if (strcmp(argv[i], "-n") == 0) {
+      if (++i == argc)
+        usage(argv[0]);
+      runs = strtol(argv[i], NULL, 10);
+      if (runs < 1)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-i") == 0) {
+      if (++i == argc)
+        usage(argv[0]);
+      load_from = argv[i];
+    } else if (strcmp(argv[i], "-o") == 0) {
+      if (++i == argc)
+        usage(argv[0]);
+      save_to = argv[i];
+    } else if (strcmp(argv[i], "-f") == 0) {
+      if (++i == argc)
+        usage(argv[0]);
+      copies = strtol(argv[i], NULL, 10);
+      if (copies < 1)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-b") == 0) {
+      if (++i == argc)
+        usage(argv[0]);
+      branch_ticks = strtol(argv[i], NULL, 10);
+      if (branch_ticks <= 0)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-p") == 0) {
+      if (++i == argc)
+        usage(argv[0]);
+      if (!PROFILE) {
+        printf("ERROR: -p needs a build with PROFILE=1\n");
+        exit(1);
+      }
+      trace_to = argv[i];
+    } else {
+      ticks = strtol(argv[i], NULL, 10);
+      if (ticks <= 0)
+        usage(argv[0]);
+    }
+  }
+
+  if ((runs > 0 && (save_to || branch_ticks > 0)) ||
+      (load_from && copies > 1))
+    usage(argv[0]);
+
+  log_init(stdout);
+  profile_name_thread("main");
+  pool_init(threads);
+
+  struct timespec start;
+  timespec_get(&start, TIME_UTC);
+
+  if (runs > 0) {
+    Ensemble e = {.ticks = ticks,
+                  .event_driven = event_driven,
+                  .varied = varied,
+                  .first_seed = seed,
+                  .snapshot = load_from,
+                  .copies = copies,
+                  .results = calloc(runs, sizeof(*e.results))};
+    if (!e.results) {
+      printf("ERROR: Couldn't allocate ensemble results\n");
+      exit(1);
+    }
+    pool_run(runs, 1, run_replications, &e);
+
+    double elapsed = seconds_since(start);
+    pool_shutdown();
+    log_shutdown();
+    print_ensemble_report(&e, runs, elapsed);
+    free(e.results);
+    if (trace_to) {
+      print_profile_report();
+      return profile_export(trace_to) ? 0 : 1;
+    }
+    return 0;
+  }
+
+  StandingOrders so = {0};
+  GameState *gs = start_game(load_from, copies, &so, seed, seeded);
+  if (varied)
+    vary_factory(gs, &so);
+
+  for (long t = 0; t < ticks;) {
+    keep_machines_busy(gs, &so);
+    t += advance(gs, ticks - t, event_driven);
+  }
+
+  double elapsed = seconds_since(start);
+  pool_shutdown();
+  log_shutdown();
+  print_report(gs, ticks, elapsed);
+  bool ok = !save_to || save_snapshot(gs, save_to);
+  if (ok && trace_to) {
+    print_profile_report();
+    ok = profile_export(trace_to);
+  }
+
+  if (ok && branch_ticks > 0) {
+    BranchStudy b = {
+        .ticks = branch_ticks, .event_driven = event_driven, .so = &so};
+    timespec_get(&start, TIME_UTC);
+    ok = run_branches(gs, TWEAK_COUNT, run_tweak, &b, &b.results[0][0],
+                      MEASURE_COUNT, threads);
+    print_branch_report(&b, gs->turn, seconds_since(start));
+  }
+
+  free_game(gs);
+  free_standing_orders(&so);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,367 @@
+#define _POSIX_C_SOURCE 200809L
+#include "log.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* -------------
+ * RING BUFFER
+ *
+ * Records hold the format and the raw arguments, and a background
+ * thread formats and writes them out, so the calling thread only
+ * copies a few words. Producers never block: if the flusher falls
+ * behind, records are dropped and counted instead.
+ *
+ * Each slot carries a sequence number so several threads can claim
+ * slots without a lock (a bounded MPSC queue, after Vyukov).
+ * ------------- */
+
+#define LOG_RING_SIZE 4096 // must be a power of two
+#define LOG_MAX_ARGS 8
+#define LOG_STRING_SIZE 64
+#define LOG_SPEC_SIZE 16
+#define LOG_FLUSH_INTERVAL_NS 1000000
+
+enum LogArgType {
+  ARG_INT,
+  ARG_LONG,
+  ARG_LONG_LONG,
+  ARG_SIZE,
+  ARG_DOUBLE,
+  ARG_STRING,
+  ARG_POINTER,
+  ARG_NONE
+};
+
+union LogArg {
+  int i;
+  long l;
+  long long ll;
+  size_t z;
+  double f;
+  const void *p;
+};
+
+// The format must be a string literal, as the flusher reads it later.
+// %s arguments are copied into `strings`, and stored as their offset.
+struct LogRecord {
+  atomic_size_t sequence;
+  unsigned char level;
+  unsigned char category;
+  unsigned char c_args;
+  const char *fmt;
+  union LogArg args[LOG_MAX_ARGS];
+  char strings[LOG_STRING_SIZE];
+};
+
+static struct LogRecord log_ring[LOG_RING_SIZE];
+static atomic_size_t log_head;
+static size_t log_tail;
+static atomic_ulong log_dropped;
+
+static FILE *log_out;
+static atomic_bool log_running;
+static atomic_bool log_started;
+static pthread_t log_thread;
+
+static bool log_categories[LOG_CATEGORY_COUNT] = {
+    true, true, true, true, true, true};
+
+static const char *log_level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+static const char *log_category_names[] = {
+    "GAME", "JOBS", "REPLENISHMENT", "STOCKPILE", "MACHINE", "WORKER"};
+
+// Reads the conversion spec starting at the '%' at `*at`, leaving `*at`
+// just past it. Returns the type of argument it takes, ARG_NONE for
+// "%%" or anything not understood.
+static enum LogArgType read_spec(const char **at) {
+  const char *f = *at + 1;
+  while (*f && strchr("-+ #0", *f))
+    f++;
+  while (*f >= '0' && *f <= '9')
+    f++;
+  if (*f == '.') {
+    f++;
+    while (*f >= '0' && *f <= '9')
+      f++;
+  }
+
+  int longs = 0;
+  bool size = false;
+  for (; *f && strchr("hlz", *f); f++) {
+    if (*f == 'l')
+      longs++;
+    if (*f == 'z')
+      size = true;
+  }
+
+  char conversion = *f;
+  *at = *f ? f + 1 : f;
+  switch (conversion) {
+  case 'd':
+  case 'i':
+  case 'u':
+  case 'x':
+  case 'X':
+  case 'o':
+  case 'c':
+    if (size)
+      return ARG_SIZE;
+    return longs == 0 ? ARG_INT : longs == 1 ? ARG_LONG : ARG_LONG_LONG;
+  case 'f':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+    return ARG_DOUBLE;
+  case 's':
+    return ARG_STRING;
+  case 'p':
+    return ARG_POINTER;
+  default:
+    return ARG_NONE;
+  }
+}
+
+static void take_args(struct LogRecord *r, const char *fmt, va_list args) {
+  int c_args = 0;
+  size_t used = 0;
+
+  for (const char *f = fmt; *f && c_args < LOG_MAX_ARGS;) {
+    if (*f != '%') {
+      f++;
+      continue;
+    }
+    enum LogArgType type = read_spec(&f);
+    if (type == ARG_NONE)
+      continue;
+
+    union LogArg *a = &r->args[c_args];
+    switch (type) {
+    case ARG_INT:
+      a->i = va_arg(args, int);
+      break;
+    case ARG_LONG:
+      a->l = va_arg(args, long);
+      break;
+    case ARG_LONG_LONG:
+      a->ll = va_arg(args, long long);
+      break;
+    case ARG_SIZE:
+      a->z = va_arg(args, size_t);
+      break;
+    case ARG_DOUBLE:
+      a->f = va_arg(args, double);
+      break;
+    case ARG_STRING: {
+      // Strings that don't fit are cut short, and once the space is
+      // used up the rest share its final '\0'.
+      const char *str = va_arg(args, const char *);
+      if (!str)
+        str = "(null)";
+      size_t room = LOG_STRING_SIZE - 1 - used;
+      size_t n = strlen(str);
+      if (n > room)
+        n = room;
+      memcpy(r->strings + used, str, n);
+      r->strings[used + n] = '\0';
+      a->z = used;
+      used += n < room ? n + 1 : n;
+      break;
+    }
+    case ARG_POINTER:
+      a->p = va_arg(args, const void *);
+      break;
+    case ARG_NONE:
+      break;
+    }
+    c_args++;
+  }
+  r->c_args = c_args;
+}
+
+static void write_record(FILE *out, const struct LogRecord *r) {
+  fprintf(out, "%s %s: ", log_level_names[r->level],
+          log_category_names[r->category]);
+
+  int arg = 0;
+  for (const char *f = r->fmt; *f;) {
+    if (*f != '%') {
+      const char *text = f;
+      while (*f && *f != '%')
+        f++;
+      fwrite(text, 1, f - text, out);
+      continue;
+    }
+
+    const char *start = f;
+    enum LogArgType type = read_spec(&f);
+    size_t length = f - start;
+    if (type == ARG_NONE || arg >= r->c_args || length >= LOG_SPEC_SIZE) {
+      if (length == 2 && start[1] == '%')
+        fputc('%', out);
+      else
+        fwrite(start, 1, length, out);
+      continue;
+    }
+
+    char spec[LOG_SPEC_SIZE];
+    memcpy(spec, start, length);
+    spec[length] = '\0';
+    const union LogArg *a = &r->args[arg++];
+    switch (type) {
+    case ARG_INT:
+      fprintf(out, spec, a->i);
+      break;
+    case ARG_LONG:
+      fprintf(out, spec, a->l);
+      break;
+    case ARG_LONG_LONG:
+      fprintf(out, spec, a->ll);
+      break;
+    case ARG_SIZE:
+      fprintf(out, spec, a->z);
+      break;
+    case ARG_DOUBLE:
+      fprintf(out, spec, a->f);
+      break;
+    case ARG_STRING:
+      fprintf(out, spec, r->strings + a->z);
+      break;
+    case ARG_POINTER:
+      fprintf(out, spec, a->p);
+      break;
+    case ARG_NONE:
+      break;
+    }
+  }
+  fputc('\n', out);
+}
+
+static bool flush_ring(void) {
+  bool wrote = false;
+
+  for (;;) {
+    struct LogRecord *r = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&r->sequence, memory_order_acquire);
+    if (seq != log_tail + 1)
+      break;
+
+    write_record(log_out, r);
+    atomic_store_explicit(&r->sequence, log_tail + LOG_RING_SIZE,
+                          memory_order_release);
+    log_tail++;
+    wrote = true;
+  }
+
+  unsigned long dropped = atomic_exchange(&log_dropped, 0);
+  if (dropped > 0) {
+    fprintf(log_out, "WARN GAME: log ring full, dropped %lu records\n",
+            dropped);
+    wrote = true;
+  }
+
+  if (wrote)
+    fflush(log_out);
+  return wrote;
+}
+
+static void *flush_loop(void *arg) {
+  (void)arg;
+  struct timespec interval = {0, LOG_FLUSH_INTERVAL_NS};
+
+  while (atomic_load(&log_running)) {
+    if (!flush_ring())
+      nanosleep(&interval, NULL);
+  }
+  flush_ring();
+  return NULL;
+}
+
+/* -------------
+ * API
+ * ------------- */
+
+void log_init(FILE *out) {
+  if (atomic_load(&log_started))
+    return;
+
+  for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+    atomic_init(&log_ring[i].sequence, i);
+  }
+  atomic_init(&log_head, 0);
+  log_tail = 0;
+  log_out = out;
+  atomic_store(&log_running, true);
+
+  if (pthread_create(&log_thread, NULL, flush_loop, NULL) != 0) {
+    printf("ERROR: Couldn't start log thread\n");
+    exit(1);
+  }
+  atomic_store(&log_started, true);
+  atexit(log_shutdown);
+}
+
+void log_shutdown(void) {
+  if (!atomic_load(&log_started))
+    return;
+
+  atomic_store(&log_running, false);
+  pthread_join(log_thread, NULL);
+  atomic_store(&log_started, false);
+}
+
+void log_after_fork(void) { atomic_store(&log_started, false); }
+
+void log_set_category(LogCategory c, bool enabled) {
+  log_categories[c] = enabled;
+}
+
+void log_write(int level, LogCategory c, const char *fmt, ...) {
+  if (!log_categories[c])
+    return;
+
+  va_list args;
+  va_start(args, fmt);
+
+  // Before log_init (or after shutdown) there's no flusher, so write
+  // straight through.
+  if (!atomic_load(&log_started)) {
+    printf("%s %s: ", log_level_names[level], log_category_names[c]);
+    vprintf(fmt, args);
+    putchar('\n');
+    va_end(args);
+    return;
+  }
+
+  struct LogRecord *r;
+  size_t head = atomic_load_explicit(&log_head, memory_order_relaxed);
+  for (;;) {
+    r = &log_ring[head & (LOG_RING_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&r->sequence, memory_order_acquire);
+
+    if (seq == head) {
+      if (atomic_compare_exchange_weak_explicit(&log_head, &head, head + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (seq < head) {
+      atomic_fetch_add(&log_dropped, 1);
+      va_end(args);
+      return;
+    } else {
+      head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    }
+  }
+
+  r->level = level;
+  r->category = c;
+  r->fmt = fmt;
+  take_args(r, fmt, args);
+  va_end(args);
+
+  atomic_store_explicit(&r->sequence, head + 1, memory_order_release);
+}
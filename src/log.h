@@ -0,0 +1,65 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Levels are plain defines so they can be compared in #if.
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+// Calls below LOG_LEVEL are compiled out entirely, arguments and all.
+// Build with -DLOG_LEVEL=LOG_LEVEL_DEBUG to get the tick-by-tick trace.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+typedef enum LogCategory {
+  LOG_GAME,
+  LOG_JOBS,
+  LOG_REPLENISHMENT,
+  LOG_STOCKPILE,
+  LOG_MACHINE,
+  LOG_WORKER,
+  LOG_CATEGORY_COUNT
+} LogCategory;
+
+void log_init(FILE *out);
+void log_shutdown(void);
+// For the child of a fork(), which has no flusher thread: writes go
+// straight through from then on.
+void log_after_fork(void);
+void log_set_category(LogCategory c, bool enabled);
+// `fmt` must be a string literal, as records are only formatted later,
+// on the flusher thread. Up to 8 arguments are kept, and %s arguments
+// are copied, up to 63 bytes between them.
+void log_write(int level, LogCategory c, const char *fmt, ...);
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(c, ...) log_write(LOG_LEVEL_DEBUG, c, __VA_ARGS__)
+#else
+#define LOG_DEBUG(c, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(c, ...) log_write(LOG_LEVEL_INFO, c, __VA_ARGS__)
+#else
+#define LOG_INFO(c, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(c, ...) log_write(LOG_LEVEL_WARN, c, __VA_ARGS__)
+#else
+#define LOG_WARN(c, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(c, ...) log_write(LOG_LEVEL_ERROR, c, __VA_ARGS__)
+#else
+#define LOG_ERROR(c, ...) ((void)0)
+#endif
+
+#endif
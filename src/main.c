@@ -1,6 +1,13 @@
 #include "game.h"
+#include "log.h"
+#include "profile.h"
 #include "raylib.h"
+#include "rlgl.h"
+#include "sim.h"
+#include "snapshot.h"
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define MAX_X 15
@@ -9,6 +16,7 @@
 #define MENU_SIZE_SQUARES 30
 #define SCREEN_WIDTH ((MAX_X + MENU_SIZE_SQUARES) * SQUARE_SIZE)
 #define SCREEN_HEIGHT (MAX_Y * SQUARE_SIZE)
+#define FLOOR_WIDTH ((MAX_X + 1) * SQUARE_SIZE)
 #define TEXT_SIZE 15
 
 #define FRAMES_PER_ROW 16
@@ -19,12 +27,46 @@
 #define FRAME_CURSOR (5 * 16) + 8
 #define FRAME_MATERIAL (1 * 16) + 14
 #define FRAME_UNKNOWN (3 * 16) + 15
+#define FRAME_WALL (2 * 16) + 3
+
+// The floor view scrolls over up to FLOOR_LIMIT tiles square, zooming
+// by factors of two between these.
+#define FLOOR_LIMIT 2048
+#define MIN_ZOOM 0.125f
+#define MAX_ZOOM 2.0f
+#define CURSOR_JUMP 10
+
+// The static floor is cached as textures CHUNK_TILES tiles square, at
+// the atlas's own CHUNK_TEXELS per tile, for the chunks last on screen.
+#define CHUNK_TILES 32
+#define CHUNK_TEXELS 16
+#define STATIC_CHUNKS 64
+
+// Sprites between checks that rlgl's vertex buffer has room.
+#define SPRITE_GROUP 1024
+
+// The side panel holds up to PANEL_LINES lines of PANEL_LINE_LENGTH - 1
+// characters; anything longer is cut short.
+#define PANEL_LINES 48
+#define PANEL_LINE_LENGTH 64
+#define PANEL_SPACING 4
 
 #define FPS 60
-#define TPS 60
+
+// In PROFILE builds, F3 shows the phase timings, taken afresh every
+// PROFILE_OVERLAY_SECONDS, and the spans still held are written to
+// PROFILE_TRACE on the way out.
+#define PROFILE_OVERLAY_SECONDS 1.0
+#define PROFILE_TRACE "profile.json"
+
+// Where the factory is saved from the menu, unless it was loaded from
+// somewhere else.
+#define DEFAULT_SNAPSHOT "factory.snap"
 
 bool quit = false;
 
+const char *speed_names[SPEED_COUNT] = {"1x", "10x", "100x", "MAX"};
+
 typedef enum {
   MENU_NONE,
   MENU_MAIN,
@@ -33,18 +75,93 @@ typedef enum {
   MENU_ADD_REQUIRED_MATERIAL,
 } MenuMode;
 
+// A tile from the atlas at tile (x, y), in whatever space it's drawn.
+typedef struct Sprite {
+  int frame;
+  int x;
+  int y;
+} Sprite;
+
+typedef struct SpriteBatch {
+  int n;
+  int cap;
+  Sprite *sprites;
+} SpriteBatch;
+
+// Chunk (x, y) of the static floor as of `version`, an earlier
+// gs->layout_version. `x` is -1 while the slot is unused.
+typedef struct StaticChunk {
+  int x;
+  int y;
+  long version;
+  long last_drawn;
+  RenderTexture2D texture;
+} StaticChunk;
+
+// Tiles [x0, x1) by [y0, y1).
+typedef struct TileRect {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+} TileRect;
+
+// A line of the side panel, laid out once: the glyphs it draws and
+// their offsets from `at`. Spaces and tabs only advance.
+typedef struct PanelLine {
+  Vector2 at;
+  char text[PANEL_LINE_LENGTH];
+  int c_glyphs;
+  int codepoints[PANEL_LINE_LENGTH];
+  float glyph_x[PANEL_LINE_LENGTH];
+} PanelLine;
+
+// The side panel as last built, for the state `version` digests.
+typedef struct Panel {
+  uint64_t version;
+  bool built;
+  Font *font;
+  float font_size;
+  int c_lines;
+  PanelLine lines[PANEL_LINES];
+} Panel;
+
 struct DrawState {
+  // This frame's view of the game from the sim thread. Edits go back
+  // through sim_send().
   GameState *gs;
-  char *context_menu_text;
   Texture2D *tilemap;
   Font *font;
   MenuMode menu_mode;
   bool paused;
+  SimSpeed speed;
+  Vector cursor;
   bool placement_mode;
   enum ObjectType placement_of;
   int placement_of_sub;
   Vector2 placement_size;
   int menu_modifier;
+  const char *snapshot_path;
+
+  Camera2D camera;
+  SpriteBatch sprites;
+  StaticChunk chunks[STATIC_CHUNKS];
+  long frame;
+
+  // What's under the cursor, as of the view turn and layout and cursor
+  // it was looked up for.
+  ObjectReference selected;
+  long selected_turn;
+  long selected_layout;
+  Vector selected_at;
+  Panel panel;
+
+#if PROFILE
+  bool show_profile;
+  double profile_since;
+  ProfileTotal profile_last[PROF_PHASE_COUNT];
+  Panel profile_panel;
+#endif
 } draw_state;
 
 Vector2 frame_to_row_col(int frame, int frames_per_row) {
@@ -66,332 +183,605 @@ void draw_frame_in_square(int frame, int row, int col, const Texture2D *tex) {
   DrawTexturePro(*tex, source_rec, dest_rec, (Vector2){0, 0}, 0, BLUE);
 }
 
-void draw_game_state(struct DrawState *ds) {
+void batch_sprite(SpriteBatch *b, int frame, int x, int y) {
+  b->sprites = grow_array(b->sprites, &b->cap, b->n + 1, sizeof(Sprite));
+  b->sprites[b->n++] = (Sprite){frame, x, y};
+}
+
+// Sends every queued sprite to rlgl as quads `size` across, then
+// empties the batch. It's all one texture, so rlgl only issues a draw
+// call when its vertex buffer fills, however many sprites there are.
+void draw_sprite_batch(SpriteBatch *b, const Texture2D *tex, float size,
+                       Color tint) {
+  if (b->n == 0)
+    return;
+
+  float fw = 1.0f / FRAMES_PER_ROW;
+  float fh = 1.0f / FRAMES_PER_COL;
+
+  rlSetTexture(tex->id);
+  rlBegin(RL_QUADS);
+  for (int i = 0; i < b->n; i++) {
+    if (i % SPRITE_GROUP == 0) {
+      int left = b->n - i;
+      rlCheckRenderBatchLimit(4 * (left < SPRITE_GROUP ? left : SPRITE_GROUP));
+    }
+
+    const Sprite *s = &b->sprites[i];
+    float u = (s->frame % FRAMES_PER_ROW) * fw;
+    float v = (s->frame / FRAMES_PER_ROW) * fh;
+    float x = s->x * size;
+    float y = s->y * size;
+
+    rlColor4ub(tint.r, tint.g, tint.b, tint.a);
+    rlNormal3f(0, 0, 1);
+    rlTexCoord2f(u, v);
+    rlVertex2f(x, y);
+    rlTexCoord2f(u, v + fh);
+    rlVertex2f(x, y + size);
+    rlTexCoord2f(u + fw, v + fh);
+    rlVertex2f(x + size, y + size);
+    rlTexCoord2f(u + fw, v);
+    rlVertex2f(x + size, y);
+  }
+  rlEnd();
+  rlSetTexture(0);
+
+  b->n = 0;
+}
+
+TileRect visible_tiles(const struct DrawState *ds) {
+  const Camera2D *c = &ds->camera;
+  float tile = SQUARE_SIZE * c->zoom;
+  TileRect r = {c->target.x / SQUARE_SIZE, c->target.y / SQUARE_SIZE, 0, 0};
+  r.x1 = r.x0 + FLOOR_WIDTH / tile + 2;
+  r.y1 = r.y0 + SCREEN_HEIGHT / tile + 2;
+  return r;
+}
+
+// The tiles on screen that are on the floor too.
+TileRect visible_floor(const struct DrawState *ds) {
+  const TileGrid *g = &ds->gs->grid;
+  TileRect r = visible_tiles(ds);
+  if (r.x1 > g->width)
+    r.x1 = g->width;
+  if (r.y1 > g->height)
+    r.y1 = g->height;
+  return r;
+}
+
+// The cached chunk at chunk coordinates (x, y), taking over the least
+// recently drawn slot if it isn't cached. STATIC_CHUNKS is well over
+// what's on screen at MIN_ZOOM, so nothing drawn this frame is taken.
+StaticChunk *static_chunk(struct DrawState *ds, int x, int y) {
+  StaticChunk *oldest = &ds->chunks[0];
+  for (int i = 0; i < STATIC_CHUNKS; i++) {
+    StaticChunk *c = &ds->chunks[i];
+    if (c->x == x && c->y == y)
+      return c;
+    if (c->last_drawn < oldest->last_drawn)
+      oldest = c;
+  }
+
+  oldest->x = x;
+  oldest->y = y;
+  oldest->version = -1;
+  return oldest;
+}
+
+bool tile_holds(GameState *gs, int x, int y, ObjectReference o) {
+  int i = tile_index(gs, x, y);
+  return i != -1 && gs->grid.statics[i].object_type == o.object_type &&
+         gs->grid.statics[i].id == o.id;
+}
+
+// Machines, stockpile floors and walls only change with the layout, so
+// they're drawn a chunk at a time into textures from the tile grid, and
+// a chunk is only redrawn once the layout has moved on.
+void draw_static_chunk(struct DrawState *ds, StaticChunk *c) {
   GameState *gs = ds->gs;
-  Texture2D *tex = ds->tilemap;
-  Font *font = ds->font;
-  int font_size = font->baseSize * 2.0;
-  char *text_buffer = ds->context_menu_text;
-  BeginDrawing();
+  int x0 = c->x * CHUNK_TILES;
+  int y0 = c->y * CHUNK_TILES;
+
+  if (c->texture.id == 0) {
+    c->texture = LoadRenderTexture(CHUNK_TILES * CHUNK_TEXELS,
+                                   CHUNK_TILES * CHUNK_TEXELS);
+  }
+  BeginTextureMode(c->texture);
   ClearBackground(RAYWHITE);
 
-  // Draw machines
-  for (int i = 0; i < gs->c_machines; i++) {
-    Machine w = gs->machines[i];
-    for (int i = 0; i < w.size.x; i++) {
-      for (int j = 0; j < w.size.y; j++) {
-        draw_frame_in_square(FRAME_MACHINE, w.location.x + i, w.location.y + j,
-                             tex);
+  for (int y = 0; y < CHUNK_TILES; y++) {
+    for (int x = 0; x < CHUNK_TILES; x++) {
+      int i = tile_index(gs, x0 + x, y0 + y);
+      if (i == -1)
+        continue;
+
+      if (gs->grid.blocked[i] & TILE_WALL) {
+        batch_sprite(&ds->sprites, FRAME_WALL, x, y);
+      } else if (gs->grid.statics[i].object_type == O_MACHINE) {
+        batch_sprite(&ds->sprites, FRAME_MACHINE, x, y);
+      } else if (gs->grid.statics[i].object_type == O_STOCKPILE) {
+        batch_sprite(&ds->sprites, FRAME_STOCKPILE, x, y);
       }
     }
   }
-
-  // Draw stockpiles
-  for (int i = 0; i < gs->c_stockpile; i++) {
-    Stockpile s = gs->stockpiles[i];
-    int x = s.location.x;
-    int y = s.location.y;
-    int w = s.size.x;
-    int h = s.size.y;
-
-    for (int i = 0; i < w; i++) {
-      for (int j = 0; j < h; j++) {
-        draw_frame_in_square(FRAME_STOCKPILE, x + i, y + j, tex);
-      }
+  draw_sprite_batch(&ds->sprites, ds->tilemap, CHUNK_TEXELS, BLUE);
+
+  // Stockpile borders, wherever a stockpile tile meets one that isn't
+  // part of it.
+  for (int y = 0; y < CHUNK_TILES; y++) {
+    for (int x = 0; x < CHUNK_TILES; x++) {
+      int i = tile_index(gs, x0 + x, y0 + y);
+      if (i == -1 || gs->grid.statics[i].object_type != O_STOCKPILE)
+        continue;
+
+      ObjectReference o = gs->grid.statics[i];
+      int left = x * CHUNK_TEXELS;
+      int top = y * CHUNK_TEXELS;
+      int right = left + CHUNK_TEXELS;
+      int bottom = top + CHUNK_TEXELS;
+      if (!tile_holds(gs, x0 + x, y0 + y - 1, o))
+        DrawLine(left, top, right, top, WHITE);
+      if (!tile_holds(gs, x0 + x, y0 + y + 1, o))
+        DrawLine(left, bottom, right, bottom, WHITE);
+      if (!tile_holds(gs, x0 + x - 1, y0 + y, o))
+        DrawLine(left, top, left, bottom, WHITE);
+      if (!tile_holds(gs, x0 + x + 1, y0 + y, o))
+        DrawLine(right, top, right, bottom, WHITE);
     }
+  }
 
-    DrawLine(SQUARE_SIZE * x, SQUARE_SIZE * y, SQUARE_SIZE * (x + w),
-             SQUARE_SIZE * y, WHITE);
+  EndTextureMode();
+  c->version = gs->layout_version;
+}
 
-    DrawLine(SQUARE_SIZE * x, SQUARE_SIZE * (y + h), SQUARE_SIZE * (x + w),
-             SQUARE_SIZE * (y + h), WHITE);
+// Brings every chunk on screen up to date. Texture mode can't be
+// entered part way through drawing the frame, so this runs first.
+void update_static_chunks(struct DrawState *ds, TileRect floor) {
+  ds->frame++;
+  for (int cy = floor.y0 / CHUNK_TILES; cy * CHUNK_TILES < floor.y1; cy++) {
+    for (int cx = floor.x0 / CHUNK_TILES; cx * CHUNK_TILES < floor.x1;
+         cx++) {
+      StaticChunk *c = static_chunk(ds, cx, cy);
+      c->last_drawn = ds->frame;
+      if (c->version != ds->gs->layout_version)
+        draw_static_chunk(ds, c);
+    }
+  }
+}
 
-    DrawLine(SQUARE_SIZE * x, SQUARE_SIZE * y, SQUARE_SIZE * x,
-             SQUARE_SIZE * (y + h), WHITE);
+void draw_static_chunks(struct DrawState *ds, TileRect floor) {
+  float texels = CHUNK_TILES * CHUNK_TEXELS;
+  float size = CHUNK_TILES * SQUARE_SIZE;
+
+  for (int cy = floor.y0 / CHUNK_TILES; cy * CHUNK_TILES < floor.y1; cy++) {
+    for (int cx = floor.x0 / CHUNK_TILES; cx * CHUNK_TILES < floor.x1;
+         cx++) {
+      StaticChunk *c = static_chunk(ds, cx, cy);
+      // Render textures are stored bottom up, hence the negative height.
+      DrawTexturePro(c->texture.texture, (Rectangle){0, 0, texels, -texels},
+                     (Rectangle){cx * size, cy * size, size, size},
+                     (Vector2){0, 0}, 0, WHITE);
+    }
+  }
+}
 
-    DrawLine(SQUARE_SIZE * (x + w), SQUARE_SIZE * y, SQUARE_SIZE * (x + w),
-             SQUARE_SIZE * (y + h), WHITE);
+// Stockpile contents and workers, for what's on screen.
+void draw_dynamic_sprites(struct DrawState *ds, TileRect floor) {
+  GameState *gs = ds->gs;
+  SpriteBatch *b = &ds->sprites;
 
-    for (int j = 0; j < s.c_contents; j++) {
-      if (s.contents_count[j] > 0) {
-        draw_frame_in_square(FRAME_MATERIAL, (x + j), y, tex);
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    const Stockpile *s = get_stockpile_by_id(gs, i);
+    int x = s->location.x;
+    int y = s->location.y;
+    if (y < floor.y0 || y >= floor.y1 || x >= floor.x1 ||
+        x + PM_COUNT < floor.x0)
+      continue;
+
+    int shown = 0;
+    for (int p = 0; p < PM_COUNT; p++) {
+      if (s->contents.count[p] > 0) {
+        batch_sprite(b, FRAME_MATERIAL, x + shown++, y);
       }
     }
   }
 
-  // Draw workers
   for (int i = 0; i < gs->c_workers; i++) {
-    Worker w = gs->workers[i];
-    draw_frame_in_square(FRAME_WORKER, w.location.x, w.location.y, tex);
+    Vector at = get_worker_by_id(gs, i)->hot->location;
+    if (at.x >= floor.x0 && at.x < floor.x1 && at.y >= floor.y0 &&
+        at.y < floor.y1)
+      batch_sprite(b, FRAME_WORKER, at.x, at.y);
   }
 
-  DrawLine(SQUARE_SIZE * (MAX_X + 1), 0, SQUARE_SIZE * (MAX_X + 1),
-           SCREEN_HEIGHT, GRAY);
-
-  // Draw context menu
+  draw_sprite_batch(b, ds->tilemap, SQUARE_SIZE, BLUE);
+}
 
-  if (ds->placement_mode) {
-    int y_offset = 1;
-    DrawTextEx(*font, "PLACEMENT MODE (q to quit)",
-               (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                         (y_offset++ * font_size)},
-               font_size, 4, BLUE);
-    DrawTextEx(*font, "hjkl to resize, c to place.",
-               (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                         (y_offset++ * font_size)},
-               font_size, 4, BLUE);
+// What object_under_point() would say, from a view. Views don't carry
+// the grid's per-tile worker lists, so workers are looked for directly.
+ObjectReference object_at(GameState *gs, int x, int y) {
+  for (int i = 0; i < gs->c_workers; i++) {
+    if (vec_equal(get_worker_by_id(gs, i)->hot->location, (Vector){x, y}))
+      return (ObjectReference){O_WORKER, i};
   }
 
-  else if (ds->menu_mode == MENU_MAIN) {
-    int y_offset = 1;
-    DrawTextEx(*font, "MENU (q to quit)",
-               (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                         (y_offset++ * font_size)},
-               font_size, 4, BLUE);
+  int i = tile_index(gs, x, y);
+  if (i == -1)
+    return (ObjectReference){O_NOTHING, -1};
+  return gs->grid.statics[i];
+}
 
-    DrawTextEx(*font, "m) MACHINE",
-               (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                         (y_offset++ * font_size)},
-               font_size, 4, BLUE);
+// object_at() the cursor, looked up again only when the view has
+// ticked, the layout has changed or the cursor has moved.
+ObjectReference selected_object(struct DrawState *ds) {
+  GameState *gs = ds->gs;
+  if (ds->selected_turn != gs->turn ||
+      ds->selected_layout != gs->layout_version ||
+      !vec_equal(ds->selected_at, ds->cursor)) {
+    ds->selected = object_at(gs, ds->cursor.x, ds->cursor.y);
+    ds->selected_turn = gs->turn;
+    ds->selected_layout = gs->layout_version;
+    ds->selected_at = ds->cursor;
+  }
+  return ds->selected;
+}
 
-    DrawTextEx(*font, "s) STOCKPILE",
-               (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                         (y_offset++ * font_size)},
-               font_size, 4, BLUE);
+/* -------------
+ * PANEL
+ *
+ * The side panel is only formatted and laid out again when something
+ * it shows has changed. Each frame digests the menu state and the
+ * fields the panel would show of the selected object, and rebuilds
+ * the lines if the digest differs from the one they were built for.
+ * The panel's text is plain ASCII, so each byte is its own codepoint.
+ * ------------- */
+
+uint64_t digest(uint64_t h, long x) {
+  for (size_t i = 0; i < sizeof(x); i++) {
+    h = (h ^ ((unsigned long)x >> (8 * i) & 0xff)) * 1099511628211ULL;
   }
+  return h;
+}
 
-  else if (ds->menu_mode == MENU_MACHINE_SELECT) {
-    int y_offset = 1;
+uint64_t digest_inventory(uint64_t h, const Inventory *inv) {
+  h = digest(h, inv->present);
+  for (int p = 0; p < PM_COUNT; p++) {
+    h = digest(h, inv->count[p]);
+  }
+  return h;
+}
 
-    DrawTextEx(*font, "SELECT MACHINE (q to quit)",
-               (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                         (y_offset++ * font_size)},
-               font_size, 4, BLUE);
+uint64_t panel_version(struct DrawState *ds, ObjectReference o) {
+  GameState *gs = ds->gs;
+  uint64_t h = 14695981039346656037ULL;
+  h = digest(h, ds->menu_mode);
+  h = digest(h, ds->menu_modifier);
+  h = digest(h, ds->placement_mode);
+  h = digest(h, ds->paused);
+  h = digest(h, ds->speed);
+  if (ds->placement_mode)
+    return h;
 
-    for (int i = 0; i < COUNT_MACHINE_TYPES; i++) {
-      sprintf(text_buffer, "%d) %s", i + 1, machine_str(i));
-      DrawTextEx(*font, text_buffer,
-                 (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                           (y_offset++ * font_size)},
-                 font_size, 4, BLUE);
+  if (ds->menu_mode == MENU_ATTACH_MACHINE_STOCKPILE) {
+    h = digest(h, gs->c_machines);
+    for (int i = 0; i < gs->c_machines; i++) {
+      h = digest(h, get_machine_by_id(gs, i)->input_stockpile);
+      h = digest(h, get_machine_by_id(gs, i)->output_stockpile);
     }
+  } else if (ds->menu_mode == MENU_NONE) {
+    h = digest(h, o.object_type);
+    h = digest(h, o.id);
+    if (o.object_type == O_WORKER) {
+      h = digest(h, get_worker_by_id(gs, o.id)->hot->job);
+    } else if (o.object_type == O_MACHINE) {
+      Machine *m = get_machine_by_id(gs, o.id);
+      h = digest(h, m->type);
+      h = digest(h, m->has_current_work_order);
+      h = digest(h, m->has_current_work_order ? (long)m->active_recipe->name
+                                              : -1);
+      h = digest(h, m->input_stockpile);
+      h = digest(h, m->output_stockpile);
+    } else if (o.object_type == O_STOCKPILE) {
+      Stockpile *s = get_stockpile_by_id(gs, o.id);
+      h = digest(h, s->attached_machine);
+      h = digest(h, s->io);
+      h = digest_inventory(h, &s->contents);
+      h = digest_inventory(h, &s->hot->required_material);
+    }
+  }
+  return h;
+}
 
-  } else if (ds->menu_mode == MENU_ADD_REQUIRED_MATERIAL) {
-    int y_offset = 1;
+// Adds a line at `at`, formatted as by vprintf() and laid out as
+// DrawTextEx() would lay it out.
+void add_panel_line(Panel *p, Vector2 at, const char *format,
+                    va_list args) {
+  if (p->c_lines == PANEL_LINES)
+    return;
+  PanelLine *l = &p->lines[p->c_lines++];
+  l->at = at;
+  vsnprintf(l->text, sizeof(l->text), format, args);
+
+  Font *font = p->font;
+  float scale = p->font_size / font->baseSize;
+  float x = 0;
+  l->c_glyphs = 0;
+  for (const char *c = l->text; *c; c++) {
+    int codepoint = (unsigned char)*c;
+    int index = GetGlyphIndex(*font, codepoint);
+    if (codepoint != ' ' && codepoint != '\t') {
+      l->codepoints[l->c_glyphs] = codepoint;
+      l->glyph_x[l->c_glyphs] = x;
+      l->c_glyphs++;
+    }
+
+    float advance = font->glyphs[index].advanceX;
+    if (advance == 0)
+      advance = font->recs[index].width;
+    x += advance * scale + PANEL_SPACING;
+  }
+}
+
+void panel_line_at(Panel *p, Vector2 at, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  add_panel_line(p, at, format, args);
+  va_end(args);
+}
+
+// Adds a line to the panel's column on `*row`, and moves on a row.
+void panel_line(Panel *p, int *row, const char *format, ...) {
+  Vector2 at = {SQUARE_SIZE * (MAX_X + 1) + p->font_size,
+                *row * p->font_size};
+  (*row)++;
 
-    DrawTextEx(*font, "ADD REQUIRED MATERIAL TO STOCKPILE (q to quit)",
-               (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                         (y_offset++ * font_size)},
-               font_size, 4, BLUE);
-    y_offset++;
+  va_list args;
+  va_start(args, format);
+  add_panel_line(p, at, format, args);
+  va_end(args);
+}
 
-    sprintf(text_buffer, "Quantity (j/k for dec/inc): %d", ds->menu_modifier);
-    DrawTextEx(*font, text_buffer,
-               (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                         (y_offset++ * font_size)},
-               font_size, 4, BLUE);
-    y_offset++;
+void build_menu_panel(struct DrawState *ds, Panel *p) {
+  GameState *gs = ds->gs;
+  int row = 1;
 
+  if (ds->placement_mode) {
+    panel_line(p, &row, "PLACEMENT MODE (q to quit)");
+    panel_line(p, &row, "hjkl to resize, c to place.");
+  }
+
+  else if (ds->menu_mode == MENU_MAIN) {
+    panel_line(p, &row, "MENU (q to quit)");
+    panel_line(p, &row, "m) MACHINE");
+    panel_line(p, &row, "s) STOCKPILE");
+    panel_line(p, &row, "w) WALL");
+    panel_line(p, &row, "f) SAVE FACTORY");
+  }
+
+  else if (ds->menu_mode == MENU_MACHINE_SELECT) {
+    panel_line(p, &row, "SELECT MACHINE (q to quit)");
+    for (int i = 0; i < COUNT_MACHINE_TYPES; i++) {
+      panel_line(p, &row, "%d) %s", i + 1, machine_str(i));
+    }
+
+  } else if (ds->menu_mode == MENU_ADD_REQUIRED_MATERIAL) {
+    panel_line(p, &row, "ADD REQUIRED MATERIAL TO STOCKPILE (q to quit)");
+    row++;
+    panel_line(p, &row, "Quantity (j/k for dec/inc): %d", ds->menu_modifier);
+    row++;
     for (int i = 1; i < PM_COUNT; i++) {
-      sprintf(text_buffer, "%d) %s", i, material_str(i));
-      DrawTextEx(*font, text_buffer,
-                 (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                           (y_offset++ * font_size)},
-                 font_size, 4, BLUE);
+      panel_line(p, &row, "%d) %s", i, material_str(i));
     }
 
   } else if (ds->menu_mode == MENU_ATTACH_MACHINE_STOCKPILE) {
-
-    int y_offset = 1;
-
     if (ds->menu_modifier == 'i') {
-      DrawTextEx(*font, "SELECT MACHINE TO ATTACH INPUT STOCKPILE (q to quit)",
-                 (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                           (y_offset++ * font_size)},
-                 font_size, 4, BLUE);
+      panel_line(p, &row,
+                 "SELECT MACHINE TO ATTACH INPUT STOCKPILE (q to quit)");
     } else if (ds->menu_modifier == 'o') {
-      DrawTextEx(*font, "SELECT MACHINE TO ATTACH OUTPUT STOCKPILE (q to quit)",
-                 (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                           (y_offset++ * font_size)},
-                 font_size, 4, BLUE);
+      panel_line(p, &row,
+                 "SELECT MACHINE TO ATTACH OUTPUT STOCKPILE (q to quit)");
     }
 
-    Machine *m;
-    for (int i = 0; i < gs->c_machines; i++) {
-      m = get_machine_by_id(i);
-      if (ds->menu_modifier == 'i' && m->input_stockpile == -1) {
-        sprintf(text_buffer, "%d) %s", i, machine_str(i));
-        DrawTextEx(*font, text_buffer,
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             (y_offset++ * font_size)},
-                   font_size, 4, BLUE);
-      }
-      if (ds->menu_modifier == 'o' && m->output_stockpile == -1) {
-        sprintf(text_buffer, "%d) %s", i, machine_str(i));
-        DrawTextEx(*font, text_buffer,
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             (y_offset++ * font_size)},
-                   font_size, 4, BLUE);
+    for (int i = 0; i < gs->c_machines && p->c_lines < PANEL_LINES; i++) {
+      Machine *m = get_machine_by_id(gs, i);
+      if ((ds->menu_modifier == 'i' && m->input_stockpile == -1) ||
+          (ds->menu_modifier == 'o' && m->output_stockpile == -1)) {
+        panel_line(p, &row, "%d) %s", i, machine_str(i));
       }
     }
-  } else {
-    ObjectReference o = object_under_point(gs->cursor.x, gs->cursor.y);
-
-    switch (o.object_type) {
-    case O_NOTHING: {
-      break;
-    }
-    case O_WORKER: {
-      // printf("DEBUG: Worker under cursor\n");
-      Worker *w = get_worker_by_id(o.id);
-      sprintf(text_buffer, "Worker %d, doing %s", w->id, job_str(w->job));
-      DrawTextEx(*font, text_buffer,
-                 (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size, font_size},
-                 font_size, 4, BLUE);
-
-      break;
-    }
-    case O_MACHINE: {
-      int y_offset = 1;
-      // printf("DEBUG: Machine under cursor\n");
-      Machine *m = get_machine_by_id(o.id);
-      sprintf(text_buffer, "%s machine %d", machine_str(m->type), m->id);
-      DrawTextEx(*font, text_buffer,
-                 (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                           (font_size * y_offset)},
-                 font_size, 4, BLUE);
-      y_offset++;
-
-      if (m->has_current_work_order) {
-        sprintf(text_buffer, "Machining batch of %s",
-                recipe_str(m->active_recipe.name));
-        DrawTextEx(*font, text_buffer,
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             (font_size * y_offset)},
-                   font_size, 4, BLUE);
-        y_offset++;
-      } else {
-        DrawTextEx(*font, "Idle",
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             (font_size * y_offset)},
-                   font_size, 4, BLUE);
-      }
+  }
+}
 
-      if (m->output_stockpile > -1 && m->input_stockpile > -1) {
-        DrawTextEx(*font, "a) add job",
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             SQUARE_SIZE * (MAX_Y - 2)},
-                   font_size, 4, BLUE);
-      } else {
-
-        DrawTextEx(*font, "Can't add job, missing io stockpiles",
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             SQUARE_SIZE * (MAX_Y - 2)},
-                   font_size, 4, BLUE);
-      }
-      break;
+void build_object_panel(struct DrawState *ds, Panel *p, ObjectReference o) {
+  GameState *gs = ds->gs;
+  int row = 1;
+
+  switch (o.object_type) {
+  case O_NOTHING: {
+    break;
+  }
+  case O_WORKER: {
+    Worker *w = get_worker_by_id(gs, o.id);
+    panel_line(p, &row, "Worker %d, doing %s", w->id, job_str(w->hot->job));
+    break;
+  }
+  case O_MACHINE: {
+    Machine *m = get_machine_by_id(gs, o.id);
+    panel_line(p, &row, "%s machine %d", machine_str(m->type), m->id);
+
+    if (m->has_current_work_order) {
+      panel_line(p, &row, "Machining batch of %s",
+                 recipe_str(m->active_recipe->name));
+    } else {
+      panel_line(p, &row, "Idle");
     }
-    case O_STOCKPILE: {
-      int y_offset = 1;
 
-      Stockpile *s = get_stockpile_by_id(o.id);
+    Vector2 footer = {SQUARE_SIZE * (MAX_X + 1) + p->font_size,
+                      SQUARE_SIZE * (MAX_Y - 2)};
+    if (m->output_stockpile > -1 && m->input_stockpile > -1) {
+      panel_line_at(p, footer, "a) add job");
+    } else {
+      panel_line_at(p, footer, "Can't add job, missing io stockpiles");
+    }
+    break;
+  }
+  case O_STOCKPILE: {
+    Stockpile *s = get_stockpile_by_id(gs, o.id);
 
-      if (s->attached_machine >= 0) {
-        sprintf(text_buffer, "Stockpile %d: %s for machine %d", s->id,
-                (s->io == INPUT) ? "input" : "output", s->attached_machine);
-      } else {
-        sprintf(text_buffer, "Stockpile %d", s->id);
-      }
-      DrawTextEx(*font, text_buffer,
-                 (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                           (y_offset++ * font_size)},
-                 font_size, 4, BLUE);
-
-      y_offset++;
-
-      if (s->c_contents > 0) {
-        DrawTextEx(*font, "Contains",
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             (y_offset++ * font_size)},
-                   font_size, 4, BLUE);
-
-        for (int i = 0; i < s->c_contents; i++) {
-          if (s->contents_count[i] > 0) {
-            sprintf(text_buffer, "\t%s: %d", material_str(s->contents[i]),
-                    s->contents_count[i]);
-            DrawTextEx(*font, text_buffer,
-                       (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                                 (font_size * y_offset++)},
-                       font_size, 4, BLUE);
-          }
+    if (s->attached_machine >= 0) {
+      panel_line(p, &row, "Stockpile %d: %s for machine %d", s->id,
+                 (s->io == INPUT) ? "input" : "output", s->attached_machine);
+    } else {
+      panel_line(p, &row, "Stockpile %d", s->id);
+    }
+    row++;
+
+    if (s->contents.present != 0) {
+      panel_line(p, &row, "Contains");
+      for (int m = 0; m < PM_COUNT; m++) {
+        if (s->contents.count[m] > 0) {
+          panel_line(p, &row, "\t%s: %d", material_str(m),
+                     s->contents.count[m]);
         }
       }
+    }
 
-      if (s->c_required_material > 0) {
-        DrawTextEx(*font, "Requires",
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             (font_size * y_offset++)},
-                   font_size, 4, BLUE);
-
-        for (int i = 0; i < s->c_required_material; i++) {
-          if (s->required_material_count[i] > 0) {
-            sprintf(text_buffer, "\t%s: %d",
-                    material_str(s->required_material[i]),
-                    s->required_material_count[i]);
-            DrawTextEx(*font, text_buffer,
-                       (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                                 (font_size * y_offset++)},
-                       font_size, 4, BLUE);
-          }
+    if (s->hot->required_material.present != 0) {
+      panel_line(p, &row, "Requires");
+      for (int m = 0; m < PM_COUNT; m++) {
+        if (s->hot->required_material.count[m] > 0) {
+          panel_line(p, &row, "\t%s: %d", material_str(m),
+                     s->hot->required_material.count[m]);
         }
       }
+    }
+    row++;
 
-      y_offset++;
+    panel_line(p, &row, "r) add required material");
+    if (s->attached_machine == -1) {
+      panel_line(p, &row, "i) Add as input for machine");
+      panel_line(p, &row, "o) Add as output for machine");
+    }
+    break;
+  }
+  default: {
+    // printf("ERROR: Unrecognized object %d under cursor\n", o.object_type);
+    exit(1);
+  }
+  }
+}
 
-      DrawTextEx(*font, "r) add required material",
-                 (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                           (font_size * y_offset++)},
-                 font_size, 4, BLUE);
+// Rebuilds the panel if what it shows has changed since it was built.
+void update_panel(struct DrawState *ds) {
+  Panel *p = &ds->panel;
+  ObjectReference o = selected_object(ds);
+  uint64_t version = panel_version(ds, o);
+  if (p->built && p->version == version)
+    return;
 
-      if (s->attached_machine == -1) {
-        DrawTextEx(*font, "i) Add as input for machine",
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             (font_size * y_offset++)},
-                   font_size, 4, BLUE);
+  p->font = ds->font;
+  p->font_size = ds->font->baseSize * 2.0;
+  p->c_lines = 0;
+  if (ds->placement_mode || ds->menu_mode != MENU_NONE) {
+    build_menu_panel(ds, p);
+  } else {
+    build_object_panel(ds, p, o);
+  }
 
-        DrawTextEx(*font, "o) Add as output for machine",
-                   (Vector2){SQUARE_SIZE * (MAX_X + 1) + font_size,
-                             (font_size * y_offset++)},
-                   font_size, 4, BLUE);
-      }
+  Vector2 status = {SQUARE_SIZE * (MAX_X / 2.0f) + p->font_size,
+                    SQUARE_SIZE * (MAX_Y - 1)};
+  panel_line_at(p, status, "%s",
+                ds->paused ? "PAUSED" : speed_names[ds->speed]);
 
-      break;
-    }
-    default: {
-      // printf("ERROR: Unrecognized object %d under cursor\n", o.object_type);
-      exit(1);
-    }
+  p->version = version;
+  p->built = true;
+}
+
+#if PROFILE
+// Rebuilds the profiler overlay from the spans recorded since it was
+// last built: the mean time each phase took, and how often it ran.
+void update_profile_overlay(struct DrawState *ds) {
+  double now = GetTime();
+  if (now - ds->profile_since < PROFILE_OVERLAY_SECONDS)
+    return;
+
+  ProfileTotal totals[PROF_PHASE_COUNT];
+  profile_totals(totals);
+  double seconds = now - ds->profile_since;
+
+  Panel *p = &ds->profile_panel;
+  p->font = ds->font;
+  p->font_size = ds->font->baseSize * 2.0;
+  p->c_lines = 0;
+  float columns[3] = {p->font_size, p->font_size * 14, p->font_size * 19};
+  float y = p->font_size;
+  panel_line_at(p, (Vector2){columns[0], y}, "PHASE");
+  panel_line_at(p, (Vector2){columns[1], y}, "US");
+  panel_line_at(p, (Vector2){columns[2], y}, "PER S");
+
+  for (int i = 0; i < PROF_PHASE_COUNT; i++) {
+    uint64_t count = totals[i].count - ds->profile_last[i].count;
+    uint64_t ns = totals[i].ns - ds->profile_last[i].ns;
+    y += p->font_size;
+    panel_line_at(p, (Vector2){columns[0], y}, "%s", profile_phase_str(i));
+    panel_line_at(p, (Vector2){columns[1], y}, "%.1f",
+                  count > 0 ? ns / 1e3 / count : 0.0);
+    panel_line_at(p, (Vector2){columns[2], y}, "%.0f", count / seconds);
+    ds->profile_last[i] = totals[i];
+  }
+  ds->profile_since = now;
+}
+#endif
+
+void draw_panel(const Panel *p) {
+  for (int i = 0; i < p->c_lines; i++) {
+    const PanelLine *l = &p->lines[i];
+    for (int g = 0; g < l->c_glyphs; g++) {
+      Vector2 at = {l->at.x + l->glyph_x[g], l->at.y};
+      DrawTextCodepoint(*p->font, l->codepoints[g], at, p->font_size, BLUE);
     }
   }
+}
+
+void draw_game_state(struct DrawState *ds) {
+  PROF_BEGIN(PROF_RENDER);
+  GameState *gs = ds->gs;
+  Texture2D *tex = ds->tilemap;
+
+  TileRect floor = visible_floor(ds);
+  update_static_chunks(ds, floor);
+  update_panel(ds);
+  BeginDrawing();
+  ClearBackground(RAYWHITE);
+
+  BeginScissorMode(0, 0, FLOOR_WIDTH, SCREEN_HEIGHT);
+  BeginMode2D(ds->camera);
+  draw_static_chunks(ds, floor);
+  draw_dynamic_sprites(ds, floor);
 
   // draw cursor
   if (ds->menu_mode == MENU_NONE) {
-    draw_frame_in_square(FRAME_CURSOR, gs->cursor.x, gs->cursor.y, tex);
+    draw_frame_in_square(FRAME_CURSOR, ds->cursor.x, ds->cursor.y, tex);
   }
 
   // draw placement rect
   if (ds->placement_mode) {
     int frame_sprite;
-    if (ds->placement_of == O_STOCKPILE) {
+    if (!area_is_free(gs, ds->cursor.x, ds->cursor.y, ds->placement_size.x,
+                      ds->placement_size.y)) {
+      frame_sprite = FRAME_UNKNOWN;
+    } else if (ds->placement_of == O_STOCKPILE) {
       frame_sprite = FRAME_STOCKPILE;
     } else if (ds->placement_of == O_MACHINE) {
       frame_sprite = FRAME_MACHINE;
+    } else if (ds->placement_of == O_WALL) {
+      frame_sprite = FRAME_WALL;
     } else {
       frame_sprite = FRAME_UNKNOWN;
     }
 
-    int sx = ds->gs->cursor.x;
-    int sy = ds->gs->cursor.y;
+    int sx = ds->cursor.x;
+    int sy = ds->cursor.y;
     int ex = sx + ds->placement_size.x;
     int ey = sy + ds->placement_size.y;
     for (int x = sx; x < ex; x++) {
@@ -400,20 +790,64 @@ void draw_game_state(struct DrawState *ds) {
       }
     }
   }
+  EndMode2D();
+  EndScissorMode();
+  DrawLine(SQUARE_SIZE * (MAX_X + 1), 0, SQUARE_SIZE * (MAX_X + 1),
+           SCREEN_HEIGHT, GRAY);
 
-  if (ds->paused) {
-    DrawTextEx(*font, "PAUSED",
-               (Vector2){SQUARE_SIZE * (MAX_X / 2.0f) + font_size,
-                         SQUARE_SIZE * (MAX_Y - 1)},
-               font_size, 4, BLUE);
+  draw_panel(&ds->panel);
+
+#if PROFILE
+  update_profile_overlay(ds);
+  if (ds->show_profile) {
+    DrawRectangle(0, 0, FLOOR_WIDTH, SCREEN_HEIGHT / 2,
+                  (Color){245, 245, 245, 224});
+    draw_panel(&ds->profile_panel);
   }
+#endif
 
+  // Presenting waits on the frame rate, so isn't counted.
+  PROF_END(PROF_RENDER);
   EndDrawing();
 }
 
+int clamp_int(int x, int low, int high) {
+  return x < low ? low : x > high ? high : x;
+}
+
+// Zooms on -/= or the mouse wheel, and pans to keep the cursor on
+// screen.
+void update_camera(struct DrawState *ds) {
+  Camera2D *c = &ds->camera;
+  float wheel = GetMouseWheelMove();
+  if ((IsKeyPressed(KEY_EQUAL) || wheel > 0) && c->zoom < MAX_ZOOM) {
+    c->zoom *= 2;
+  }
+  if ((IsKeyPressed(KEY_MINUS) || wheel < 0) && c->zoom > MIN_ZOOM) {
+    c->zoom /= 2;
+  }
+
+  float view_w = FLOOR_WIDTH / c->zoom;
+  float view_h = SCREEN_HEIGHT / c->zoom;
+  float x = ds->cursor.x * SQUARE_SIZE;
+  float y = ds->cursor.y * SQUARE_SIZE;
+  if (x < c->target.x)
+    c->target.x = x;
+  if (x + SQUARE_SIZE > c->target.x + view_w)
+    c->target.x = x + SQUARE_SIZE - view_w;
+  if (y < c->target.y)
+    c->target.y = y;
+  if (y + SQUARE_SIZE > c->target.y + view_h)
+    c->target.y = y + SQUARE_SIZE - view_h;
+  if (c->target.x < 0)
+    c->target.x = 0;
+  if (c->target.y < 0)
+    c->target.y = 0;
+}
+
 void handle_input(struct DrawState *ds) {
   GameState *gs = ds->gs;
-  ObjectReference o = object_under_point(gs->cursor.x, gs->cursor.y);
+  ObjectReference o = selected_object(ds);
 
   if (ds->menu_mode == MENU_MAIN) {
     if (IsKeyPressed(KEY_Q)) {
@@ -430,6 +864,21 @@ void handle_input(struct DrawState *ds) {
     if (IsKeyPressed(KEY_M)) {
       ds->menu_mode = MENU_MACHINE_SELECT;
     }
+
+    if (IsKeyPressed(KEY_W)) { // wall placement
+      ds->menu_mode = MENU_NONE;
+      ds->placement_mode = true;
+      ds->placement_of = O_WALL;
+      ds->placement_size = (Vector2){1, 1};
+    }
+
+    if (IsKeyPressed(KEY_F)) {
+      ds->menu_mode = MENU_NONE;
+      sim_send((Command){.type = CMD_SAVE,
+                         .path = ds->snapshot_path,
+                         .x = ds->cursor.x,
+                         .y = ds->cursor.y});
+    }
     return;
   }
 
@@ -460,14 +909,15 @@ void handle_input(struct DrawState *ds) {
       ds->menu_mode = MENU_NONE;
     }
 
-    for (int i = 0; i < 9; i++) {
+    for (int i = 0; i < 9 && i < gs->c_machines; i++) {
       // 48 is num key 0
       if (IsKeyPressed(48 + i)) {
         if (ds->menu_modifier == 'i') {
-          add_input_stockpile_to_machine(i, sid);
+          sim_send((Command){.type = CMD_ATTACH_INPUT, .id = i, .value = sid});
           ds->menu_mode = MENU_NONE;
         } else if (ds->menu_modifier == 'o') {
-          add_output_stockpile_to_machine(i, sid);
+          sim_send(
+              (Command){.type = CMD_ATTACH_OUTPUT, .id = i, .value = sid});
           ds->menu_mode = MENU_NONE;
         } else {
           printf("ERROR: attach stockpile with invalid modifier %c",
@@ -480,7 +930,6 @@ void handle_input(struct DrawState *ds) {
   }
 
   if (ds->menu_mode == MENU_ADD_REQUIRED_MATERIAL) {
-    Stockpile *s = get_stockpile_by_id(o.id);
     if (IsKeyPressed(KEY_Q)) {
       ds->menu_mode = MENU_NONE;
     }
@@ -496,7 +945,10 @@ void handle_input(struct DrawState *ds) {
     for (int i = 1; i < PM_COUNT; i++) {
       // 48 is num key 0
       if (IsKeyPressed(48 + i)) {
-        add_required_material_to_stockpile(s, i, ds->menu_modifier);
+        sim_send((Command){.type = CMD_ADD_REQUIRED_MATERIAL,
+                           .id = o.id,
+                           .value = i,
+                           .count = ds->menu_modifier});
         ds->menu_mode = MENU_NONE;
       }
     }
@@ -504,22 +956,25 @@ void handle_input(struct DrawState *ds) {
   }
 
   if (ds->menu_mode == MENU_NONE) {
-    if (IsKeyPressed(KEY_RIGHT) && (gs->cursor.x < MAX_X)) {
-      gs->cursor.x++;
+    int step = IsKeyDown(KEY_LEFT_SHIFT) ? CURSOR_JUMP : 1;
+    if (IsKeyPressed(KEY_RIGHT)) {
+      ds->cursor.x += step;
     }
-    if (IsKeyPressed(KEY_LEFT) && (gs->cursor.x > 0)) {
-      gs->cursor.x--;
+    if (IsKeyPressed(KEY_LEFT)) {
+      ds->cursor.x -= step;
     }
-    if (IsKeyPressed(KEY_UP) && (gs->cursor.y > 0)) {
-      gs->cursor.y--;
+    if (IsKeyPressed(KEY_UP)) {
+      ds->cursor.y -= step;
     }
-    if (IsKeyPressed(KEY_DOWN) && (gs->cursor.y < MAX_Y)) {
-      gs->cursor.y++;
+    if (IsKeyPressed(KEY_DOWN)) {
+      ds->cursor.y += step;
     }
+    ds->cursor.x = clamp_int(ds->cursor.x, 0, FLOOR_LIMIT - 1);
+    ds->cursor.y = clamp_int(ds->cursor.y, 0, FLOOR_LIMIT - 1);
   }
 
   if (ds->placement_mode) {
-    if (ds->placement_of == O_STOCKPILE) {
+    if (ds->placement_of == O_STOCKPILE || ds->placement_of == O_WALL) {
       if (IsKeyPressed(KEY_L)) {
         ds->placement_size.x += 1;
       }
@@ -532,10 +987,35 @@ void handle_input(struct DrawState *ds) {
       if (IsKeyPressed(KEY_K) && ds->placement_size.y > 1) {
         ds->placement_size.y -= 1;
       }
+    }
 
-      if (IsKeyPressed(KEY_C)) {
-        add_stockpile(gs->cursor.x, gs->cursor.y, ds->placement_size.x,
-                      ds->placement_size.y);
+    if (ds->placement_of == O_STOCKPILE) {
+      if (IsKeyPressed(KEY_C) &&
+          area_is_free(gs, ds->cursor.x, ds->cursor.y, ds->placement_size.x,
+                       ds->placement_size.y)) {
+        sim_send((Command){.type = CMD_ADD_STOCKPILE,
+                           .x = ds->cursor.x,
+                           .y = ds->cursor.y,
+                           .w = ds->placement_size.x,
+                           .h = ds->placement_size.y});
+        ds->placement_mode = false;
+      }
+
+      if (IsKeyPressed(KEY_Q)) {
+        ds->placement_mode = false;
+        ds->menu_mode = MENU_MAIN;
+      }
+    }
+
+    if (ds->placement_of == O_WALL) {
+      if (IsKeyPressed(KEY_C) &&
+          area_is_free(gs, ds->cursor.x, ds->cursor.y, ds->placement_size.x,
+                       ds->placement_size.y)) {
+        sim_send((Command){.type = CMD_ADD_WALL,
+                           .x = ds->cursor.x,
+                           .y = ds->cursor.y,
+                           .w = ds->placement_size.x,
+                           .h = ds->placement_size.y});
         ds->placement_mode = false;
       }
 
@@ -547,8 +1027,13 @@ void handle_input(struct DrawState *ds) {
 
     if (ds->placement_of == O_MACHINE) {
 
-      if (IsKeyPressed(KEY_C)) {
-        add_machine(ds->placement_of_sub, gs->cursor.x, gs->cursor.y);
+      if (IsKeyPressed(KEY_C) &&
+          area_is_free(gs, ds->cursor.x, ds->cursor.y, ds->placement_size.x,
+                       ds->placement_size.y)) {
+        sim_send((Command){.type = CMD_ADD_MACHINE,
+                           .value = ds->placement_of_sub,
+                           .x = ds->cursor.x,
+                           .y = ds->cursor.y});
         ds->placement_mode = false;
       }
 
@@ -566,6 +1051,21 @@ void handle_input(struct DrawState *ds) {
 
     if (IsKeyPressed(KEY_P)) {
       ds->paused = !ds->paused;
+      sim_send((Command){.type = CMD_SET_PAUSED, .value = ds->paused});
+    }
+
+#if PROFILE
+    if (IsKeyPressed(KEY_F3)) {
+      ds->show_profile = !ds->show_profile;
+    }
+#endif
+
+    for (int i = 0; i < SPEED_COUNT; i++) {
+      // 49 is num key 1
+      if (IsKeyPressed(49 + i)) {
+        ds->speed = i;
+        sim_send((Command){.type = CMD_SET_SPEED, .value = i});
+      }
     }
 
     if (IsKeyPressed(KEY_M)) {
@@ -582,17 +1082,17 @@ void handle_input(struct DrawState *ds) {
 
   if (o.object_type == O_MACHINE) {
     if (IsKeyPressed(KEY_A)) {
-      Machine *m = get_machine_by_id(o.id);
+      Machine *m = get_machine_by_id(gs, o.id);
       const RecipeName *rs = possible_recipes(m);
       // @IMPROVE: currently this just takes the first thing
       // should be able to pick any possible recipe
       RecipeName r = *rs;
-      assign_machine_production_job(o.id, r);
+      sim_send((Command){.type = CMD_ASSIGN_JOB, .id = o.id, .value = r});
     }
   }
 
   if (o.object_type == O_STOCKPILE) {
-    Stockpile *s = get_stockpile_by_id(o.id);
+    Stockpile *s = get_stockpile_by_id(gs, o.id);
 
     if (IsKeyPressed(KEY_R)) {
       ds->menu_mode = MENU_ADD_REQUIRED_MATERIAL;
@@ -612,85 +1112,97 @@ void handle_input(struct DrawState *ds) {
   }
 }
 
-int main(void) {
-  int frame = 0;
-  long turn = 0;
+// The factory a new game starts with.
+void start_factory(GameState *gs) {
   const bool setup = false;
 
-  srand(time(0));
-  GameState *gs = new_game();
-  char *context_menu_text = malloc(sizeof(char) * 100);
-
-  struct DrawState ds = {
-      .gs = gs,
-      .context_menu_text = context_menu_text,
-  };
-
-  if (!context_menu_text) {
-    printf("Allocation Error for context menu text\n");
-    exit(1);
-  }
-
-  int factory_in = add_stockpile(0, 3, 2, 2);
-  int factory_out = add_stockpile(14, 3, 2, 2);
-  Stockpile *s = get_stockpile_by_id(factory_in);
-  s->can_be_taken_from = true;
-  add_material_to_stockpile(s, EMPTY_SPINDLE, 5);
-  add_material_to_stockpile(s, WASHED_IRON_WIRE_COIL, 5);
-  add_material_to_stockpile(s, SMALL_BOWL, 5);
+  int factory_in = add_stockpile(gs, 0, 3, 2, 2);
+  int factory_out = add_stockpile(gs, 14, 3, 2, 2);
+  Stockpile *s = get_stockpile_by_id(gs, factory_in);
+  set_stockpile_takeable(gs, s, true);
+  add_material_to_stockpile(gs, s, EMPTY_SPINDLE, 5);
+  add_material_to_stockpile(gs, s, WASHED_IRON_WIRE_COIL, 5);
+  add_material_to_stockpile(gs, s, SMALL_BOWL, 5);
 
   if (setup) {
     // WINDER machine
-    int in = add_stockpile(2, 2, 2, 2);
-    Stockpile *s_in = get_stockpile_by_id(in);
-    int out = add_stockpile(2, 6, 2, 2);
+    int in = add_stockpile(gs, 2, 2, 2, 2);
+    int out = add_stockpile(gs, 2, 6, 2, 2);
+    Stockpile *s_in = get_stockpile_by_id(gs, in);
 
     add_required_material_to_stockpile(s_in, EMPTY_SPINDLE, 1);
-    add_material_to_stockpile(s_in, WASHED_IRON_WIRE_COIL, 1);
-    add_material_to_stockpile(s_in, EMPTY_SPINDLE, 1);
+    add_material_to_stockpile(gs, s_in, WASHED_IRON_WIRE_COIL, 1);
+    add_material_to_stockpile(gs, s_in, EMPTY_SPINDLE, 1);
 
-    int winder = add_machine(WIRE_WINDER, 2, 4);
-    add_output_stockpile_to_machine(winder, out);
-    add_input_stockpile_to_machine(winder, in);
+    int winder = add_machine(gs, WIRE_WINDER, 2, 4);
+    add_output_stockpile_to_machine(gs, winder, out);
+    add_input_stockpile_to_machine(gs, winder, in);
 
     // PULLER machine
-    out = add_stockpile(11, 10, 3, 3);
+    out = add_stockpile(gs, 11, 10, 3, 3);
 
-    in = add_stockpile(7, 10, 2, 2);
+    in = add_stockpile(gs, 7, 10, 2, 2);
     // add_material_to_stockpile(in, SPINDLED_WIRE_COIL, 5);
-    s_in = get_stockpile_by_id(in);
+    s_in = get_stockpile_by_id(gs, in);
     add_required_material_to_stockpile(s_in, SPINDLED_WIRE_COIL, 5);
 
-    int puller = add_machine(WIRE_PULLER, 9, 10);
-    add_output_stockpile_to_machine(puller, out);
-    add_input_stockpile_to_machine(puller, in);
+    int puller = add_machine(gs, WIRE_PULLER, 9, 10);
+    add_output_stockpile_to_machine(gs, puller, out);
+    add_input_stockpile_to_machine(gs, puller, in);
 
     // CUTTER machine
-    int cutter = add_machine(WIRE_CUTTER, 12, 3);
-    out = add_stockpile(12, 5, 2, 2);
+    int cutter = add_machine(gs, WIRE_CUTTER, 12, 3);
+    out = add_stockpile(gs, 12, 5, 2, 2);
 
-    in = add_stockpile(10, 3, 2, 2);
-    s_in = get_stockpile_by_id(in);
+    in = add_stockpile(gs, 10, 3, 2, 2);
+    s_in = get_stockpile_by_id(gs, in);
     add_required_material_to_stockpile(s_in, LONG_WIRES, 50);
-    add_material_to_stockpile(s_in, SMALL_BOWL, 5);
+    add_material_to_stockpile(gs, s_in, SMALL_BOWL, 5);
 
-    add_output_stockpile_to_machine(cutter, out);
-    add_input_stockpile_to_machine(cutter, in);
+    add_output_stockpile_to_machine(gs, cutter, out);
+    add_input_stockpile_to_machine(gs, cutter, in);
 
     // GRINDER machine
-    int grinder = add_machine(WIRE_GRINDER, 7, 5);
-    out = add_stockpile(7, 6, 2, 1);
+    int grinder = add_machine(gs, WIRE_GRINDER, 7, 5);
+    out = add_stockpile(gs, 7, 6, 2, 1);
 
-    in = add_stockpile(6, 4, 2, 1);
-    s_in = get_stockpile_by_id(in);
+    in = add_stockpile(gs, 6, 4, 2, 1);
+    s_in = get_stockpile_by_id(gs, in);
 
-    assign_machine_production_job(winder, WIND_WIRE);
+    assign_machine_production_job(gs, winder, WIND_WIRE);
   }
 
   // add workers
-  add_worker();
-  add_worker();
-  add_worker();
+  add_worker(gs);
+  add_worker(gs);
+  add_worker(gs);
+}
+
+int main(int argc, char **argv) {
+  log_init(stdout);
+
+  // A snapshot given on the command line is carried on from, instead of
+  // building the starting factory.
+  GameState *gs;
+  if (argc > 1) {
+    gs = load_snapshot(argv[1]);
+    if (!gs)
+      exit(1);
+  } else {
+    gs = new_game();
+    seed_game(gs, time(0));
+    start_factory(gs);
+  }
+
+  struct DrawState ds = {
+      .cursor = gs->cursor,
+      .snapshot_path = argc > 1 ? argv[1] : DEFAULT_SNAPSHOT,
+      .camera = {.zoom = 1},
+      .selected_turn = -1,
+  };
+  for (int i = 0; i < STATIC_CHUNKS; i++) {
+    ds.chunks[i] = (StaticChunk){.x = -1, .y = -1, .version = -1};
+  }
 
   InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "THE_GOAL");
   Font font = LoadFont("assets/romulus.png");
@@ -699,21 +1211,29 @@ int main(void) {
   ds.tilemap = &ascii;
   SetTargetFPS(FPS);
 
+  profile_name_thread("window");
+  sim_start(gs, ds.paused);
   while (!WindowShouldClose() && !quit) {
+    ds.gs = sim_view();
     handle_input(&ds);
+    update_camera(&ds);
     draw_game_state(&ds);
-    if (frame % (FPS / TPS) == 0 && (ds.menu_mode == MENU_NONE || !ds.paused)) {
-      tick_game();
-      turn++;
-    }
-    frame++;
   }
-
+  gs = sim_stop();
+#if PROFILE
+  profile_export(PROFILE_TRACE);
+#endif
+
+  for (int i = 0; i < STATIC_CHUNKS; i++) {
+    if (ds.chunks[i].texture.id != 0)
+      UnloadRenderTexture(ds.chunks[i].texture);
+  }
+  free(ds.sprites.sprites);
   UnloadTexture(ascii);
   UnloadFont(font);
   CloseWindow();
 
-  free(context_menu_text);
+  free_game(gs);
 
   return 0;
 }
@@ -0,0 +1,389 @@
+#include "path.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* -------------
+ * OPEN SET
+ *
+ * A binary min-heap on estimated total cost. Ties go to the tile
+ * furthest from the start, which keeps A* running straight at the goal
+ * across open floor instead of fanning out. Stale entries are skipped
+ * when popped rather than being removed.
+ * ------------- */
+
+struct OpenTile {
+  int f;
+  int g;
+  int tile;
+};
+
+static bool open_before(struct OpenTile a, struct OpenTile b) {
+  if (a.f != b.f)
+    return a.f < b.f;
+  if (a.g != b.g)
+    return a.g > b.g;
+  return a.tile < b.tile;
+}
+
+static void open_push(PathFinder *pf, struct OpenTile t) {
+  if (pf->open_count == pf->open_capacity) {
+    int capacity = pf->open_capacity ? pf->open_capacity * 2 : 64;
+    struct OpenTile *open = realloc(pf->open, capacity * sizeof(*open));
+    if (!open) {
+      printf("ERROR: Couldn't grow pathfinding open set\n");
+      exit(1);
+    }
+    pf->open = open;
+    pf->open_capacity = capacity;
+  }
+
+  int i = pf->open_count++;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!open_before(t, pf->open[parent]))
+      break;
+    pf->open[i] = pf->open[parent];
+    i = parent;
+  }
+  pf->open[i] = t;
+}
+
+static struct OpenTile open_pop(PathFinder *pf) {
+  struct OpenTile top = pf->open[0];
+  struct OpenTile last = pf->open[--pf->open_count];
+
+  int i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= pf->open_count)
+      break;
+    if (child + 1 < pf->open_count &&
+        open_before(pf->open[child + 1], pf->open[child]))
+      child++;
+    if (!open_before(pf->open[child], last))
+      break;
+    pf->open[i] = pf->open[child];
+    i = child;
+  }
+  if (pf->open_count > 0)
+    pf->open[i] = last;
+
+  return top;
+}
+
+/* -------------
+ * SEARCH
+ * ------------- */
+
+static const Vector neighbours[4] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+static void reserve_tiles(PathFinder *pf, int tiles) {
+  if (tiles <= pf->tiles)
+    return;
+
+  free(pf->seen);
+  free(pf->cost);
+  free(pf->came_from);
+  pf->seen = calloc(tiles, sizeof(*pf->seen));
+  pf->cost = malloc(tiles * sizeof(*pf->cost));
+  pf->came_from = malloc(tiles * sizeof(*pf->came_from));
+  if (!pf->seen || !pf->cost || !pf->came_from) {
+    printf("ERROR: Couldn't allocate pathfinding scratch for %d tiles\n",
+           tiles);
+    exit(1);
+  }
+  pf->tiles = tiles;
+  pf->generation = 0;
+}
+
+static bool in_bounds(int width, int height, Vector v) {
+  return v.x >= 0 && v.y >= 0 && v.x < width && v.y < height;
+}
+
+static void reconstruct_path(const PathFinder *pf, int width, int start,
+                             int goal, Path *out) {
+  int length = 0;
+  for (int t = goal; t != start; t = pf->came_from[t]) {
+    length++;
+  }
+
+  if (length > out->capacity) {
+    Vector *steps = realloc(out->steps, length * sizeof(Vector));
+    if (!steps) {
+      printf("ERROR: Couldn't allocate path of %d steps\n", length);
+      exit(1);
+    }
+    out->steps = steps;
+    out->capacity = length;
+  }
+
+  out->length = length;
+  for (int t = goal, i = length - 1; t != start; t = pf->came_from[t], i--) {
+    out->steps[i] = (Vector){t % width, t / width};
+  }
+}
+
+bool find_path(PathFinder *pf, int width, int height,
+               const unsigned char *blocked, Vector start, Vector goal,
+               Path *out) {
+  if (!in_bounds(width, height, start) || !in_bounds(width, height, goal))
+    return false;
+
+  if (vec_equal(start, goal)) {
+    out->length = 0;
+    return true;
+  }
+
+  reserve_tiles(pf, width * height);
+
+  // Bumping the generation marks every tile unseen without a clear.
+  if (++pf->generation == 0) {
+    memset(pf->seen, 0, pf->tiles * sizeof(*pf->seen));
+    pf->generation = 1;
+  }
+
+  int start_tile = start.y * width + start.x;
+  int goal_tile = goal.y * width + goal.x;
+
+  pf->open_count = 0;
+  pf->seen[start_tile] = pf->generation;
+  pf->cost[start_tile] = 0;
+  open_push(pf, (struct OpenTile){abs(goal.x - start.x) +
+                                      abs(goal.y - start.y),
+                                  0, start_tile});
+
+  while (pf->open_count > 0) {
+    struct OpenTile current = open_pop(pf);
+
+    if (current.tile == goal_tile) {
+      reconstruct_path(pf, width, start_tile, goal_tile, out);
+      return true;
+    }
+
+    if (current.g > pf->cost[current.tile])
+      continue;
+
+    Vector here = {current.tile % width, current.tile / width};
+
+    for (int i = 0; i < 4; i++) {
+      Vector next = {here.x + neighbours[i].x, here.y + neighbours[i].y};
+      if (!in_bounds(width, height, next))
+        continue;
+
+      int tile = next.y * width + next.x;
+      if (blocked[tile] && tile != goal_tile)
+        continue;
+
+      int g = current.g + 1;
+      if (pf->seen[tile] == pf->generation && pf->cost[tile] <= g)
+        continue;
+
+      pf->seen[tile] = pf->generation;
+      pf->cost[tile] = g;
+      pf->came_from[tile] = current.tile;
+      open_push(pf, (struct OpenTile){g + abs(goal.x - next.x) +
+                                          abs(goal.y - next.y),
+                                      g, tile});
+    }
+  }
+
+  return false;
+}
+
+void free_path(Path *p) {
+  free(p->steps);
+  *p = (Path){0};
+}
+
+void free_path_finder(PathFinder *pf) {
+  free(pf->seen);
+  free(pf->cost);
+  free(pf->came_from);
+  free(pf->open);
+  *pf = (PathFinder){0};
+}
+
+/* -------------
+ * FLOW FIELDS
+ *
+ * A breadth first search out from the goal. Only open tiles are
+ * expanded, so distances agree with find_path: the goal itself may be
+ * blocked, and a blocked start is handled when it's looked up.
+ * ------------- */
+
+static void reset_flow_cache(FlowCache *fc, int width, int height) {
+  free_flow_cache(fc);
+
+  int tiles = width * height;
+  long max_fields = FLOW_CACHE_BYTES / ((long)tiles * sizeof(int));
+  if (max_fields < FLOW_CACHE_MIN_FIELDS)
+    max_fields = FLOW_CACHE_MIN_FIELDS;
+  if (max_fields > FLOW_CACHE_MAX_FIELDS)
+    max_fields = FLOW_CACHE_MAX_FIELDS;
+  fc->max_fields = max_fields;
+  fc->fields = malloc(fc->max_fields * sizeof(FlowField));
+  fc->field_of_tile = malloc(tiles * sizeof(int));
+  fc->queue = malloc(tiles * sizeof(int));
+  if (!fc->fields || !fc->field_of_tile || !fc->queue) {
+    printf("ERROR: Couldn't allocate flow cache for %d tiles\n", tiles);
+    exit(1);
+  }
+  for (int i = 0; i < tiles; i++) {
+    fc->field_of_tile[i] = -1;
+  }
+  fc->width = width;
+  fc->height = height;
+}
+
+static void build_flow_field(FlowCache *fc, FlowField *ff,
+                             const unsigned char *blocked) {
+  int tiles = fc->width * fc->height;
+  for (int i = 0; i < tiles; i++) {
+    ff->distance[i] = -1;
+  }
+
+  int head = 0;
+  int tail = 0;
+  ff->distance[ff->goal] = 0;
+  fc->queue[tail++] = ff->goal;
+
+  while (head < tail) {
+    int tile = fc->queue[head++];
+    Vector here = {tile % fc->width, tile / fc->width};
+
+    for (int i = 0; i < 4; i++) {
+      Vector next = {here.x + neighbours[i].x, here.y + neighbours[i].y};
+      if (!in_bounds(fc->width, fc->height, next))
+        continue;
+
+      int n = next.y * fc->width + next.x;
+      if (blocked[n] || ff->distance[n] != -1)
+        continue;
+
+      ff->distance[n] = ff->distance[tile] + 1;
+      fc->queue[tail++] = n;
+    }
+  }
+}
+
+static const FlowField *lookup_flow_field(FlowCache *fc, int width,
+                                         int height,
+                                         const unsigned char *blocked,
+                                         long version, Vector goal,
+                                         long since) {
+  if (!in_bounds(width, height, goal))
+    return NULL;
+
+  if (fc->width != width || fc->height != height)
+    reset_flow_cache(fc, width, height);
+
+  int tile = goal.y * width + goal.x;
+  FlowField *ff;
+
+  if (fc->field_of_tile[tile] != -1) {
+    ff = &fc->fields[fc->field_of_tile[tile]];
+  } else {
+    int slot;
+    if (fc->c_fields < fc->max_fields) {
+      slot = fc->c_fields++;
+      fc->fields[slot].distance = malloc(width * height * sizeof(int));
+      if (!fc->fields[slot].distance) {
+        printf("ERROR: Couldn't allocate flow field\n");
+        exit(1);
+      }
+    } else {
+      slot = 0;
+      for (int i = 1; i < fc->c_fields; i++) {
+        if (fc->fields[i].last_used < fc->fields[slot].last_used)
+          slot = i;
+      }
+      if (fc->fields[slot].last_used >= since)
+        return NULL;
+      fc->field_of_tile[fc->fields[slot].goal] = -1;
+    }
+
+    ff = &fc->fields[slot];
+    ff->goal = tile;
+    ff->version = version - 1;
+    fc->field_of_tile[tile] = slot;
+  }
+
+  if (ff->version != version) {
+    build_flow_field(fc, ff, blocked);
+    ff->version = version;
+  }
+  ff->last_used = ++fc->uses;
+  return ff;
+}
+
+const FlowField *get_flow_field(FlowCache *fc, int width, int height,
+                                const unsigned char *blocked, long version,
+                                Vector goal) {
+  return lookup_flow_field(fc, width, height, blocked, version, goal,
+                           LONG_MAX);
+}
+
+const FlowField *try_flow_field(FlowCache *fc, int width, int height,
+                                const unsigned char *blocked, long version,
+                                Vector goal, long since) {
+  return lookup_flow_field(fc, width, height, blocked, version, goal, since);
+}
+
+const FlowField *peek_flow_field(const FlowCache *fc, int width, int height,
+                                 long version, Vector goal) {
+  if (fc->width != width || fc->height != height ||
+      !in_bounds(width, height, goal))
+    return NULL;
+
+  int slot = fc->field_of_tile[goal.y * width + goal.x];
+  if (slot == -1 || fc->fields[slot].version != version)
+    return NULL;
+  return &fc->fields[slot];
+}
+
+int flow_distance(const FlowCache *fc, const FlowField *ff,
+                  const unsigned char *blocked, Vector from) {
+  if (!in_bounds(fc->width, fc->height, from))
+    return -1;
+
+  int tile = from.y * fc->width + from.x;
+  if (!blocked[tile] || tile == ff->goal)
+    return ff->distance[tile];
+
+  int best = -1;
+  for (int i = 0; i < 4; i++) {
+    Vector next = {from.x + neighbours[i].x, from.y + neighbours[i].y};
+    if (!in_bounds(fc->width, fc->height, next))
+      continue;
+
+    int d = ff->distance[next.y * fc->width + next.x];
+    if (d != -1 && (best == -1 || d + 1 < best))
+      best = d + 1;
+  }
+  return best;
+}
+
+Vector flow_step(const FlowCache *fc, const FlowField *ff,
+                 const unsigned char *blocked, Vector from) {
+  int want = flow_distance(fc, ff, blocked, from) - 1;
+
+  for (int i = 0; i < 4; i++) {
+    Vector next = {from.x + neighbours[i].x, from.y + neighbours[i].y};
+    if (in_bounds(fc->width, fc->height, next) &&
+        ff->distance[next.y * fc->width + next.x] == want)
+      return next;
+  }
+  return from;
+}
+
+void free_flow_cache(FlowCache *fc) {
+  for (int i = 0; i < fc->c_fields; i++) {
+    free(fc->fields[i].distance);
+  }
+  free(fc->fields);
+  free(fc->field_of_tile);
+  free(fc->queue);
+  *fc = (FlowCache){0};
+}
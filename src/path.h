@@ -0,0 +1,98 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include "vector.h"
+
+// Memory the flow cache may spend on fields before it starts dropping
+// them. Every worker walking somewhere needs its field, so this should
+// cover one field per walking worker on the largest floors.
+#define FLOW_CACHE_BYTES (256L * 1024 * 1024)
+#define FLOW_CACHE_MIN_FIELDS 16
+#define FLOW_CACHE_MAX_FIELDS 4096
+
+// A route from (but not including) a start tile to a goal tile, one
+// orthogonal step per entry.
+typedef struct Path {
+  int length;
+  int capacity;
+  Vector *steps;
+} Path;
+
+// Scratch space for searches, reused between calls so a search doesn't
+// have to clear or allocate anything proportional to the grid.
+typedef struct PathFinder {
+  int tiles;
+  unsigned int generation;
+  unsigned int *seen;
+  int *cost;
+  int *came_from;
+
+  int open_count;
+  int open_capacity;
+  struct OpenTile *open;
+} PathFinder;
+
+// A* over a 4-connected width x height grid, where any non-zero entry in
+// `blocked` is impassable. The start and goal tiles may themselves be
+// blocked (a worker standing at a machine). Returns false, leaving `out`
+// untouched, if there's no route.
+bool find_path(PathFinder *pf, int width, int height,
+               const unsigned char *blocked, Vector start, Vector goal,
+               Path *out);
+
+void free_path(Path *p);
+void free_path_finder(PathFinder *pf);
+
+// Distance to one goal tile from every tile on the grid, -1 where the
+// goal can't be reached. One field serves every worker heading to that
+// goal.
+typedef struct FlowField {
+  int goal;
+  long version;
+  long last_used;
+  int *distance;
+} FlowField;
+
+// Flow fields built on demand, keyed by goal tile. A field is rebuilt
+// when its version falls behind the layout, and the least recently used
+// one is dropped once FLOW_CACHE_BYTES worth of fields are held.
+typedef struct FlowCache {
+  int width;
+  int height;
+  int *field_of_tile;
+  long uses;
+
+  int c_fields;
+  int max_fields;
+  FlowField *fields;
+  int *queue;
+} FlowCache;
+
+const FlowField *get_flow_field(FlowCache *fc, int width, int height,
+                                const unsigned char *blocked, long version,
+                                Vector goal);
+
+// Like get_flow_field(), but returns NULL rather than drop a field that
+// has been used since `since` (an earlier value of fc->uses).
+const FlowField *try_flow_field(FlowCache *fc, int width, int height,
+                                const unsigned char *blocked, long version,
+                                Vector goal, long since);
+
+// The field for `goal` if it's already built and current, else NULL.
+// Doesn't change the cache, so it's safe from several threads at once.
+const FlowField *peek_flow_field(const FlowCache *fc, int width, int height,
+                                 long version, Vector goal);
+
+// Steps from `from` to the goal, -1 if unreachable. Like find_path, a
+// blocked `from` tile may still be left.
+int flow_distance(const FlowCache *fc, const FlowField *ff,
+                  const unsigned char *blocked, Vector from);
+
+// The next tile from `from` toward the goal. `from` must be reachable
+// and not the goal.
+Vector flow_step(const FlowCache *fc, const FlowField *ff,
+                 const unsigned char *blocked, Vector from);
+
+void free_flow_cache(FlowCache *fc);
+
+#endif
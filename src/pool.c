@@ -0,0 +1,141 @@
+#include "pool.h"
+#include "profile.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int pool_size = 1;
+static pthread_t pool_helpers[POOL_MAX_THREADS];
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned long pool_generation;
+static int pool_busy;
+static bool pool_stopping;
+
+// The job currently being run. Written under the lock before the
+// helpers are woken.
+static PoolTask pool_task;
+static void *pool_ctx;
+static int pool_n;
+static int pool_chunk;
+static atomic_int pool_next;
+
+// Set while a thread is inside a task. A pool_run() from inside a task
+// (say, a replication that ticks its own game) runs inline on that
+// thread, since every other thread is already busy with the outer job.
+static _Thread_local bool pool_in_task;
+static _Thread_local int pool_thread;
+
+static void run_chunks(int thread) {
+  for (;;) {
+    int begin = atomic_fetch_add(&pool_next, pool_chunk);
+    if (begin >= pool_n)
+      return;
+    int end = (pool_n - begin > pool_chunk) ? begin + pool_chunk : pool_n;
+    pool_in_task = true;
+    pool_thread = thread;
+    pool_task(pool_ctx, begin, end, thread);
+    pool_in_task = false;
+  }
+}
+
+static void *helper_loop(void *arg) {
+  int thread = (int)(intptr_t)arg;
+  unsigned long seen = 0;
+  profile_name_thread("pool %d", thread);
+
+  pthread_mutex_lock(&pool_lock);
+  for (;;) {
+    while (pool_generation == seen && !pool_stopping) {
+      pthread_cond_wait(&pool_wake, &pool_lock);
+    }
+    if (pool_stopping)
+      break;
+    seen = pool_generation;
+    pthread_mutex_unlock(&pool_lock);
+
+    run_chunks(thread);
+
+    pthread_mutex_lock(&pool_lock);
+    if (--pool_busy == 0)
+      pthread_cond_signal(&pool_done);
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return NULL;
+}
+
+void pool_init(int threads) {
+  if (pool_size > 1)
+    pool_shutdown();
+
+  if (threads < 1)
+    threads = 1;
+  if (threads > POOL_MAX_THREADS)
+    threads = POOL_MAX_THREADS;
+
+  // Helpers start out having seen generation 0, so a generation left
+  // over from before a shutdown would look like work to them.
+  pool_stopping = false;
+  pool_generation = 0;
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&pool_helpers[i], NULL, helper_loop,
+                       (void *)(intptr_t)i) != 0) {
+      printf("ERROR: Couldn't start pool thread %d\n", i);
+      exit(1);
+    }
+  }
+  pool_size = threads;
+}
+
+void pool_shutdown(void) {
+  pthread_mutex_lock(&pool_lock);
+  pool_stopping = true;
+  pthread_cond_broadcast(&pool_wake);
+  pthread_mutex_unlock(&pool_lock);
+
+  for (int i = 1; i < pool_size; i++) {
+    pthread_join(pool_helpers[i], NULL);
+  }
+  pool_size = 1;
+}
+
+int pool_threads(void) { return pool_size; }
+
+void pool_after_fork(void) { pool_size = 1; }
+
+void pool_run(int n, int chunk, PoolTask task, void *ctx) {
+  if (n <= 0)
+    return;
+  if (pool_in_task) {
+    task(ctx, 0, n, pool_thread);
+    return;
+  }
+  if (pool_size == 1 || n <= chunk) {
+    task(ctx, 0, n, 0);
+    return;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  pool_task = task;
+  pool_ctx = ctx;
+  pool_n = n;
+  pool_chunk = chunk;
+  atomic_store(&pool_next, 0);
+  pool_busy = pool_size - 1;
+  pool_generation++;
+  pthread_cond_broadcast(&pool_wake);
+  pthread_mutex_unlock(&pool_lock);
+
+  run_chunks(0);
+
+  pthread_mutex_lock(&pool_lock);
+  while (pool_busy > 0) {
+    pthread_cond_wait(&pool_done, &pool_lock);
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
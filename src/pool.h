@@ -0,0 +1,29 @@
+#ifndef POOL_H
+#define POOL_H
+
+// A fixed set of threads for splitting a loop over many entities.
+// Threads take chunks of the index range from a shared counter, so a
+// thread that finishes early just takes more.
+
+// Called with [begin, end) of the range. `thread` is 0 for the calling
+// thread and 1..pool_threads()-1 for the helpers.
+typedef void (*PoolTask)(void *ctx, int begin, int end, int thread);
+
+#define POOL_MAX_THREADS 64
+
+// Starts `threads` - 1 helper threads; the caller makes up the rest.
+// Without a call to pool_init everything runs on the calling thread.
+void pool_init(int threads);
+void pool_shutdown(void);
+int pool_threads(void);
+
+// For the child of a fork(), which has none of the helper threads:
+// everything from then on runs on the calling thread.
+void pool_after_fork(void);
+
+// Runs `task` over [0, n) in chunks of `chunk`, returning once all of
+// it is done. Called from inside a task, it just runs the whole
+// range on the calling thread.
+void pool_run(int n, int chunk, PoolTask task, void *ctx);
+
+#endif
@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+#include "profile.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char *profile_phase_names[PROF_PHASE_COUNT] = {
+    "tick",          "replenishment orders", "replenishment matching",
+    "job dispatch",  "machines",             "machine countdown",
+    "workers",       "worker steps",         "fast forward",
+    "render"};
+
+const char *profile_phase_str(ProfilePhase phase) {
+  return profile_phase_names[phase];
+}
+
+uint64_t profile_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* -------------
+ * RINGS
+ *
+ * A thread gets a ring the first time it records, and keeps it for the
+ * life of the program. Only its own thread writes to a ring. Spans
+ * overwrite the oldest once the ring is full, but the running totals
+ * count every span; they're published with relaxed stores, as each has
+ * just the one writer.
+ * ------------- */
+
+#define PROFILE_RING_SIZE 65536 // must be a power of two
+#define PROFILE_MAX_THREADS 32
+#define PROFILE_NAME_SIZE 32
+
+typedef struct ProfileSpan {
+  uint64_t start;
+  uint64_t end;
+  int phase;
+} ProfileSpan;
+
+typedef struct ProfileRing {
+  size_t head;
+  char name[PROFILE_NAME_SIZE];
+  atomic_uint_least64_t count[PROF_PHASE_COUNT];
+  atomic_uint_least64_t ns[PROF_PHASE_COUNT];
+  ProfileSpan spans[PROFILE_RING_SIZE];
+} ProfileRing;
+
+static _Atomic(ProfileRing *) profile_rings[PROFILE_MAX_THREADS];
+static atomic_int profile_c_rings;
+
+static _Thread_local ProfileRing *profile_ring;
+static _Thread_local bool profile_ringless;
+
+// The calling thread's ring, or NULL if every ring has been handed out.
+static ProfileRing *own_ring(void) {
+  if (profile_ring || profile_ringless)
+    return profile_ring;
+
+  int i = atomic_fetch_add(&profile_c_rings, 1);
+  if (i >= PROFILE_MAX_THREADS) {
+    fprintf(stderr, "WARN: More than %d threads profiled, not recording\n",
+            PROFILE_MAX_THREADS);
+    profile_ringless = true;
+    return NULL;
+  }
+
+  ProfileRing *r = calloc(1, sizeof(ProfileRing));
+  if (!r) {
+    printf("ERROR: Couldn't allocate profile ring\n");
+    exit(1);
+  }
+  snprintf(r->name, sizeof(r->name), "thread %d", i);
+  atomic_store(&profile_rings[i], r);
+  profile_ring = r;
+  return r;
+}
+
+static void add_total(atomic_uint_least64_t *total, uint64_t amount) {
+  uint64_t was = atomic_load_explicit(total, memory_order_relaxed);
+  atomic_store_explicit(total, was + amount, memory_order_relaxed);
+}
+
+void profile_record(ProfilePhase phase, uint64_t start, uint64_t end) {
+  ProfileRing *r = own_ring();
+  if (!r)
+    return;
+
+  r->spans[r->head++ & (PROFILE_RING_SIZE - 1)] =
+      (ProfileSpan){start, end, phase};
+  add_total(&r->count[phase], 1);
+  add_total(&r->ns[phase], end - start);
+}
+
+void profile_name_thread(const char *format, ...) {
+  if (!PROFILE)
+    return;
+  ProfileRing *r = own_ring();
+  if (!r)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  vsnprintf(r->name, sizeof(r->name), format, args);
+  va_end(args);
+}
+
+// Rings handed out so far; a slot claimed but not yet filled is NULL.
+static int rings_in_use(void) {
+  int n = atomic_load(&profile_c_rings);
+  return n < PROFILE_MAX_THREADS ? n : PROFILE_MAX_THREADS;
+}
+
+void profile_totals(ProfileTotal totals[PROF_PHASE_COUNT]) {
+  for (int p = 0; p < PROF_PHASE_COUNT; p++) {
+    totals[p] = (ProfileTotal){0};
+  }
+
+  for (int i = 0; i < rings_in_use(); i++) {
+    ProfileRing *r = atomic_load(&profile_rings[i]);
+    if (!r)
+      continue;
+    for (int p = 0; p < PROF_PHASE_COUNT; p++) {
+      totals[p].count +=
+          atomic_load_explicit(&r->count[p], memory_order_relaxed);
+      totals[p].ns += atomic_load_explicit(&r->ns[p], memory_order_relaxed);
+    }
+  }
+}
+
+/* -------------
+ * CHROME TRACE
+ *
+ * Each span is a complete ("X") event, timed in microseconds from the
+ * earliest span still held. Each ring is a thread, named by a metadata
+ * ("M") event.
+ * ------------- */
+
+// The oldest span still held in the ring.
+static size_t ring_tail(const ProfileRing *r) {
+  return r->head > PROFILE_RING_SIZE ? r->head - PROFILE_RING_SIZE : 0;
+}
+
+bool profile_export(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    printf("ERROR: Couldn't open %s for the profile trace\n", path);
+    return false;
+  }
+
+  int n = rings_in_use();
+  uint64_t epoch = UINT64_MAX;
+  for (int i = 0; i < n; i++) {
+    ProfileRing *r = atomic_load(&profile_rings[i]);
+    for (size_t s = r ? ring_tail(r) : 0; r && s < r->head; s++) {
+      uint64_t start = r->spans[s & (PROFILE_RING_SIZE - 1)].start;
+      if (start < epoch)
+        epoch = start;
+    }
+  }
+
+  fprintf(f, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (int i = 0; i < n; i++) {
+    ProfileRing *r = atomic_load(&profile_rings[i]);
+    if (!r)
+      continue;
+
+    fprintf(f,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", i, r->name);
+    first = false;
+
+    for (size_t s = ring_tail(r); s < r->head; s++) {
+      const ProfileSpan *span = &r->spans[s & (PROFILE_RING_SIZE - 1)];
+      fprintf(f,
+              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              profile_phase_names[span->phase], i,
+              (span->start - epoch) / 1e3, (span->end - span->start) / 1e3);
+    }
+  }
+  fprintf(f, "\n]}\n");
+
+  bool ok = !ferror(f);
+  if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    printf("ERROR: Couldn't write the profile trace to %s\n", path);
+  return ok;
+}
@@ -0,0 +1,63 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timings of the phases of a tick, and of drawing a frame. Each thread
+// records the spans it runs into a ring of its own, so recording never
+// takes a lock or shares a cache line with another thread.
+//
+// Profiling is off unless built with -DPROFILE=1 (make PROFILE=1). Off,
+// PROF_BEGIN and PROF_END compile to nothing and nothing is recorded.
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+typedef enum ProfilePhase {
+  PROF_TICK,
+  PROF_REPLENISHMENT_ORDERS,
+  PROF_REPLENISHMENT_MATCHING,
+  PROF_JOB_DISPATCH,
+  PROF_MACHINES,
+  PROF_MACHINE_COUNTDOWN,
+  PROF_WORKERS,
+  PROF_WORKER_STEPS,
+  PROF_FAST_FORWARD,
+  PROF_RENDER,
+  PROF_PHASE_COUNT
+} ProfilePhase;
+
+// Times the code between the two, which must be in the same block.
+#if PROFILE
+#define PROF_BEGIN(phase) uint64_t prof_start_##phase = profile_now()
+#define PROF_END(phase)                                                        \
+  profile_record(phase, prof_start_##phase, profile_now())
+#else
+#define PROF_BEGIN(phase) ((void)0)
+#define PROF_END(phase) ((void)0)
+#endif
+
+// Spans recorded for a phase across all threads so far.
+typedef struct ProfileTotal {
+  uint64_t count;
+  uint64_t ns;
+} ProfileTotal;
+
+const char *profile_phase_str(ProfilePhase phase);
+
+// Monotonic nanoseconds.
+uint64_t profile_now(void);
+void profile_record(ProfilePhase phase, uint64_t start, uint64_t end);
+// Names the calling thread in exported traces, printf() style.
+void profile_name_thread(const char *format, ...);
+
+// Safe to call while other threads are recording; the totals may be a
+// span or two behind.
+void profile_totals(ProfileTotal totals[PROF_PHASE_COUNT]);
+
+// Writes the spans still in the rings as Chrome trace event JSON (for
+// chrome://tracing or Perfetto). Only call once no thread is recording.
+bool profile_export(const char *path);
+
+#endif
@@ -0,0 +1,123 @@
+#include "rng.h"
+
+static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+static double to_double(uint64_t x) { return (x >> 11) * 0x1.0p-53; }
+
+uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+/* -------------
+ * STREAMS
+ * ------------- */
+
+Rng rng_stream(uint64_t seed, uint64_t stream) {
+  // The stream number goes through splitmix before it meets the seed, so
+  // neighbouring streams (worker 1, worker 2) start far apart.
+  uint64_t key = splitmix64(&stream) ^ seed;
+
+  Rng r;
+  for (int i = 0; i < 4; i++) {
+    r.s[i] = splitmix64(&key);
+  }
+  return r;
+}
+
+uint64_t rng_next(Rng *r) {
+  uint64_t *s = r->s;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+// Lemire's multiply and shift, redrawing only in the rare case that the
+// low half lands in the biased region.
+uint32_t rng_below(Rng *r, uint32_t n) {
+  uint64_t m = (rng_next(r) >> 32) * n;
+  uint32_t low = (uint32_t)m;
+  if (low < n) {
+    uint32_t threshold = -n % n;
+    while (low < threshold) {
+      m = (rng_next(r) >> 32) * n;
+      low = (uint32_t)m;
+    }
+  }
+  return m >> 32;
+}
+
+int rng_between(Rng *r, int lower, int upper) {
+  return lower + (int)rng_below(r, (uint32_t)(upper - lower) + 1);
+}
+
+double rng_double(Rng *r) { return to_double(rng_next(r)); }
+
+double rng_unit(uint64_t x) { return to_double(x); }
+
+/* -------------
+ * LANES
+ * ------------- */
+
+Rng rng_lane(const RngLanes *l, int lane) {
+  Rng r;
+  for (int i = 0; i < 4; i++) {
+    r.s[i] = l->s[i][lane];
+  }
+  return r;
+}
+
+void rng_set_lane(RngLanes *l, int lane, Rng r) {
+  for (int i = 0; i < 4; i++) {
+    l->s[i][lane] = r.s[i];
+  }
+}
+
+// Every lane is stepped, and the mask picks per lane between the new
+// state and the old one, so the loop has no branches in it. It's kept
+// simple enough for the compiler to vectorise: the masks are worked out
+// first, the draws go to a local array, which can't alias the state,
+// and the multiplies are shifts and adds, as SSE2 has no 64-bit one.
+void rng_lanes_next(RngLanes *l, unsigned mask, uint64_t *out) {
+  uint64_t(*s)[RNG_LANES] = l->s;
+  uint64_t keep[RNG_LANES];
+  uint64_t draw[RNG_LANES];
+
+  for (int lane = 0; lane < RNG_LANES; lane++) {
+    keep[lane] = (uint64_t)((mask >> lane) & 1) - 1;
+  }
+
+  for (int lane = 0; lane < RNG_LANES; lane++) {
+    uint64_t s0 = s[0][lane], s1 = s[1][lane];
+    uint64_t s2 = s[2][lane], s3 = s[3][lane];
+    uint64_t x = rotl((s1 << 2) + s1, 7);
+    draw[lane] = (x << 3) + x;
+
+    uint64_t t = s1 << 17;
+    uint64_t n2 = s2 ^ s0;
+    uint64_t n3 = s3 ^ s1;
+    uint64_t n1 = s1 ^ n2;
+    uint64_t n0 = s0 ^ n3;
+    n2 ^= t;
+    n3 = rotl(n3, 45);
+
+    s[0][lane] = (n0 & ~keep[lane]) | (s0 & keep[lane]);
+    s[1][lane] = (n1 & ~keep[lane]) | (s1 & keep[lane]);
+    s[2][lane] = (n2 & ~keep[lane]) | (s2 & keep[lane]);
+    s[3][lane] = (n3 & ~keep[lane]) | (s3 & keep[lane]);
+  }
+
+  for (int lane = 0; lane < RNG_LANES; lane++) {
+    out[lane] = draw[lane];
+  }
+}
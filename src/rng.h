@@ -0,0 +1,45 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// xoshiro256** (Blackman and Vigna). Each entity or thread gets its own
+// stream from rng_stream(), so draws don't depend on what order anything
+// else makes theirs in, and nothing is shared between threads.
+typedef struct Rng {
+  uint64_t s[4];
+} Rng;
+
+uint64_t splitmix64(uint64_t *state);
+
+// Stream `stream` of the run seeded with `seed`. The same pair always
+// gives the same sequence.
+Rng rng_stream(uint64_t seed, uint64_t stream);
+
+uint64_t rng_next(Rng *r);
+// Uniform on [0, n), without modulo bias. `n` must be non-zero.
+uint32_t rng_below(Rng *r, uint32_t n);
+// Uniform on [lower, upper], inclusive.
+int rng_between(Rng *r, int lower, int upper);
+// Uniform on [0, 1), with 53 random bits.
+double rng_double(Rng *r);
+// The same, from a draw already made.
+double rng_unit(uint64_t x);
+
+// RNG_LANES streams stored structure-of-arrays, lane i's state being
+// s[0][i] to s[3][i], so stepping them is the same few shifts and xors
+// on every lane, which the compiler can turn into SIMD.
+#define RNG_LANES 8
+
+typedef struct RngLanes {
+  uint64_t s[4][RNG_LANES];
+} RngLanes;
+
+Rng rng_lane(const RngLanes *l, int lane);
+void rng_set_lane(RngLanes *l, int lane, Rng r);
+// Steps the lanes whose bit is set in `mask`, each giving the draw
+// rng_next() would on its own, into out[lane]. The other lanes keep
+// their state, and their out[] means nothing.
+void rng_lanes_next(RngLanes *l, unsigned mask, uint64_t *out);
+
+#endif
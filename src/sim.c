@@ -0,0 +1,384 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sim.h"
+#include "log.h"
+#include "profile.h"
+#include "snapshot.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static GameState *sim_game;
+static pthread_t sim_thread;
+static atomic_bool sim_running;
+
+static const double sim_rates[SPEED_COUNT] = {SIM_TPS, SIM_TPS * 10,
+                                              SIM_TPS * 100, 0};
+
+// Ticks run between checks for commands at max speed.
+#define SIM_MAX_BATCH 16
+
+// How far behind the sim may fall before it gives up catching up.
+#define SIM_MAX_LAG_SECONDS 0.25
+
+#define SIM_IDLE_NS 1000000
+
+/* -------------
+ * COMMAND QUEUE
+ *
+ * A bounded single producer, single consumer ring. The window only
+ * ever advances the head and the sim thread the tail, so each just
+ * publishes its own index with a release store.
+ * ------------- */
+
+#define SIM_QUEUE_SIZE 256 // must be a power of two
+
+static Command sim_queue[SIM_QUEUE_SIZE];
+static atomic_size_t sim_queue_head;
+static atomic_size_t sim_queue_tail;
+
+bool sim_send(Command c) {
+  size_t head = atomic_load_explicit(&sim_queue_head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&sim_queue_tail, memory_order_acquire);
+  if (head - tail == SIM_QUEUE_SIZE) {
+    LOG_WARN(LOG_GAME, "Sim command queue full, dropped a command");
+    return false;
+  }
+
+  sim_queue[head & (SIM_QUEUE_SIZE - 1)] = c;
+  atomic_store_explicit(&sim_queue_head, head + 1, memory_order_release);
+  return true;
+}
+
+static bool next_command(Command *c) {
+  size_t tail = atomic_load_explicit(&sim_queue_tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&sim_queue_head, memory_order_acquire);
+  if (tail == head)
+    return false;
+
+  *c = sim_queue[tail & (SIM_QUEUE_SIZE - 1)];
+  atomic_store_explicit(&sim_queue_tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/* -------------
+ * VIEWS
+ *
+ * Three views, passed round a triple buffer: the sim thread fills its
+ * back view and swaps it into the middle slot, and the window swaps the
+ * middle slot for its front view when there's a fresh one there.
+ * Neither side ever waits, and the window always gets the latest view
+ * published.
+ * ------------- */
+
+#define VIEW_FRESH 4
+
+static GameState sim_views[3];
+static atomic_int sim_middle;
+static int sim_back;
+static int sim_front;
+
+// Copies the first `count` elements of `size` from one Chunks into
+// another, which grows to fit.
+static void copy_chunks(Chunks *to, const Chunks *from, int count,
+                        size_t size) {
+  chunks_reserve(to, count, size);
+  for (int k = 0; k * ENTITY_CHUNK < count; k++) {
+    int n = count - k * ENTITY_CHUNK;
+    if (n > ENTITY_CHUNK)
+      n = ENTITY_CHUNK;
+    memcpy(to->chunk[k], from->chunk[k], n * size);
+  }
+}
+
+static void copy_view(GameState *view, const GameState *gs) {
+  copy_chunks(&view->machines, &gs->machines, gs->c_machines,
+              sizeof(Machine));
+  copy_chunks(&view->machine_hot, &gs->machine_hot, gs->c_machines,
+              sizeof(MachineHot));
+  copy_chunks(&view->machine_rng, &gs->machine_rng,
+              (gs->c_machines + RNG_LANES - 1) / RNG_LANES, sizeof(RngLanes));
+  view->c_machines = gs->c_machines;
+  copy_chunks(&view->stockpiles, &gs->stockpiles, gs->c_stockpile,
+              sizeof(Stockpile));
+  copy_chunks(&view->stockpile_hot, &gs->stockpile_hot, gs->c_stockpile,
+              sizeof(StockpileHot));
+  view->c_stockpile = gs->c_stockpile;
+  copy_chunks(&view->workers, &gs->workers, gs->c_workers, sizeof(Worker));
+  copy_chunks(&view->worker_hot, &gs->worker_hot, gs->c_workers,
+              sizeof(WorkerHot));
+  view->c_workers = gs->c_workers;
+
+  // Entities point at their hot parts, so point them at the view's.
+  for (int i = 0; i < view->c_stockpile; i++) {
+    get_stockpile_by_id(view, i)->hot =
+        CHUNK_ITEM(view->stockpile_hot, StockpileHot, i);
+  }
+  for (int i = 0; i < view->c_workers; i++) {
+    get_worker_by_id(view, i)->hot = CHUNK_ITEM(view->worker_hot, WorkerHot, i);
+  }
+
+  // Machines point at recipes too.
+  memcpy(view->recipes, gs->recipes, sizeof(gs->recipes));
+  for (int i = 0; i < view->c_machines; i++) {
+    Machine *m = get_machine_by_id(view, i);
+    m->hot = CHUNK_ITEM(view->machine_hot, MachineHot, i);
+    if (m->active_recipe)
+      m->active_recipe = &view->recipes[m->active_recipe - gs->recipes];
+    if (m->set_up_for)
+      m->set_up_for = &view->recipes[m->set_up_for - gs->recipes];
+  }
+
+  // The static layer only changes with the layout, and on a big floor
+  // it's most of what there is to copy.
+  if (view->layout_version != gs->layout_version) {
+    size_t tiles = (size_t)gs->grid.width * gs->grid.height;
+    if (view->grid.width != gs->grid.width ||
+        view->grid.height != gs->grid.height) {
+      free(view->grid.statics);
+      free(view->grid.blocked);
+      view->grid.statics = malloc(tiles * sizeof(ObjectReference));
+      view->grid.blocked = malloc(tiles);
+      if (tiles > 0 && (!view->grid.statics || !view->grid.blocked)) {
+        printf("ERROR: Couldn't allocate view of %dx%d tile grid\n",
+               gs->grid.width, gs->grid.height);
+        exit(1);
+      }
+      view->grid.width = gs->grid.width;
+      view->grid.height = gs->grid.height;
+    }
+    if (tiles > 0) {
+      memcpy(view->grid.statics, gs->grid.statics,
+             tiles * sizeof(ObjectReference));
+      memcpy(view->grid.blocked, gs->grid.blocked, tiles);
+    }
+    view->layout_version = gs->layout_version;
+  }
+
+  view->turn = gs->turn;
+  view->seed = gs->seed;
+  view->cursor = gs->cursor;
+  memcpy(view->produced, gs->produced, sizeof(gs->produced));
+  memcpy(view->scrapped, gs->scrapped, sizeof(gs->scrapped));
+}
+
+static void publish_view(void) {
+  copy_view(&sim_views[sim_back], sim_game);
+  sim_back = atomic_exchange(&sim_middle, sim_back | VIEW_FRESH) & 3;
+}
+
+GameState *sim_view(void) {
+  if (atomic_load(&sim_middle) & VIEW_FRESH)
+    sim_front = atomic_exchange(&sim_middle, sim_front) & 3;
+  return &sim_views[sim_front];
+}
+
+static void free_view(GameState *view) {
+  chunks_free(&view->machines);
+  chunks_free(&view->machine_hot);
+  chunks_free(&view->machine_rng);
+  chunks_free(&view->stockpiles);
+  chunks_free(&view->stockpile_hot);
+  chunks_free(&view->workers);
+  chunks_free(&view->worker_hot);
+  free(view->grid.statics);
+  free(view->grid.blocked);
+  *view = (GameState){0};
+}
+
+/* -------------
+ * SIM THREAD
+ * ------------- */
+
+static double seconds_now(void) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+typedef struct SimClock {
+  SimSpeed speed;
+  bool paused;
+  // Ticks are owed at the speed's rate from this time and turn on.
+  double since;
+  long since_turn;
+} SimClock;
+
+static void reset_clock(SimClock *sc) {
+  sc->since = seconds_now();
+  sc->since_turn = sim_game->turn;
+}
+
+static bool in_range(int v, int n) { return v >= 0 && v < n; }
+
+// The window checks edits against a view that may be a few ticks old,
+// and the view may hold things the game no longer agrees with, so
+// each command is checked again against the game itself.
+static bool placement_ok(GameState *gs, const Command *c, int w, int h) {
+  return area_is_free(gs, c->x, c->y, w, h);
+}
+
+static bool command_ok(GameState *gs, const Command *c) {
+  switch (c->type) {
+  case CMD_ADD_STOCKPILE:
+  case CMD_ADD_WALL:
+    return placement_ok(gs, c, c->w, c->h);
+  case CMD_ADD_MACHINE: {
+    if (!in_range(c->value, COUNT_MACHINE_TYPES))
+      return false;
+    Vector size = machine_size(c->value);
+    return placement_ok(gs, c, size.x, size.y);
+  }
+  case CMD_ATTACH_INPUT:
+  case CMD_ATTACH_OUTPUT:
+    return in_range(c->id, gs->c_machines) &&
+           in_range(c->value, gs->c_stockpile);
+  case CMD_ADD_REQUIRED_MATERIAL:
+    return in_range(c->id, gs->c_stockpile) && c->value != NONE &&
+           in_range(c->value, PM_COUNT) && c->count > 0;
+  case CMD_ASSIGN_JOB:
+    return in_range(c->id, gs->c_machines) &&
+           in_range(c->value, RECIPE_COUNT);
+  case CMD_SET_SPEED:
+    return in_range(c->value, SPEED_COUNT);
+  case CMD_SAVE:
+  case CMD_SET_PAUSED:
+    return true;
+  }
+  return false;
+}
+
+static void apply_command(SimClock *sc, const Command *c) {
+  GameState *gs = sim_game;
+
+  if (!command_ok(gs, c)) {
+    LOG_WARN(LOG_GAME,
+             "Dropped invalid command %d (id %d, value %d, at %d,%d)",
+             c->type, c->id, c->value, c->x, c->y);
+    return;
+  }
+
+  switch (c->type) {
+  case CMD_ADD_STOCKPILE:
+    add_stockpile(gs, c->x, c->y, c->w, c->h);
+    break;
+  case CMD_ADD_WALL:
+    add_wall(gs, c->x, c->y, c->w, c->h);
+    break;
+  case CMD_ADD_MACHINE:
+    add_machine(gs, c->value, c->x, c->y);
+    break;
+  case CMD_ATTACH_INPUT:
+    add_input_stockpile_to_machine(gs, c->id, c->value);
+    break;
+  case CMD_ATTACH_OUTPUT:
+    add_output_stockpile_to_machine(gs, c->id, c->value);
+    break;
+  case CMD_ADD_REQUIRED_MATERIAL:
+    add_required_material_to_stockpile(get_stockpile_by_id(gs, c->id),
+                                       c->value, c->count);
+    break;
+  case CMD_ASSIGN_JOB:
+    assign_machine_production_job(gs, c->id, c->value);
+    break;
+  case CMD_SAVE:
+    gs->cursor = (Vector){c->x, c->y};
+    if (save_snapshot(gs, c->path))
+      LOG_INFO(LOG_GAME, "Saved factory to %s", c->path);
+    break;
+  case CMD_SET_SPEED:
+    sc->speed = c->value;
+    reset_clock(sc);
+    break;
+  case CMD_SET_PAUSED:
+    sc->paused = c->value;
+    reset_clock(sc);
+    break;
+  }
+}
+
+static void *sim_loop(void *arg) {
+  SimClock *sc = arg;
+  struct timespec idle = {0, SIM_IDLE_NS};
+  double next_publish = 0;
+  profile_name_thread("sim");
+  reset_clock(sc);
+
+  while (atomic_load(&sim_running)) {
+    bool changed = false;
+    Command c;
+    while (next_command(&c)) {
+      apply_command(sc, &c);
+      changed = true;
+    }
+
+    long owed = 0;
+    if (!sc->paused && sc->speed == SPEED_MAX) {
+      owed = SIM_MAX_BATCH;
+    } else if (!sc->paused) {
+      double rate = sim_rates[sc->speed];
+      double behind = (seconds_now() - sc->since) * rate -
+                      (sim_game->turn - sc->since_turn);
+      if (behind > rate * SIM_MAX_LAG_SECONDS) {
+        reset_clock(sc);
+        behind = 1;
+      }
+      owed = (long)behind;
+    }
+
+    for (long i = 0; i < owed; i++) {
+      tick_game(sim_game);
+    }
+
+    double now = seconds_now();
+    if (changed || (owed > 0 && now >= next_publish)) {
+      publish_view();
+      next_publish = now + 1.0 / SIM_PUBLISH_HZ;
+    }
+    if (owed == 0)
+      nanosleep(&idle, NULL);
+  }
+
+  free(sc);
+  return NULL;
+}
+
+void sim_start(GameState *gs, bool paused) {
+  sim_game = gs;
+  for (int i = 0; i < 3; i++) {
+    sim_views[i].layout_version = -1;
+  }
+  sim_back = 0;
+  sim_front = 1;
+  atomic_store(&sim_middle, 2);
+  atomic_store(&sim_queue_head, 0);
+  atomic_store(&sim_queue_tail, 0);
+
+  // The window's first view is the game as it starts.
+  copy_view(&sim_views[sim_front], gs);
+
+  SimClock *sc = malloc(sizeof(SimClock));
+  if (!sc) {
+    printf("ERROR: Couldn't allocate sim clock\n");
+    exit(1);
+  }
+  *sc = (SimClock){.speed = SPEED_1X, .paused = paused};
+
+  atomic_store(&sim_running, true);
+  if (pthread_create(&sim_thread, NULL, sim_loop, sc) != 0) {
+    printf("ERROR: Couldn't start sim thread\n");
+    exit(1);
+  }
+}
+
+GameState *sim_stop(void) {
+  atomic_store(&sim_running, false);
+  pthread_join(sim_thread, NULL);
+
+  for (int i = 0; i < 3; i++) {
+    free_view(&sim_views[i]);
+  }
+  return sim_game;
+}
@@ -0,0 +1,78 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "game.h"
+
+// Runs the window's game on a thread of its own, so drawing and ticking
+// never wait on each other. The window sees the game only through
+// views the sim thread publishes, and changes it only by sending
+// commands.
+
+typedef enum SimSpeed {
+  SPEED_1X,
+  SPEED_10X,
+  SPEED_100X,
+  SPEED_MAX,
+  SPEED_COUNT
+} SimSpeed;
+
+// Ticks per second at 1x.
+#define SIM_TPS 60
+
+// How often a new view is published, at most.
+#define SIM_PUBLISH_HZ 120
+
+typedef enum CommandType {
+  CMD_ADD_STOCKPILE,
+  CMD_ADD_WALL,
+  CMD_ADD_MACHINE,
+  CMD_ATTACH_INPUT,
+  CMD_ATTACH_OUTPUT,
+  CMD_ADD_REQUIRED_MATERIAL,
+  CMD_ASSIGN_JOB,
+  CMD_SAVE,
+  CMD_SET_SPEED,
+  CMD_SET_PAUSED
+} CommandType;
+
+// One edit, with the arguments of the call it stands for:
+//
+//   CMD_ADD_STOCKPILE, CMD_ADD_WALL  x, y, w, h
+//   CMD_ADD_MACHINE                  value (type), x, y
+//   CMD_ATTACH_INPUT, _OUTPUT        id (machine), value (stockpile)
+//   CMD_ADD_REQUIRED_MATERIAL        id (stockpile), value, count
+//   CMD_ASSIGN_JOB                   id (machine), value (recipe)
+//   CMD_SAVE                         path, x, y (cursor)
+//   CMD_SET_SPEED, CMD_SET_PAUSED    value
+typedef struct Command {
+  CommandType type;
+  int id;
+  int value;
+  int count;
+  int x;
+  int y;
+  int w;
+  int h;
+  const char *path;
+} Command;
+
+// Hands `gs` over to a new sim thread, which owns it until sim_stop().
+// Starts paused or not, at 1x.
+void sim_start(GameState *gs, bool paused);
+// Stops the thread and hands the game back.
+GameState *sim_stop(void);
+
+// Queues a command for the sim thread, which applies commands in the
+// order they were sent between ticks. Only to be called from one
+// thread. Returns false if the queue is full.
+bool sim_send(Command c);
+
+// The most recently published view of the game, the caller's until the
+// next call. Nothing done to it goes back to the game. Views carry the
+// entities, the grid's static layer and the counters, but not the
+// grid's worker lists, the job queue or any caches. Pointers inside
+// entities to anything but recipes (paths, distribution tables) lead
+// into the running game and mustn't be followed.
+GameState *sim_view(void);
+
+#endif
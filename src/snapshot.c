@@ -0,0 +1,1024 @@
+#define _POSIX_C_SOURCE 200809L
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* -------------
+ * FORMAT
+ *
+ * A fixed header, then the body. Every value is little-endian whatever
+ * the host: integers and enums are 1, 4 or 8 bytes, doubles are their
+ * IEEE bits in 8, and arrays are a 4 byte count then the elements.
+ * Pointers are stored as the index of what they point at.
+ *
+ * The header holds the body's length and an FNV-1a hash of it, so a
+ * truncated or damaged file is refused before any of it is used. It
+ * also holds the material and recipe counts, since the body is laid
+ * out by them.
+ * ------------- */
+
+static const char snapshot_magic[8] = "PINSNAP";
+
+static uint64_t fnv1a(const unsigned char *data, size_t size) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ data[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/* -------------
+ * WRITING
+ * ------------- */
+
+typedef struct Writer {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+} Writer;
+
+static void put_bytes(Writer *w, const void *bytes, size_t n) {
+  if (w->size + n > w->capacity) {
+    size_t capacity = w->capacity ? w->capacity : 4096;
+    while (capacity < w->size + n)
+      capacity *= 2;
+    unsigned char *data = realloc(w->data, capacity);
+    if (!data) {
+      printf("ERROR: Couldn't grow snapshot to %zu bytes\n", capacity);
+      exit(1);
+    }
+    w->data = data;
+    w->capacity = capacity;
+  }
+  memcpy(w->data + w->size, bytes, n);
+  w->size += n;
+}
+
+static void put_u64(Writer *w, uint64_t v) {
+  unsigned char b[8];
+  for (int i = 0; i < 8; i++) {
+    b[i] = (unsigned char)(v >> (8 * i));
+  }
+  put_bytes(w, b, 8);
+}
+
+static void put_u32(Writer *w, uint32_t v) {
+  unsigned char b[4];
+  for (int i = 0; i < 4; i++) {
+    b[i] = (unsigned char)(v >> (8 * i));
+  }
+  put_bytes(w, b, 4);
+}
+
+static void put_u8(Writer *w, unsigned v) {
+  unsigned char b = (unsigned char)v;
+  put_bytes(w, &b, 1);
+}
+
+static void put_i32(Writer *w, int v) { put_u32(w, (uint32_t)v); }
+static void put_i64(Writer *w, long v) { put_u64(w, (uint64_t)v); }
+
+static void put_f64(Writer *w, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  put_u64(w, bits);
+}
+
+static void put_vector(Writer *w, Vector v) {
+  put_i32(w, v.x);
+  put_i32(w, v.y);
+}
+
+static void put_object(Writer *w, ObjectReference o) {
+  put_i32(w, o.object_type);
+  put_i32(w, o.id);
+}
+
+static void put_rng(Writer *w, const Rng *r) {
+  for (int i = 0; i < 4; i++) {
+    put_u64(w, r->s[i]);
+  }
+}
+
+static void put_inventory(Writer *w, const Inventory *inv) {
+  put_u32(w, inv->present);
+  for (int p = 0; p < PM_COUNT; p++) {
+    put_i32(w, inv->count[p]);
+  }
+}
+
+// The compiled table is kept rather than the shape, since an empirical
+// shape's values belong to whoever set it up. Distributions with a
+// single outcome have no table.
+static void put_dist(Writer *w, const Distribution *d) {
+  put_i32(w, d->kind);
+  put_f64(w, d->a);
+  put_f64(w, d->b);
+  put_f64(w, d->c);
+  put_i32(w, d->min);
+  put_i32(w, d->n);
+  for (int i = 0; d->n > 1 && i < d->n; i++) {
+    put_u64(w, d->threshold[i]);
+  }
+  for (int i = 0; d->n > 1 && i < d->n; i++) {
+    put_i32(w, d->alias[i]);
+  }
+}
+
+static int recipe_index(const GameState *gs, const Recipe *r) {
+  return r ? (int)(r - gs->recipes) : -1;
+}
+
+static void put_recipe(Writer *w, const Recipe *r) {
+  put_i32(w, r->name);
+  put_i32(w, r->c_inputs);
+  for (int i = 0; i < r->c_inputs; i++) {
+    put_i32(w, r->inputs[i]);
+    put_i32(w, r->inputs_count[i]);
+  }
+  put_i32(w, r->c_outputs);
+  for (int i = 0; i < r->c_outputs; i++) {
+    put_i32(w, r->outputs[i]);
+    put_i32(w, r->outputs_count[i]);
+    put_dist(w, &r->defects[i]);
+  }
+  put_dist(w, &r->time);
+  put_dist(w, &r->setup);
+  put_dist(w, &r->teardown);
+  put_f64(w, r->defect_rate);
+  put_inventory(w, &r->needs);
+}
+
+static void put_stockpile(Writer *w, const Stockpile *s) {
+  put_i32(w, s->id);
+  put_vector(w, s->location);
+  put_vector(w, s->size);
+  put_u8(w, s->can_be_taken_from);
+  put_i32(w, s->attached_machine);
+  put_i32(w, s->io);
+  put_inventory(w, &s->contents);
+  put_inventory(w, &s->hot->required_material);
+  put_u32(w, s->supplying);
+  for (int p = 0; p < PM_COUNT; p++) {
+    put_i32(w, s->earmarked[p]);
+    put_i32(w, s->replenishment_outstanding[p]);
+    put_i32(w, s->supply_next[p]);
+    put_i32(w, s->supply_prev[p]);
+  }
+}
+
+static void put_machine(Writer *w, const GameState *gs, const Machine *m) {
+  put_i32(w, m->id);
+  put_i32(w, m->type);
+  put_u8(w, m->has_current_work_order);
+  put_u8(w, m->hot->working);
+  put_i32(w, m->hot->job_time_left);
+  put_i32(w, m->worker);
+  put_vector(w, m->location);
+  put_vector(w, m->size);
+  put_i32(w, recipe_index(gs, m->active_recipe));
+  put_i32(w, m->output_stockpile);
+  put_i32(w, m->input_stockpile);
+  put_inventory(w, &m->input_buffer);
+  put_inventory(w, &m->output_buffer);
+  Rng rng = get_machine_rng(gs, m->id);
+  put_rng(w, &rng);
+  put_i32(w, recipe_index(gs, m->set_up_for));
+  put_f64(w, m->breakdown_chance);
+  put_dist(w, &m->repair_time);
+  put_i32(w, m->breakdowns);
+}
+
+static void put_worker(Writer *w, const Worker *wk) {
+  put_i32(w, wk->id);
+  put_i32(w, wk->hot->status);
+  put_vector(w, wk->hot->location);
+  put_vector(w, wk->hot->target);
+  put_i32(w, wk->target_material);
+  put_i32(w, wk->target_count);
+  put_i32(w, wk->hot->job);
+  put_i32(w, wk->job_id);
+  put_object(w, wk->job_target);
+  put_object(w, wk->job_target_secondary);
+  put_i32(w, wk->carrying);
+  put_i32(w, wk->carrying_count);
+  put_i32(w, wk->idle_slot);
+  put_i32(w, wk->route);
+  put_i32(w, wk->path.length);
+  for (int i = 0; i < wk->path.length; i++) {
+    put_vector(w, wk->path.steps[i]);
+  }
+  put_i32(w, wk->path_step);
+  put_vector(w, wk->path_start);
+  put_vector(w, wk->path_target);
+  put_i64(w, wk->path_version);
+  put_rng(w, &wk->rng);
+}
+
+static void put_game(Writer *w, const GameState *gs) {
+  put_i64(w, gs->turn);
+  put_u64(w, gs->seed);
+  put_i64(w, gs->layout_version);
+  for (int p = 0; p < PM_COUNT; p++) {
+    put_i64(w, gs->produced[p]);
+    put_i64(w, gs->scrapped[p]);
+  }
+  put_vector(w, gs->cursor);
+  put_i32(w, gs->message_head);
+  for (int i = 0; i < MESSAGE_BUFFER_SIZE; i++) {
+    const char *m = gs->message_buffer[i];
+    size_t length = strnlen(m, MESSAGE_MAX_SIZE - 1);
+    put_i32(w, (int)length);
+    put_bytes(w, m, length);
+  }
+
+  for (int i = 0; i < RECIPE_COUNT; i++) {
+    put_recipe(w, &gs->recipes[i]);
+  }
+
+  put_i32(w, gs->c_stockpile);
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    put_stockpile(w, get_stockpile_by_id(gs, i));
+  }
+  put_i32(w, gs->c_machines);
+  for (int i = 0; i < gs->c_machines; i++) {
+    put_machine(w, gs, get_machine_by_id(gs, i));
+  }
+  put_i32(w, gs->c_workers);
+  for (int i = 0; i < gs->c_workers; i++) {
+    put_worker(w, get_worker_by_id(gs, i));
+  }
+  put_i32(w, gs->c_idle);
+  for (int i = 0; i < gs->c_idle; i++) {
+    put_i32(w, gs->idle_workers[i]);
+  }
+
+  // Walls only exist on the grid, one bit a tile. The rest of the grid
+  // is rebuilt from the entities.
+  const TileGrid *g = &gs->grid;
+  put_i32(w, g->width);
+  put_i32(w, g->height);
+  int tiles = g->width * g->height;
+  for (int i = 0; i < tiles; i += 8) {
+    unsigned bits = 0;
+    for (int j = 0; j < 8 && i + j < tiles; j++) {
+      if (g->blocked[i + j] & TILE_WALL)
+        bits |= 1u << j;
+    }
+    put_u8(w, bits);
+  }
+
+  put_i32(w, gs->c_job_queue);
+  for (int i = 0; i < gs->c_job_queue; i++) {
+    const struct JobQueueItem *jq = &gs->job_queue[i];
+    put_object(w, jq->object);
+    put_i32(w, jq->job);
+    put_i64(w, jq->sequence);
+  }
+  put_i64(w, gs->job_sequence);
+
+  put_i32(w, gs->c_replenishment_orders);
+  for (int i = 0; i < gs->c_replenishment_orders; i++) {
+    const struct ReplenishmentOrder *ro = &gs->replenishment_orders[i];
+    put_i32(w, ro->ordering_stockpile);
+    put_i32(w, ro->material);
+    put_i32(w, ro->amount_ordered);
+    put_i32(w, ro->amount_picked_up);
+    put_i64(w, ro->sequence);
+    put_i32(w, ro->next);
+  }
+  put_i32(w, gs->free_replenishment_orders);
+  put_i64(w, gs->replenishment_sequence);
+  for (int p = 0; p < PM_COUNT; p++) {
+    const struct OpenOrders *open = &gs->open_replenishment_orders[p];
+    put_i32(w, open->head);
+    put_i32(w, open->tail);
+    put_i32(w, open->count);
+    put_i32(w, gs->supply[p].head);
+    put_i32(w, gs->supply[p].count);
+  }
+}
+
+bool save_snapshot(const GameState *gs, const char *path) {
+  Writer body = {0};
+  put_game(&body, gs);
+
+  Writer header = {0};
+  put_bytes(&header, snapshot_magic, sizeof(snapshot_magic));
+  put_u32(&header, SNAPSHOT_VERSION);
+  put_u32(&header, PM_COUNT);
+  put_u32(&header, RECIPE_COUNT);
+  put_u32(&header, 0);
+  put_u64(&header, body.size);
+  put_u64(&header, fnv1a(body.data, body.size));
+
+  // Written aside and moved into place, so a checkpoint that fails part
+  // way doesn't cost the one before it.
+  char temp[FILENAME_MAX];
+  snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+  FILE *f = fopen(temp, "wb");
+  bool ok = f && fwrite(header.data, 1, header.size, f) == header.size &&
+            fwrite(body.data, 1, body.size, f) == body.size;
+  if (f && fclose(f) != 0)
+    ok = false;
+#ifdef _WIN32
+  if (ok)
+    remove(path);
+#endif
+  if (ok && rename(temp, path) != 0)
+    ok = false;
+  if (!ok) {
+    printf("ERROR: Couldn't write snapshot %s\n", path);
+    remove(temp);
+  }
+
+  free(header.data);
+  free(body.data);
+  return ok;
+}
+
+/* -------------
+ * READING
+ *
+ * Reads go through a cursor that stops, and marks the snapshot bad,
+ * at the end of the data rather than run past it. Everything read
+ * after that is zero, so a half-filled game is still safe to free.
+ * ------------- */
+
+typedef struct Reader {
+  const unsigned char *at;
+  const unsigned char *end;
+  bool ok;
+} Reader;
+
+static const unsigned char *take(Reader *r, size_t n) {
+  if (!r->ok || (size_t)(r->end - r->at) < n) {
+    r->ok = false;
+    return NULL;
+  }
+  const unsigned char *bytes = r->at;
+  r->at += n;
+  return bytes;
+}
+
+static uint64_t get_u64(Reader *r) {
+  const unsigned char *b = take(r, 8);
+  uint64_t v = 0;
+  for (int i = 0; b && i < 8; i++) {
+    v |= (uint64_t)b[i] << (8 * i);
+  }
+  return v;
+}
+
+static uint32_t get_u32(Reader *r) {
+  const unsigned char *b = take(r, 4);
+  uint32_t v = 0;
+  for (int i = 0; b && i < 4; i++) {
+    v |= (uint32_t)b[i] << (8 * i);
+  }
+  return v;
+}
+
+static unsigned get_u8(Reader *r) {
+  const unsigned char *b = take(r, 1);
+  return b ? *b : 0;
+}
+
+static int get_i32(Reader *r) { return (int32_t)get_u32(r); }
+static long get_i64(Reader *r) { return (long)(int64_t)get_u64(r); }
+
+static double get_f64(Reader *r) {
+  uint64_t bits = get_u64(r);
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+// A count of elements at least `element_size` bytes each, checked
+// against what's left so a bad one can't ask for a huge allocation.
+static int get_count(Reader *r, size_t element_size, int max) {
+  int n = get_i32(r);
+  if (n < 0 || n > max || (size_t)n * element_size > (size_t)(r->end - r->at))
+    r->ok = false;
+  return r->ok ? n : 0;
+}
+
+static Vector get_vector(Reader *r) {
+  Vector v;
+  v.x = get_i32(r);
+  v.y = get_i32(r);
+  return v;
+}
+
+static ObjectReference get_object(Reader *r) {
+  ObjectReference o;
+  o.object_type = get_i32(r);
+  o.id = get_i32(r);
+  return o;
+}
+
+static Rng get_rng(Reader *r) {
+  Rng rng;
+  for (int i = 0; i < 4; i++) {
+    rng.s[i] = get_u64(r);
+  }
+  return rng;
+}
+
+static Inventory get_inventory(Reader *r) {
+  Inventory inv = {0};
+  inv.present = get_u32(r);
+  for (int p = 0; p < PM_COUNT; p++) {
+    inv.count[p] = get_i32(r);
+  }
+  return inv;
+}
+
+static Distribution get_dist(Reader *r) {
+  Distribution d = {0};
+  d.kind = get_i32(r);
+  d.a = get_f64(r);
+  d.b = get_f64(r);
+  d.c = get_f64(r);
+  d.min = get_i32(r);
+  d.n = get_count(r, 0, DIST_MAX_TICKS + 1);
+  if (d.n > 1 && (size_t)d.n * 12 > (size_t)(r->end - r->at))
+    r->ok = false;
+  if (r->ok && d.n > 1) {
+    d.threshold = malloc(d.n * sizeof(*d.threshold));
+    d.alias = malloc(d.n * sizeof(*d.alias));
+    if (!d.threshold || !d.alias) {
+      printf("ERROR: Couldn't allocate distribution of %d outcomes\n", d.n);
+      exit(1);
+    }
+    for (int i = 0; i < d.n; i++) {
+      d.threshold[i] = get_u64(r);
+    }
+    for (int i = 0; i < d.n; i++) {
+      d.alias[i] = get_i32(r);
+    }
+  }
+  return d;
+}
+
+static const Recipe *get_recipe_pointer(Reader *r, const GameState *gs) {
+  int i = get_i32(r);
+  if (i < -1 || i >= RECIPE_COUNT) {
+    r->ok = false;
+    return NULL;
+  }
+  return i == -1 ? NULL : &gs->recipes[i];
+}
+
+static void get_recipe(Reader *r, Recipe *recipe) {
+  recipe->name = get_i32(r);
+  recipe->c_inputs = get_count(r, 8, 10);
+  for (int i = 0; i < recipe->c_inputs; i++) {
+    recipe->inputs[i] = get_i32(r);
+    recipe->inputs_count[i] = get_i32(r);
+  }
+  recipe->c_outputs = get_count(r, 8, 10);
+  for (int i = 0; i < recipe->c_outputs; i++) {
+    recipe->outputs[i] = get_i32(r);
+    recipe->outputs_count[i] = get_i32(r);
+    recipe->defects[i] = get_dist(r);
+  }
+  recipe->time = get_dist(r);
+  recipe->setup = get_dist(r);
+  recipe->teardown = get_dist(r);
+  recipe->defect_rate = get_f64(r);
+  recipe->needs = get_inventory(r);
+}
+
+static void get_stockpile(Reader *r, Stockpile *s) {
+  s->id = get_i32(r);
+  s->location = get_vector(r);
+  s->size = get_vector(r);
+  s->can_be_taken_from = get_u8(r);
+  s->attached_machine = get_i32(r);
+  s->io = get_i32(r);
+  s->contents = get_inventory(r);
+  s->hot->required_material = get_inventory(r);
+  s->supplying = get_u32(r);
+  for (int p = 0; p < PM_COUNT; p++) {
+    s->earmarked[p] = get_i32(r);
+    s->replenishment_outstanding[p] = get_i32(r);
+    s->supply_next[p] = get_i32(r);
+    s->supply_prev[p] = get_i32(r);
+  }
+}
+
+static void get_machine(Reader *r, GameState *gs, int slot) {
+  Machine *m = new_machine(gs, slot);
+  m->id = get_i32(r);
+  m->type = get_i32(r);
+  m->has_current_work_order = get_u8(r);
+  m->hot->working = get_u8(r);
+  m->hot->job_time_left = get_i32(r);
+  m->worker = get_i32(r);
+  m->location = get_vector(r);
+  m->size = get_vector(r);
+  m->active_recipe = get_recipe_pointer(r, gs);
+  m->output_stockpile = get_i32(r);
+  m->input_stockpile = get_i32(r);
+  m->input_buffer = get_inventory(r);
+  m->output_buffer = get_inventory(r);
+  set_machine_rng(gs, slot, get_rng(r));
+  m->set_up_for = get_recipe_pointer(r, gs);
+  m->breakdown_chance = get_f64(r);
+  m->repair_time = get_dist(r);
+  m->breakdowns = get_i32(r);
+}
+
+static void get_worker(Reader *r, Worker *w) {
+  w->id = get_i32(r);
+  w->hot->status = get_i32(r);
+  w->hot->location = get_vector(r);
+  w->hot->target = get_vector(r);
+  w->target_material = get_i32(r);
+  w->target_count = get_i32(r);
+  w->hot->job = get_i32(r);
+  w->job_id = get_i32(r);
+  w->job_target = get_object(r);
+  w->job_target_secondary = get_object(r);
+  w->carrying = get_i32(r);
+  w->carrying_count = get_i32(r);
+  w->next_on_tile = -1;
+  w->idle_slot = get_i32(r);
+  w->route = get_i32(r);
+
+  int length = get_count(r, 8, INT32_MAX);
+  if (length > 0) {
+    w->path.steps = malloc(length * sizeof(Vector));
+    if (!w->path.steps) {
+      printf("ERROR: Couldn't allocate path of %d steps\n", length);
+      exit(1);
+    }
+    w->path.length = length;
+    w->path.capacity = length;
+    for (int i = 0; i < length; i++) {
+      w->path.steps[i] = get_vector(r);
+    }
+  }
+  w->path_step = get_i32(r);
+  w->path_start = get_vector(r);
+  w->path_target = get_vector(r);
+  w->path_version = get_i64(r);
+  w->rng = get_rng(r);
+}
+
+static bool fits(Vector location, Vector size, int width, int height) {
+  return location.x >= 0 && location.y >= 0 && size.x > 0 && size.y > 0 &&
+         (long)location.x + size.x <= width &&
+         (long)location.y + size.y <= height;
+}
+
+// The grid saved covers everything placed, so anything outside it is
+// damage, and would have grid_ensure() grow the grid out to meet it.
+static bool objects_fit(const GameState *gs, int width, int height) {
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    const Stockpile *s = get_stockpile_by_id(gs, i);
+    if (!fits(s->location, s->size, width, height))
+      return false;
+  }
+  for (int i = 0; i < gs->c_machines; i++) {
+    const Machine *m = get_machine_by_id(gs, i);
+    if (!fits(m->location, m->size, width, height))
+      return false;
+  }
+  return true;
+}
+
+static void get_game(Reader *r, GameState *gs) {
+  gs->turn = get_i64(r);
+  gs->seed = get_u64(r);
+  gs->layout_version = get_i64(r);
+  for (int p = 0; p < PM_COUNT; p++) {
+    gs->produced[p] = get_i64(r);
+    gs->scrapped[p] = get_i64(r);
+  }
+  gs->cursor = get_vector(r);
+  gs->message_head = get_i32(r);
+  if (gs->message_head < 0 || gs->message_head >= MESSAGE_BUFFER_SIZE) {
+    gs->message_head = 0;
+    r->ok = false;
+  }
+  for (int i = 0; i < MESSAGE_BUFFER_SIZE; i++) {
+    int length = get_count(r, 1, MESSAGE_MAX_SIZE - 1);
+    const unsigned char *m = take(r, length);
+    if (m)
+      memcpy(gs->message_buffer[i], m, length);
+    gs->message_buffer[i][length] = '\0';
+  }
+
+  // new_game() compiled the stock recipes, which these replace.
+  for (int i = 0; i < RECIPE_COUNT; i++) {
+    Recipe *recipe = &gs->recipes[i];
+    dist_free(&recipe->time);
+    dist_free(&recipe->setup);
+    dist_free(&recipe->teardown);
+    for (int j = 0; j < recipe->c_outputs; j++) {
+      dist_free(&recipe->defects[j]);
+    }
+    *recipe = (Recipe){0};
+    get_recipe(r, recipe);
+  }
+
+  int n = get_count(r, 1, INT32_MAX);
+  for (; gs->c_stockpile < n; gs->c_stockpile++) {
+    get_stockpile(r, new_stockpile(gs, gs->c_stockpile));
+  }
+
+  n = get_count(r, 1, INT32_MAX);
+  for (; gs->c_machines < n; gs->c_machines++) {
+    get_machine(r, gs, gs->c_machines);
+  }
+
+  n = get_count(r, 1, INT32_MAX);
+  for (; gs->c_workers < n; gs->c_workers++) {
+    get_worker(r, new_worker(gs, gs->c_workers));
+  }
+
+  n = get_count(r, 4, gs->c_workers);
+  gs->idle_workers =
+      grow_array(gs->idle_workers, &gs->cap_idle, n, sizeof(int));
+  for (; gs->c_idle < n; gs->c_idle++) {
+    gs->idle_workers[gs->c_idle] = get_i32(r);
+  }
+
+  int width = get_i32(r);
+  int height = get_i32(r);
+  if (width < 0 || height < 0 || (long)width * height > 8L * (r->end - r->at) ||
+      !objects_fit(gs, width, height)) {
+    r->ok = false;
+    return;
+  }
+  if (width > 0 && height > 0) {
+    grid_ensure(gs, width, height);
+    if (gs->grid.width != width || gs->grid.height != height) {
+      r->ok = false;
+      return;
+    }
+  }
+  int tiles = width * height;
+  for (int i = 0; i < tiles; i += 8) {
+    unsigned bits = get_u8(r);
+    for (int j = 0; j < 8 && i + j < tiles; j++) {
+      if (bits & (1u << j))
+        gs->grid.blocked[i + j] |= TILE_WALL;
+    }
+  }
+
+  n = get_count(r, 20, INT32_MAX);
+  gs->job_queue = grow_array(gs->job_queue, &gs->cap_job_queue, n,
+                             sizeof(struct JobQueueItem));
+  for (; gs->c_job_queue < n; gs->c_job_queue++) {
+    struct JobQueueItem *jq = &gs->job_queue[gs->c_job_queue];
+    jq->object = get_object(r);
+    jq->job = get_i32(r);
+    jq->sequence = get_i64(r);
+  }
+  gs->job_sequence = get_i64(r);
+
+  n = get_count(r, 28, INT32_MAX);
+  gs->replenishment_orders =
+      grow_array(gs->replenishment_orders, &gs->cap_replenishment_orders, n,
+                 sizeof(struct ReplenishmentOrder));
+  for (; gs->c_replenishment_orders < n; gs->c_replenishment_orders++) {
+    struct ReplenishmentOrder *ro =
+        &gs->replenishment_orders[gs->c_replenishment_orders];
+    ro->ordering_stockpile = get_i32(r);
+    ro->material = get_i32(r);
+    ro->amount_ordered = get_i32(r);
+    ro->amount_picked_up = get_i32(r);
+    ro->sequence = get_i64(r);
+    ro->next = get_i32(r);
+  }
+  gs->free_replenishment_orders = get_i32(r);
+  gs->replenishment_sequence = get_i64(r);
+  for (int p = 0; p < PM_COUNT; p++) {
+    struct OpenOrders *open = &gs->open_replenishment_orders[p];
+    open->head = get_i32(r);
+    open->tail = get_i32(r);
+    open->count = get_i32(r);
+    gs->supply[p].head = get_i32(r);
+    gs->supply[p].count = get_i32(r);
+  }
+}
+
+// The hash catches damage, not a snapshot that was well formed but
+// wrong, so anything used as an index is checked before the game runs:
+// ids, materials, enums, path places and alias tables. Counts aren't
+// checked against each other, so a snapshot that's wrong about those
+// can still stop the game with one of its own errors, but can't have
+// it read or write out of bounds.
+static bool in_range(int i, int n) { return i >= -1 && i < n; }
+
+static bool on_floor(const GameState *gs, Vector v) {
+  return v.x >= 0 && v.y >= 0 && v.x < gs->grid.width &&
+         v.y < gs->grid.height;
+}
+
+static bool object_ok(const GameState *gs, ObjectReference o) {
+  switch (o.object_type) {
+  case O_MACHINE:
+    return in_range(o.id, gs->c_machines) && o.id != -1;
+  case O_WORKER:
+    return in_range(o.id, gs->c_workers) && o.id != -1;
+  case O_STOCKPILE:
+    return in_range(o.id, gs->c_stockpile) && o.id != -1;
+  case O_NOTHING:
+  case O_WALL:
+    return true;
+  }
+  return false;
+}
+
+// A flow route is only ever built to an object's tile. An idle worker
+// keeps its last route, but won't follow it until given a new target.
+static bool route_ok(const GameState *gs, const Worker *w) {
+  if (w->route != ROUTE_FLOW || w->hot->status == W_IDLE)
+    return true;
+  int i = w->hot->target.y * gs->grid.width + w->hot->target.x;
+  return gs->grid.statics[i].object_type != O_NOTHING;
+}
+
+static bool material_ok(ProductionMaterial p) {
+  return (unsigned)p < PM_COUNT;
+}
+
+static bool inventory_ok(const Inventory *inv) {
+  return (inv->present >> PM_COUNT) == 0;
+}
+
+// Sampling indexes the alias table with whatever it holds.
+static bool dist_ok(const Distribution *d) {
+  for (int i = 0; d->n > 1 && i < d->n; i++) {
+    if (d->alias[i] < 0 || d->alias[i] >= d->n)
+      return false;
+  }
+  return true;
+}
+
+static bool recipe_ok(const Recipe *recipe, int i) {
+  if ((int)recipe->name != i || recipe->c_inputs > 10 ||
+      recipe->c_outputs > 10 || !dist_ok(&recipe->time) ||
+      !dist_ok(&recipe->setup) || !dist_ok(&recipe->teardown) ||
+      !inventory_ok(&recipe->needs))
+    return false;
+  for (int j = 0; j < recipe->c_inputs; j++) {
+    if (!material_ok(recipe->inputs[j]))
+      return false;
+  }
+  for (int j = 0; j < recipe->c_outputs; j++) {
+    if (!material_ok(recipe->outputs[j]) || !dist_ok(&recipe->defects[j]))
+      return false;
+  }
+  return true;
+}
+
+static bool references_ok(const GameState *gs) {
+  for (int i = 0; i < RECIPE_COUNT; i++) {
+    if (!recipe_ok(&gs->recipes[i], i))
+      return false;
+  }
+  for (int i = 0; i < gs->c_stockpile; i++) {
+    const Stockpile *s = get_stockpile_by_id(gs, i);
+    if (s->id != i || !in_range(s->attached_machine, gs->c_machines) ||
+        !in_range(s->io, OUTPUT + 1) ||
+        !inventory_ok(&s->contents) ||
+        !inventory_ok(&s->hot->required_material))
+      return false;
+    for (int p = 0; p < PM_COUNT; p++) {
+      if (!in_range(s->supply_next[p], gs->c_stockpile) ||
+          !in_range(s->supply_prev[p], gs->c_stockpile))
+        return false;
+    }
+  }
+  for (int i = 0; i < gs->c_machines; i++) {
+    const Machine *m = get_machine_by_id(gs, i);
+    if (m->id != i || (unsigned)m->type >= COUNT_MACHINE_TYPES ||
+        !in_range(m->worker, gs->c_workers) ||
+        !in_range(m->input_stockpile, gs->c_stockpile) ||
+        !in_range(m->output_stockpile, gs->c_stockpile) ||
+        !inventory_ok(&m->input_buffer) || !inventory_ok(&m->output_buffer) ||
+        !dist_ok(&m->repair_time))
+      return false;
+    // Only a manned machine with a work order counts down.
+    if (m->hot->working && (!m->has_current_work_order || m->worker == -1))
+      return false;
+  }
+  for (int i = 0; i < gs->c_workers; i++) {
+    const Worker *w = get_worker_by_id(gs, i);
+    if (w->id != i || !on_floor(gs, w->hot->location) ||
+        !on_floor(gs, w->hot->target) ||
+        !in_range(w->idle_slot, gs->c_idle) ||
+        !object_ok(gs, w->job_target) ||
+        !object_ok(gs, w->job_target_secondary) ||
+        (unsigned)w->hot->status > W_PRODUCING ||
+        (unsigned)w->route > ROUTE_DIRECT ||
+        (unsigned)w->hot->job > JOB_REPLENISH_STOCKPILE ||
+        !in_range(w->carrying, PM_COUNT) || !material_ok(w->target_material) ||
+        w->path_step < 0 || w->path_step > w->path.length ||
+        !route_ok(gs, w))
+      return false;
+    if (w->hot->job == JOB_REPLENISH_STOCKPILE &&
+        (!in_range(w->job_id, gs->c_replenishment_orders) || w->job_id == -1))
+      return false;
+    for (int j = 0; j < w->path.length; j++) {
+      if (!on_floor(gs, w->path.steps[j]))
+        return false;
+    }
+  }
+  // The idle set is exactly the idle workers, each in its own slot,
+  // since the grid's idle lists are built from it.
+  for (int i = 0; i < gs->c_idle; i++) {
+    if (!in_range(gs->idle_workers[i], gs->c_workers) ||
+        gs->idle_workers[i] == -1 ||
+        get_worker_by_id(gs, gs->idle_workers[i])->idle_slot != i)
+      return false;
+  }
+  for (int i = 0; i < gs->c_workers; i++) {
+    const Worker *w = get_worker_by_id(gs, i);
+    if ((w->hot->status == W_IDLE) != (w->idle_slot != -1))
+      return false;
+  }
+  for (int i = 0; i < gs->c_job_queue; i++) {
+    if (!object_ok(gs, gs->job_queue[i].object))
+      return false;
+  }
+  for (int i = 0; i < gs->c_replenishment_orders; i++) {
+    const struct ReplenishmentOrder *ro = &gs->replenishment_orders[i];
+    if (!in_range(ro->ordering_stockpile, gs->c_stockpile) ||
+        (unsigned)ro->material >= PM_COUNT ||
+        !in_range(ro->next, gs->c_replenishment_orders))
+      return false;
+  }
+  // Free orders are the ones marked NONE; a chain longer than the array
+  // has a cycle in it and would hand out the same order twice.
+  int free_id = gs->free_replenishment_orders;
+  for (int n = 0; free_id != -1; n++) {
+    if (n == gs->c_replenishment_orders ||
+        !in_range(free_id, gs->c_replenishment_orders) ||
+        gs->replenishment_orders[free_id].material != NONE)
+      return false;
+    free_id = gs->replenishment_orders[free_id].next;
+  }
+  // An empty list's head and tail are whatever they were last, which in
+  // a game that has never used it is 0, so they're only checked in use.
+  for (int p = 0; p < PM_COUNT; p++) {
+    const struct OpenOrders *open = &gs->open_replenishment_orders[p];
+    if (open->count > 0 &&
+        (!in_range(open->tail, gs->c_replenishment_orders) ||
+         open->tail == -1))
+      return false;
+    // Walk the queue as far as its count says: every link has to land on
+    // an order of this material and the last one has to be the tail, or
+    // picking up would run the head off the end of the chain.
+    if (open->count < 0 || open->count > gs->c_replenishment_orders)
+      return false;
+    int id = open->head;
+    for (int n = 0; n < open->count; n++) {
+      if (!in_range(id, gs->c_replenishment_orders) || id == -1 ||
+          gs->replenishment_orders[id].material != (ProductionMaterial)p)
+        return false;
+      if (n == open->count - 1 &&
+          (id != open->tail || gs->replenishment_orders[id].next != -1))
+        return false;
+      id = gs->replenishment_orders[id].next;
+    }
+    if (gs->supply[p].count > 0 &&
+        (!in_range(gs->supply[p].head, gs->c_stockpile) ||
+         gs->supply[p].head == -1))
+      return false;
+  }
+  return true;
+}
+
+/* -------------
+ * MAPPING
+ *
+ * The file is mapped rather than read where that's possible, so a big
+ * snapshot is paged straight into the decoder without a copy.
+ * ------------- */
+
+#ifdef _WIN32
+
+static unsigned char *map_file(const char *path, size_t *size) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+
+  unsigned char *data = NULL;
+  if (fseek(f, 0, SEEK_END) == 0) {
+    long length = ftell(f);
+    if (length > 0 && fseek(f, 0, SEEK_SET) == 0) {
+      data = malloc(length);
+      if (data && fread(data, 1, length, f) != (size_t)length) {
+        free(data);
+        data = NULL;
+      }
+      *size = length;
+    }
+  }
+  fclose(f);
+  return data;
+}
+
+static void unmap_file(unsigned char *data, size_t size) {
+  (void)size;
+  free(data);
+}
+
+#else
+
+static unsigned char *map_file(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    *size = st.st_size;
+    data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  posix_madvise(data, *size, POSIX_MADV_SEQUENTIAL);
+  return data;
+}
+
+static void unmap_file(unsigned char *data, size_t size) {
+  munmap(data, size);
+}
+
+#endif
+
+static bool check_header(Reader *r, const char *path) {
+  const unsigned char *magic = take(r, sizeof(snapshot_magic));
+  if (!magic || memcmp(magic, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+    printf("ERROR: %s isn't a snapshot\n", path);
+    return false;
+  }
+
+  uint32_t version = get_u32(r);
+  uint32_t materials = get_u32(r);
+  uint32_t recipes = get_u32(r);
+  get_u32(r);
+  uint64_t body_size = get_u64(r);
+  uint64_t hash = get_u64(r);
+
+  if (version != SNAPSHOT_VERSION) {
+    printf("ERROR: %s is snapshot version %u, expected %u\n", path, version,
+           SNAPSHOT_VERSION);
+    return false;
+  }
+  if (materials != PM_COUNT || recipes != RECIPE_COUNT) {
+    printf("ERROR: %s was saved with %u materials and %u recipes, not %d "
+           "and %d\n",
+           path, materials, recipes, PM_COUNT, RECIPE_COUNT);
+    return false;
+  }
+  if (!r->ok || body_size != (uint64_t)(r->end - r->at) ||
+      fnv1a(r->at, body_size) != hash) {
+    printf("ERROR: %s is truncated or damaged\n", path);
+    return false;
+  }
+  return true;
+}
+
+GameState *load_snapshot(const char *path) {
+  size_t size = 0;
+  unsigned char *data = map_file(path, &size);
+  if (!data) {
+    printf("ERROR: Couldn't read snapshot %s\n", path);
+    return NULL;
+  }
+
+  Reader r = {data, data + size, true};
+  GameState *gs = NULL;
+  if (check_header(&r, path)) {
+    gs = new_game();
+    get_game(&r, gs);
+    if (!r.ok || r.at != r.end || !references_ok(gs)) {
+      printf("ERROR: %s doesn't match its header\n", path);
+      free_game(gs);
+      gs = NULL;
+    }
+  }
+
+  unmap_file(data, size);
+  return gs;
+}
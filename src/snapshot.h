@@ -0,0 +1,21 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "game.h"
+
+// Bumped whenever the layout below the header changes. Older snapshots
+// are refused rather than misread.
+#define SNAPSHOT_VERSION 1
+
+// Writes everything needed to carry on a run exactly where it left off:
+// entities, the job queue, the replenishment order book, every random
+// stream and the recipes as varied. Returns false, with a message, if
+// the file can't be written.
+bool save_snapshot(const GameState *gs, const char *path);
+
+// A new game carrying on from a snapshot, or NULL, with a message, if
+// the file can't be read or wasn't written by this version. Caches
+// (the tile grid and flow fields) are rebuilt rather than stored.
+GameState *load_snapshot(const char *path);
+
+#endif
@@ -0,0 +1,154 @@
+#include "stats.h"
+#include <math.h>
+
+/* -------------
+ * MEAN AND VARIANCE
+ * ------------- */
+
+void stats_add(RunningStats *s, double x) {
+  s->n++;
+  double delta = x - s->mean;
+  s->mean += delta / s->n;
+  s->m2 += delta * (x - s->mean);
+}
+
+double stats_variance(const RunningStats *s) {
+  return (s->n > 1) ? s->m2 / (s->n - 1) : 0;
+}
+
+// Two-sided 95% critical values of Student's t for 1 to 30 degrees of
+// freedom. Past that the normal value is close enough.
+static const double t95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+double stats_ci95(const RunningStats *s) {
+  if (s->n < 2)
+    return 0;
+  long df = s->n - 1;
+  double t = (df <= 30) ? t95[df - 1] : 1.960;
+  return t * sqrt(stats_variance(s) / s->n);
+}
+
+/* -------------
+ * QUANTILES
+ * ------------- */
+
+Quantile quantile_new(double p) { return (Quantile){.p = p}; }
+
+static double parabolic(const Quantile *q, int i, int d) {
+  const double *h = q->height, *n = q->pos;
+  return h[i] + d / (n[i + 1] - n[i - 1]) *
+                    ((n[i] - n[i - 1] + d) * (h[i + 1] - h[i]) /
+                         (n[i + 1] - n[i]) +
+                     (n[i + 1] - n[i] - d) * (h[i] - h[i - 1]) /
+                         (n[i] - n[i - 1]));
+}
+
+static double linear(const Quantile *q, int i, int d) {
+  return q->height[i] +
+         d * (q->height[i + d] - q->height[i]) / (q->pos[i + d] - q->pos[i]);
+}
+
+// Places the markers on the kept values at the ranks P-square would
+// have moved them to by now.
+static void start_markers(Quantile *q) {
+  double p = q->p;
+  int n = q->n;
+
+  q->want[0] = 1;
+  q->want[1] = 1 + (n - 1) * p / 2;
+  q->want[2] = 1 + (n - 1) * p;
+  q->want[3] = 1 + (n - 1) * (1 + p) / 2;
+  q->want[4] = n;
+  q->step[0] = 0;
+  q->step[1] = p / 2;
+  q->step[2] = p;
+  q->step[3] = (1 + p) / 2;
+  q->step[4] = 1;
+
+  for (int i = 0; i < 5; i++) {
+    int rank = (int)(q->want[i] + 0.5);
+    q->pos[i] = rank;
+    q->height[i] = q->exact[rank - 1];
+  }
+}
+
+void quantile_add(Quantile *q, double x) {
+  if (q->n < QUANTILE_EXACT) {
+    int i = q->n++;
+    while (i > 0 && q->exact[i - 1] > x) {
+      q->exact[i] = q->exact[i - 1];
+      i--;
+    }
+    q->exact[i] = x;
+    return;
+  }
+  if (q->n == QUANTILE_EXACT)
+    start_markers(q);
+  q->n++;
+
+  int k;
+  if (x < q->height[0]) {
+    q->height[0] = x;
+    k = 0;
+  } else if (x >= q->height[4]) {
+    q->height[4] = x;
+    k = 3;
+  } else {
+    k = 0;
+    while (x >= q->height[k + 1]) {
+      k++;
+    }
+  }
+
+  for (int i = k + 1; i < 5; i++) {
+    q->pos[i]++;
+  }
+  for (int i = 0; i < 5; i++) {
+    q->want[i] += q->step[i];
+  }
+
+  for (int i = 1; i < 4; i++) {
+    double off = q->want[i] - q->pos[i];
+    if ((off >= 1 && q->pos[i + 1] - q->pos[i] > 1) ||
+        (off <= -1 && q->pos[i - 1] - q->pos[i] < -1)) {
+      int d = (off > 0) ? 1 : -1;
+      double h = parabolic(q, i, d);
+      if (q->height[i - 1] < h && h < q->height[i + 1])
+        q->height[i] = h;
+      else
+        q->height[i] = linear(q, i, d);
+      q->pos[i] += d;
+    }
+  }
+}
+
+double quantile_value(const Quantile *q) {
+  if (q->n == 0)
+    return 0;
+  if (q->n > QUANTILE_EXACT)
+    return q->height[2];
+
+  // Interpolate between the kept values.
+  double rank = q->p * (q->n - 1);
+  int below = (int)rank;
+  if (below >= q->n - 1)
+    return q->exact[q->n - 1];
+  double frac = rank - below;
+  return q->exact[below] + frac * (q->exact[below + 1] - q->exact[below]);
+}
+
+/* -------------
+ * TIME AVERAGES
+ * ------------- */
+
+void time_average_add(TimeAverage *t, double value, long ticks) {
+  t->area += value * ticks;
+  t->ticks += ticks;
+}
+
+double time_average_value(const TimeAverage *t) {
+  return (t->ticks > 0) ? t->area / t->ticks : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Streaming summaries for comparing runs, each updated one value at a
+// time in constant space.
+
+// Mean and variance by Welford's method, which doesn't lose precision
+// the way summing squares does.
+typedef struct RunningStats {
+  long n;
+  double mean;
+  double m2;
+} RunningStats;
+
+void stats_add(RunningStats *s, double x);
+double stats_variance(const RunningStats *s);
+// Half width of the 95% confidence interval for the mean, using
+// Student's t since ensembles are often only a handful of runs.
+double stats_ci95(const RunningStats *s);
+
+// One quantile, estimated with the P-square algorithm (Jain and
+// Chlamtac): five markers whose heights are nudged towards the quantile
+// as values arrive. The first QUANTILE_EXACT values are kept, so small
+// ensembles get exact answers, and the markers start from them.
+#define QUANTILE_EXACT 32
+
+typedef struct Quantile {
+  double p;
+  int n;
+  double exact[QUANTILE_EXACT];
+  double height[5];
+  double pos[5];
+  double want[5];
+  double step[5];
+} Quantile;
+
+Quantile quantile_new(double p);
+void quantile_add(Quantile *q, double x);
+double quantile_value(const Quantile *q);
+
+// The average of a value over time, each value counting for the number
+// of ticks it held.
+typedef struct TimeAverage {
+  double area;
+  long ticks;
+} TimeAverage;
+
+void time_average_add(TimeAverage *t, double value, long ticks);
+double time_average_value(const TimeAverage *t);
+
+#endif
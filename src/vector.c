@@ -39,14 +39,40 @@ Vector vec_move_towards(Vector current, Vector target) {
     return vec_move(current, UP);
 }
 
-int rand_between(int lower, int upper) {
-  return (rand() % (upper - lower + 1)) + lower;
-}
-
-Vector vec_move_random(Vector current, int die_size) {
-  int roll = rand_between(0, die_size);
+Vector vec_move_random(Rng *rng, Vector current, int die_size) {
+  int roll = rng_between(rng, 0, die_size);
   if (roll < 3)
     return vec_move(current, roll);
   else
     return current;
 }
+
+// Where `vec_move_towards` ends up after `steps` moves, without taking
+// them one at a time. The greedy walk first closes the gap on the
+// longer axis until both are equal, then alternates, x first.
+Vector vec_move_towards_n(Vector current, Vector target, int steps) {
+  int dx = target.x - current.x;
+  int dy = target.y - current.y;
+  int ax = abs(dx);
+  int ay = abs(dy);
+
+  if (steps >= ax + ay)
+    return target;
+
+  int x_steps = 0;
+  int y_steps = 0;
+  int lead = (ax > ay) ? ax - ay : ay - ax;
+  int first = (steps < lead) ? steps : lead;
+
+  if (ax >= ay)
+    x_steps += first;
+  else
+    y_steps += first;
+
+  int rest = steps - first;
+  x_steps += (rest + 1) / 2;
+  y_steps += rest / 2;
+
+  return (Vector){current.x + ((dx > 0) ? x_steps : -x_steps),
+                  current.y + ((dy > 0) ? y_steps : -y_steps)};
+}
@@ -1,3 +1,7 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "rng.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,4 +16,7 @@ typedef enum { UP, DOWN, LEFT, RIGHT } Direction;
 
 bool vec_equal(Vector a, Vector b);
 Vector vec_move_towards(Vector current, Vector target);
-Vector vec_move_random(Vector current, int die_size);
+Vector vec_move_towards_n(Vector current, Vector target, int steps);
+Vector vec_move_random(Rng *rng, Vector current, int die_size);
+
+#endif